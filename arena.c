@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+
+// Payloads start this far after their block, keeping them as aligned as malloc would
+#define ARENA_HEADER_BYTES ((sizeof(arena_block_t) + 15) / 16 * 16)
+// Slabs start with a link to the next slab, padded the same way
+#define ARENA_SLAB_HEADER_BYTES 16
+
+static arena_block_t* block_of(void* payload)
+{
+    return (arena_block_t*)((char*)payload - ARENA_HEADER_BYTES);
+}
+
+// Pushes the chain head..tail onto the owner's return stack
+static void push_returned(arena_cache_t* owner, arena_block_t* head, arena_block_t* tail)
+{
+    arena_block_t* top = atomic_load_explicit(&owner->returned, memory_order_relaxed);
+    do {
+        tail->next = top;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->returned, &top, head, memory_order_release, memory_order_relaxed));
+}
+
+// Sends the cache's pending chain to its owner
+static void flush_pending(arena_cache_t* cache)
+{
+    if (cache->pending == NULL) {
+        return;
+    }
+    push_returned(cache->pending_owner, cache->pending, cache->pending_tail);
+    cache->pending = NULL;
+    cache->pending_tail = NULL;
+    cache->pending_owner = NULL;
+    cache->pending_count = 0;
+}
+
+// Flushes an exiting thread's batch and leaves its cache, with the blocks still out, for another thread to adopt
+static void cache_exit(void* arg)
+{
+    arena_cache_t* cache = arg;
+    flush_pending(cache);
+    pthread_mutex_lock(&cache->arena->mutex);
+    cache->exited = true;
+    pthread_mutex_unlock(&cache->arena->mutex);
+}
+
+// Returns the calling thread's cache, adopting one left by an exited thread or creating one on first use
+static arena_cache_t* get_cache(arena_t* arena)
+{
+    arena_cache_t* cache = pthread_getspecific(arena->key);
+    if (cache != NULL) {
+        return cache;
+    }
+    pthread_mutex_lock(&arena->mutex);
+    // prefer a cache with blocks to hand out, so that they are not stranded
+    for (arena_cache_t* exited = arena->caches; exited != NULL; exited = exited->next) {
+        if (exited->exited && (cache == NULL || exited->free != NULL || atomic_load(&exited->returned) != NULL)) {
+            cache = exited;
+            if (cache->free != NULL || atomic_load(&cache->returned) != NULL) {
+                break;
+            }
+        }
+    }
+    if (cache != NULL) {
+        cache->exited = false;
+    } else {
+        cache = malloc(sizeof(arena_cache_t));
+        assert(cache != NULL);
+        cache->arena = arena;
+        cache->free = NULL;
+        atomic_init(&cache->returned, NULL);
+        cache->pending = NULL;
+        cache->pending_tail = NULL;
+        cache->pending_owner = NULL;
+        cache->pending_count = 0;
+        cache->exited = false;
+        cache->next = arena->caches;
+        arena->caches = cache;
+    }
+    pthread_mutex_unlock(&arena->mutex);
+    pthread_setspecific(arena->key, cache);
+    return cache;
+}
+
+// Carves a new slab into the cache's free list
+// Returns false if the slab could not be allocated
+static bool add_slab(arena_t* arena, arena_cache_t* cache)
+{
+    char* slab = malloc(ARENA_SLAB_HEADER_BYTES + arena->stride * arena->blocks_per_slab);
+    if (slab == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < arena->blocks_per_slab; i++) {
+        arena_block_t* block = (arena_block_t*)(slab + ARENA_SLAB_HEADER_BYTES + i * arena->stride);
+        block->owner = cache;
+        atomic_init(&block->refs, 0);
+        block->next = cache->free;
+        cache->free = block;
+    }
+    pthread_mutex_lock(&arena->mutex);
+    *(void**)slab = arena->slabs;
+    arena->slabs = slab;
+    arena->num_slabs++;
+    pthread_mutex_unlock(&arena->mutex);
+    return true;
+}
+
+// Creates an arena handing out payloads of block_size bytes, allocating blocks_per_slab of them at a time
+// Returns NULL if the arena could not be created
+arena_t* arena_create(size_t block_size, size_t blocks_per_slab)
+{
+    if (blocks_per_slab == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    arena_t* arena = malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+    if (pthread_key_create(&arena->key, cache_exit) != 0) {
+        free(arena);
+        return NULL;
+    }
+    arena->block_size = block_size;
+    arena->stride = ARENA_HEADER_BYTES + (block_size + 15) / 16 * 16;
+    arena->blocks_per_slab = blocks_per_slab;
+    pthread_mutex_init(&arena->mutex, NULL);
+    arena->caches = NULL;
+    arena->slabs = NULL;
+    arena->num_slabs = 0;
+    return arena;
+}
+
+// Returns a payload of the arena's block size holding one reference, from the calling thread's slabs
+// Returns NULL if a new slab was needed and could not be allocated
+void* arena_alloc(arena_t* arena)
+{
+    if (arena == NULL) {
+        return NULL; // Taking invalid arguments
+    }
+    arena_cache_t* cache = get_cache(arena);
+    if (cache->free == NULL) {
+        // take everything other threads gave back in one exchange
+        cache->free = atomic_exchange_explicit(&cache->returned, NULL, memory_order_acquire);
+    }
+    if (cache->free == NULL && !add_slab(arena, cache)) {
+        return NULL;
+    }
+    arena_block_t* block = cache->free;
+    cache->free = block->next;
+    atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+    return (char*)block + ARENA_HEADER_BYTES;
+}
+
+// Adds count references to a payload, e.g. before sending the same payload to count more receivers
+void arena_retain(void* payload, size_t count)
+{
+    if (payload == NULL) {
+        return; // Taking invalid arguments
+    }
+    atomic_fetch_add_explicit(&block_of(payload)->refs, count, memory_order_relaxed);
+}
+
+// Drops one reference to a payload; the last one gives the block back to the thread that allocated it
+// From another thread the block is batched with others for the same owner, see arena_flush
+void arena_release(void* payload)
+{
+    if (payload == NULL) {
+        return; // Taking invalid arguments
+    }
+    arena_block_t* block = block_of(payload);
+    if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    arena_cache_t* owner = block->owner;
+    arena_cache_t* cache = get_cache(owner->arena);
+    if (cache == owner) {
+        block->next = cache->free;
+        cache->free = block;
+        return;
+    }
+    if (cache->pending_owner != owner) {
+        // one batch at a time, consumers mostly release blocks of a single producer
+        flush_pending(cache);
+        cache->pending_owner = owner;
+    }
+    block->next = cache->pending;
+    cache->pending = block;
+    if (cache->pending_tail == NULL) {
+        cache->pending_tail = block;
+    }
+    if (++cache->pending_count >= ARENA_RETURN_BATCH) {
+        flush_pending(cache);
+    }
+}
+
+// Gives the calling thread's batch of released blocks back to their owner right away
+// Threads that release blocks should call this when they go idle; exiting threads do it automatically
+void arena_flush(arena_t* arena)
+{
+    if (arena == NULL) {
+        return; // Taking invalid arguments
+    }
+    flush_pending(get_cache(arena));
+}
+
+// Returns the number of slabs the arena allocated so far
+size_t arena_slab_count(arena_t* arena)
+{
+    if (arena == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    pthread_mutex_lock(&arena->mutex);
+    size_t num_slabs = arena->num_slabs;
+    pthread_mutex_unlock(&arena->mutex);
+    return num_slabs;
+}
+
+// Frees every slab of the arena, no payload may still be in use
+void arena_destroy(arena_t* arena)
+{
+    if (arena == NULL) {
+        return; // Taking invalid arguments
+    }
+    // Deleting the key keeps the exit destructor from touching the caches freed here
+    pthread_key_delete(arena->key);
+    while (arena->caches != NULL) {
+        arena_cache_t* next = arena->caches->next;
+        free(arena->caches);
+        arena->caches = next;
+    }
+    while (arena->slabs != NULL) {
+        void* next = *(void**)arena->slabs;
+        free(arena->slabs);
+        arena->slabs = next;
+    }
+    pthread_mutex_destroy(&arena->mutex);
+    free(arena);
+}
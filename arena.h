@@ -0,0 +1,71 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Blocks are returned to their owning thread in chains of this many
+#define ARENA_RETURN_BATCH 32
+
+// Header in front of every payload
+typedef struct arena_block {
+    struct arena_cache* owner; // Thread cache whose slab the block was carved from
+    atomic_size_t refs; // References to the payload, the block is returned once they reach 0
+    struct arena_block* next; // Link in a free list, return chain or pending batch
+} arena_block_t;
+
+// Blocks one thread allocates from, with the queue other threads give its blocks back through
+typedef struct arena_cache {
+    struct arena* arena; // Arena the cache belongs to
+    arena_block_t* free; // Blocks ready to be allocated, only used by the owning thread
+    _Atomic(arena_block_t*) returned; // Lock-free stack of block chains released by other threads
+    arena_block_t* pending; // Chain of released blocks waiting to go back to pending_owner
+    arena_block_t* pending_tail; // Last block of pending
+    struct arena_cache* pending_owner; // Cache the pending chain belongs to
+    size_t pending_count; // Number of blocks in pending
+    bool exited; // Whether the owning thread exited, another thread may adopt the cache then
+    struct arena_cache* next; // Next cache of the arena
+} arena_cache_t;
+
+// Allocator of fixed size, reference counted message payloads from per-thread slabs
+// Releasing a payload on another thread than the one that allocated it queues the block in a batch
+// that goes back to the owner in one atomic push, instead of a remote free per message
+typedef struct arena {
+    size_t block_size; // Payload bytes of every block
+    size_t stride; // Bytes per block including the header
+    size_t blocks_per_slab; // Blocks carved from one slab allocation
+    pthread_key_t key; // The calling thread's arena_cache_t
+    pthread_mutex_t mutex; // Mutex protecting the fields below
+    arena_cache_t* caches; // Caches of every thread that used the arena
+    void* slabs; // Slabs allocated, linked through their first word
+    size_t num_slabs; // Number of slabs allocated
+} arena_t;
+
+// Creates an arena handing out payloads of block_size bytes, allocating blocks_per_slab of them at a time
+// Returns NULL if the arena could not be created
+arena_t* arena_create(size_t block_size, size_t blocks_per_slab);
+
+// Returns a payload of the arena's block size holding one reference, from the calling thread's slabs
+// Returns NULL if a new slab was needed and could not be allocated
+void* arena_alloc(arena_t* arena);
+
+// Adds count references to a payload, e.g. before sending the same payload to count more receivers
+void arena_retain(void* payload, size_t count);
+
+// Drops one reference to a payload; the last one gives the block back to the thread that allocated it
+// From another thread the block is batched with others for the same owner, see arena_flush
+void arena_release(void* payload);
+
+// Gives the calling thread's batch of released blocks back to their owner right away
+// Threads that release blocks should call this when they go idle; exiting threads do it automatically
+void arena_flush(arena_t* arena);
+
+// Returns the number of slabs the arena allocated so far
+size_t arena_slab_count(arena_t* arena);
+
+// Frees every slab of the arena, no payload may still be in use
+void arena_destroy(arena_t* arena);
+
+#endif // ARENA_H
@@ -0,0 +1,744 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "channel.h"
+#include "worker_pool.h"
+#include "stress.h"
+#include "stress_send_recv.h"
+#include "time_nsec.h"
+
+#define MAX_LIST 32
+
+// Comma separated list of numbers or file names given on the command line
+typedef struct {
+    size_t count;
+    const char* items[MAX_LIST];
+} arg_list_t;
+
+// Splits a comma separated argument in place
+void parse_list(char* arg, arg_list_t* list)
+{
+    list->count = 0;
+    for (char* item = strtok(arg, ","); item != NULL && list->count < MAX_LIST; item = strtok(NULL, ",")) {
+        list->items[list->count++] = item;
+    }
+}
+
+size_t list_size_at(const arg_list_t* list, size_t index)
+{
+    return (size_t)strtoull(list->items[index], NULL, 10);
+}
+
+// Converts an encoding name given on the command line
+// Returns false if the name is unknown
+bool parse_encoding(const char* name, enum vector_encoding* encoding)
+{
+    if (strcmp(name, "auto") == 0) {
+        *encoding = VECTOR_AUTO;
+    } else if (strcmp(name, "dense") == 0) {
+        *encoding = VECTOR_DENSE;
+    } else if (strcmp(name, "sparse") == 0) {
+        *encoding = VECTOR_SPARSE;
+    } else if (strcmp(name, "runs") == 0) {
+        *encoding = VECTOR_RUNS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Converts a route mode name given on the command line
+// Returns false if the name is unknown
+bool parse_route_mode(const char* name, enum route_mode* mode)
+{
+    if (strcmp(name, "full") == 0) {
+        *mode = ROUTE_FULL;
+    } else if (strcmp(name, "split") == 0) {
+        *mode = ROUTE_SPLIT_HORIZON;
+    } else if (strcmp(name, "poison") == 0) {
+        *mode = ROUTE_POISON_REVERSE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Converts a routing algorithm name given on the command line
+// Returns false if the name is unknown
+bool parse_algorithm(const char* name, enum stress_algorithm* algorithm)
+{
+    if (strcmp(name, "dv") == 0) {
+        *algorithm = ALGORITHM_DISTANCE_VECTOR;
+    } else if (strcmp(name, "ls") == 0) {
+        *algorithm = ALGORITHM_LINK_STATE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Converts a wake order name given on the command line
+// Returns false if the name is unknown
+bool parse_wake_order(const char* name, enum chan_wake_order* order)
+{
+    if (strcmp(name, "barging") == 0) {
+        *order = CHAN_WAKE_BARGING;
+    } else if (strcmp(name, "fifo") == 0) {
+        *order = CHAN_WAKE_FIFO;
+    } else if (strcmp(name, "lifo") == 0) {
+        *order = CHAN_WAKE_LIFO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void print_usage(const char* program)
+{
+    printf("usage: %s sweep [-b main_sizes] [-s secondary_sizes] [-f topologies] [-e encodings] [-r route_modes] [-a algorithms] [-w worker_counts] [-n thread_counts] [-l load] [-d duration_usec] [-H hops] [-o file.csv]\n", program);
+    printf("  -b  comma separated router channel buffer sizes (default 1,2,4,8,16,64)\n");
+    printf("  -s  comma separated done/completed channel buffer sizes (default 1)\n");
+    printf("  -f  comma separated topology files (default topology.txt,connected_topology.txt,random_topology.txt,random_topology_1.txt,big_graph.txt)\n");
+    printf("  -e  comma separated distance vector encodings: auto, dense, sparse, runs (default auto)\n");
+    printf("  -r  comma separated route modes: full, split, poison (default full)\n");
+    printf("  -a  comma separated routing algorithms: dv, ls (default dv)\n");
+    printf("  -w  comma separated worker thread counts to partition the routers onto, 0 for one thread per router (default 0)\n");
+    printf("  -n  comma separated thread counts for the send/recv ring (default 4,8,16)\n");
+    printf("  -l  send/recv ring load factor (default 0.5)\n");
+    printf("  -d  send/recv ring duration in microseconds (default 200000)\n");
+    printf("  -H  run the send/recv ring for this many hops instead of for a duration (default 0, timed by -d)\n");
+    printf("  -o  CSV output file (default stdout)\n");
+    printf("usage: %s wakeup [-O wake_orders] [-E elimination_slots] [-b buffer_sizes] [-n thread_counts] [-m messages] [-o file.csv]\n", program);
+    printf("  -O  comma separated wake orders: barging, fifo, lifo (default barging,fifo)\n");
+    printf("  -E  comma separated elimination array sizes, 0 for none; barging order only (default 0)\n");
+    printf("  -b  comma separated channel buffer sizes (default 1,16)\n");
+    printf("  -n  comma separated numbers of senders, with as many receivers (default 4,16)\n");
+    printf("  -m  messages per sender (default 20000)\n");
+    printf("  -o  CSV output file (default stdout)\n");
+    printf("usage: %s contention [-M modes] [-E elimination_slots] [-b buffer_sizes] [-n thread_counts] [-m messages] [-o file.csv]\n", program);
+    printf("  -M  comma separated channel modes: mutex, elimination, combining (default mutex,elimination,combining)\n");
+    printf("  -E  elimination array size of the elimination mode (default 4)\n");
+    printf("  -b  comma separated channel buffer sizes (default 64)\n");
+    printf("  -n  comma separated numbers of senders, with as many receivers (default 1,2,4,8,16,32)\n");
+    printf("  -m  messages per sender (default 20000)\n");
+    printf("  -o  CSV output file (default stdout)\n");
+    printf("usage: %s pool [-O wake_orders] [-n worker_counts] [-W working_set_kb] [-k jobs_in_flight] [-m jobs] [-o file.csv]\n", program);
+    printf("  -O  comma separated wake orders of the job channel: barging, fifo, lifo (default barging,fifo,lifo)\n");
+    printf("  -n  comma separated numbers of pool workers (default 4,16)\n");
+    printf("  -W  kilobytes each worker sweeps per job, its private working set (default 512)\n");
+    printf("  -k  jobs kept in flight (default 1)\n");
+    printf("  -m  jobs per run (default 5000)\n");
+    printf("  -o  CSV output file (default stdout)\n");
+}
+
+// Runs run_stress for every topology and buffer size combination and run_stress_send_recv for every buffer size and thread count
+// Writes one CSV row per run
+int run_sweep(int argc, char** argv)
+{
+    char default_sizes[] = "1,2,4,8,16,64";
+    char default_secondary_sizes[] = "1";
+    char default_topologies[] = "topology.txt,connected_topology.txt,random_topology.txt,random_topology_1.txt,big_graph.txt";
+    char default_encodings[] = "auto";
+    char default_route_modes[] = "full";
+    char default_algorithms[] = "dv";
+    char default_workers[] = "0";
+    char default_threads[] = "4,8,16";
+    arg_list_t sizes;
+    arg_list_t secondary_sizes;
+    arg_list_t topologies;
+    arg_list_t encodings;
+    arg_list_t route_modes;
+    arg_list_t algorithms;
+    arg_list_t workers;
+    arg_list_t threads;
+    parse_list(default_sizes, &sizes);
+    parse_list(default_secondary_sizes, &secondary_sizes);
+    parse_list(default_topologies, &topologies);
+    parse_list(default_encodings, &encodings);
+    parse_list(default_route_modes, &route_modes);
+    parse_list(default_algorithms, &algorithms);
+    parse_list(default_workers, &workers);
+    parse_list(default_threads, &threads);
+    double load = 0.5;
+    useconds_t duration_usec = 200000;
+    size_t hop_count = 0;
+    const char* output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:f:e:r:a:w:n:l:d:H:o:")) != -1) {
+        switch (opt) {
+        case 'b':
+            parse_list(optarg, &sizes);
+            break;
+        case 's':
+            parse_list(optarg, &secondary_sizes);
+            break;
+        case 'f':
+            parse_list(optarg, &topologies);
+            break;
+        case 'e':
+            parse_list(optarg, &encodings);
+            break;
+        case 'r':
+            parse_list(optarg, &route_modes);
+            break;
+        case 'a':
+            parse_list(optarg, &algorithms);
+            break;
+        case 'w':
+            parse_list(optarg, &workers);
+            break;
+        case 'n':
+            parse_list(optarg, &threads);
+            break;
+        case 'l':
+            load = atof(optarg);
+            break;
+        case 'd':
+            duration_usec = (useconds_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            hop_count = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* file = stdout;
+    if (output != NULL) {
+        file = fopen(output, "w");
+        if (file == NULL) {
+            printf("Could not open output file: %s\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(file, "workload,topology,algorithm,encoding,route_mode,main_buffer_size,secondary_buffer_size,threads,elapsed_ms,messages,"
+                  "messages_per_sec,bytes,broadcast_rounds,productive_wakeups,spurious_wakeups,peak_channel_depth,flood_ms,compute_ms,"
+                  "edge_cut,local_updates\n");
+    for (size_t t = 0; t < topologies.count; t++) {
+        for (size_t a = 0; a < algorithms.count; a++) {
+            for (size_t e = 0; e < encodings.count; e++) {
+                for (size_t r = 0; r < route_modes.count; r++) {
+                    for (size_t b = 0; b < sizes.count; b++) {
+                        for (size_t s = 0; s < secondary_sizes.count; s++) {
+                            for (size_t w = 0; w < workers.count; w++) {
+                                stress_options_t options;
+                                stress_options_init(&options, list_size_at(&sizes, b), list_size_at(&secondary_sizes, s), topologies.items[t]);
+                                options.num_workers = list_size_at(&workers, w);
+                                if (!parse_algorithm(algorithms.items[a], &options.algorithm)) {
+                                    printf("Unknown algorithm: %s\n", algorithms.items[a]);
+                                    return 1;
+                                }
+                                if (!parse_encoding(encodings.items[e], &options.encoding)) {
+                                    printf("Unknown encoding: %s\n", encodings.items[e]);
+                                    return 1;
+                                }
+                                if (!parse_route_mode(route_modes.items[r], &options.route_mode)) {
+                                    printf("Unknown route mode: %s\n", route_modes.items[r]);
+                                    return 1;
+                                }
+                                stress_report_t report;
+                                run_stress_options(&options, &report);
+                                double elapsed_ms = (double)report.convergence_nsec / 1e6;
+                                fprintf(file, "routing,%s,%s,%s,%s,%zu,%zu,%zu,%.3f,%zu,%.0f,%zu,%zu,%zu,%zu,%zu,%.3f,%.3f,%zu,%zu\n", report.filename,
+                                        algorithms.items[a], encodings.items[e], route_modes.items[r], report.main_buffer_size,
+                                        report.secondary_buffer_size, report.num_threads, elapsed_ms, report.total_messages,
+                                        (double)report.total_messages / (elapsed_ms / 1e3), report.total_bytes,
+                                        report.total_broadcast_rounds, report.productive_wakeups, report.spurious_wakeups,
+                                        report.peak_channel_depth, (double)report.flood_nsec / 1e6, (double)report.compute_nsec / 1e6,
+                                        report.edge_cut, report.total_local_updates);
+                                fflush(file);
+                                stress_report_free(&report);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    for (size_t n = 0; n < threads.count; n++) {
+        for (size_t b = 0; b < sizes.count; b++) {
+            size_t buffer_size = list_size_at(&sizes, b);
+            size_t num_threads = list_size_at(&threads, n);
+            size_t hops = hop_count;
+            double elapsed_ms;
+            if (hop_count > 0) {
+                elapsed_ms = (double)run_stress_send_recv_hops(buffer_size, num_threads, load, hop_count) / 1e6;
+            } else {
+                hops = run_stress_send_recv_count(buffer_size, num_threads, load, duration_usec);
+                elapsed_ms = (double)duration_usec / 1e3;
+            }
+            fprintf(file, "send_recv,,,,,%zu,,%zu,%.3f,%zu,%.0f,,,,,,,,,\n", buffer_size, num_threads, elapsed_ms,
+                    hops, (double)hops / (elapsed_ms / 1e3));
+            fflush(file);
+        }
+    }
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+// One sender or receiver of a wakeup run, timing every blocking call it makes
+typedef struct {
+    chan_t* channel;
+    bool is_send;
+    size_t count; // Calls to make
+    uint64_t* waits; // Duration of every call, count entries
+} wakeup_thread_t;
+
+void* wakeup_thread(void* arg)
+{
+    wakeup_thread_t* thread = arg;
+    for (size_t i = 0; i < thread->count; i++) {
+        uint64_t start = monotonic_nsec();
+        if (thread->is_send) {
+            channel_send(thread->channel, (void*)(i + 1), true);
+        } else {
+            void* data;
+            channel_receive(thread->channel, &data, true);
+        }
+        thread->waits[i] = monotonic_nsec() - start;
+    }
+    return NULL;
+}
+
+// Runs num_senders senders of messages messages each against as many receivers on channel
+// Stores the duration of every call in send_waits and receive_waits, num_senders * messages entries each
+// Returns the elapsed time in milliseconds
+double run_senders_receivers(chan_t* channel, size_t num_senders, size_t messages, uint64_t* send_waits, uint64_t* receive_waits)
+{
+    wakeup_thread_t* args = malloc(sizeof(wakeup_thread_t) * 2 * num_senders);
+    pthread_t* pids = malloc(sizeof(pthread_t) * 2 * num_senders);
+    uint64_t start = monotonic_nsec();
+    for (size_t i = 0; i < 2 * num_senders; i++) {
+        bool is_send = (i % 2 == 0);
+        uint64_t* waits = is_send ? send_waits : receive_waits;
+        args[i] = (wakeup_thread_t){channel, is_send, messages, waits + (i / 2) * messages};
+        pthread_create(&pids[i], NULL, wakeup_thread, &args[i]);
+    }
+    for (size_t i = 0; i < 2 * num_senders; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    double elapsed_ms = (double)(monotonic_nsec() - start) / 1e6;
+    free(args);
+    free(pids);
+    return elapsed_ms;
+}
+
+int compare_nsec(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the given percentile of sorted waits, in microseconds
+double percentile_usec(const uint64_t* waits, size_t count, double percentile)
+{
+    size_t index = (size_t)(percentile / 100.0 * (double)(count - 1));
+    return (double)waits[index] / 1e3;
+}
+
+// Sorts the waits of one side and writes their percentiles as CSV columns
+void write_wait_percentiles(FILE* file, uint64_t* waits, size_t count)
+{
+    qsort(waits, count, sizeof(uint64_t), compare_nsec);
+    fprintf(file, ",%.1f,%.1f,%.1f,%.1f", percentile_usec(waits, count, 50), percentile_usec(waits, count, 99),
+            percentile_usec(waits, count, 99.9), (double)waits[count - 1] / 1e3);
+}
+
+// Runs senders against as many receivers on one channel for every wake order, buffer size and thread count
+// Writes one CSV row per run with the throughput and the wait-time percentiles of blocking sends and receives
+int run_wakeup(int argc, char** argv)
+{
+    char default_orders[] = "barging,fifo";
+    char default_sizes[] = "1,16";
+    char default_threads[] = "4,16";
+    char default_slots[] = "0";
+    arg_list_t orders;
+    arg_list_t sizes;
+    arg_list_t threads;
+    arg_list_t slots;
+    parse_list(default_orders, &orders);
+    parse_list(default_sizes, &sizes);
+    parse_list(default_threads, &threads);
+    parse_list(default_slots, &slots);
+    size_t messages = 20000;
+    const char* output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "O:E:b:n:m:o:")) != -1) {
+        switch (opt) {
+        case 'O':
+            parse_list(optarg, &orders);
+            break;
+        case 'E':
+            parse_list(optarg, &slots);
+            break;
+        case 'b':
+            parse_list(optarg, &sizes);
+            break;
+        case 'n':
+            parse_list(optarg, &threads);
+            break;
+        case 'm':
+            messages = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (messages == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE* file = stdout;
+    if (output != NULL) {
+        file = fopen(output, "w");
+        if (file == NULL) {
+            printf("Could not open output file: %s\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(file, "workload,wake_order,elimination_slots,buffer_size,threads,messages,elapsed_ms,messages_per_sec,send_p50_us,send_p99_us,"
+                  "send_p999_us,send_max_us,receive_p50_us,receive_p99_us,receive_p999_us,receive_max_us,exchanges\n");
+    for (size_t o = 0; o < orders.count; o++) {
+        enum chan_wake_order order;
+        if (!parse_wake_order(orders.items[o], &order)) {
+            printf("Unknown wake order: %s\n", orders.items[o]);
+            return 1;
+        }
+        for (size_t e = 0; e < slots.count; e++) {
+            for (size_t n = 0; n < threads.count; n++) {
+                for (size_t b = 0; b < sizes.count; b++) {
+                    size_t num_slots = list_size_at(&slots, e);
+                    size_t num_senders = list_size_at(&threads, n);
+                    size_t buffer_size = list_size_at(&sizes, b);
+                    size_t total = num_senders * messages;
+                    chan_t* channel = channel_create(buffer_size);
+                    channel_set_wake_order(channel, order);
+                    if (channel_set_elimination(channel, num_slots) != SUCCESS) {
+                        fprintf(stderr, "Skipping %zu elimination slots with the %s wake order\n", num_slots, orders.items[o]);
+                        channel_close(channel);
+                        channel_destroy(channel);
+                        continue;
+                    }
+                    uint64_t* send_waits = malloc(sizeof(uint64_t) * total);
+                    uint64_t* receive_waits = malloc(sizeof(uint64_t) * total);
+                    double elapsed_ms = run_senders_receivers(channel, num_senders, messages, send_waits, receive_waits);
+
+                    fprintf(file, "wakeup,%s,%zu,%zu,%zu,%zu,%.3f,%.0f", orders.items[o], num_slots, buffer_size, num_senders, total,
+                            elapsed_ms, (double)total / (elapsed_ms / 1e3));
+                    write_wait_percentiles(file, send_waits, total);
+                    write_wait_percentiles(file, receive_waits, total);
+                    fprintf(file, ",%zu\n", channel_exchanges(channel));
+                    fflush(file);
+
+                    channel_close(channel);
+                    channel_destroy(channel);
+                    free(send_waits);
+                    free(receive_waits);
+                }
+            }
+        }
+    }
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+// Runs senders against as many receivers on one channel for every synchronisation mode, buffer size and thread count
+// Writes one CSV row per run with the throughput and the call-time percentiles of sends and receives
+int run_contention(int argc, char** argv)
+{
+    char default_modes[] = "mutex,elimination,combining";
+    char default_sizes[] = "64";
+    char default_threads[] = "1,2,4,8,16,32";
+    arg_list_t modes;
+    arg_list_t sizes;
+    arg_list_t threads;
+    parse_list(default_modes, &modes);
+    parse_list(default_sizes, &sizes);
+    parse_list(default_threads, &threads);
+    size_t messages = 20000;
+    size_t slots = 4;
+    const char* output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "M:E:b:n:m:o:")) != -1) {
+        switch (opt) {
+        case 'M':
+            parse_list(optarg, &modes);
+            break;
+        case 'E':
+            slots = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            parse_list(optarg, &sizes);
+            break;
+        case 'n':
+            parse_list(optarg, &threads);
+            break;
+        case 'm':
+            messages = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (messages == 0 || slots == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE* file = stdout;
+    if (output != NULL) {
+        file = fopen(output, "w");
+        if (file == NULL) {
+            printf("Could not open output file: %s\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(file, "workload,mode,buffer_size,threads,messages,elapsed_ms,messages_per_sec,send_p50_us,send_p99_us,send_p999_us,send_max_us,"
+                  "receive_p50_us,receive_p99_us,receive_p999_us,receive_max_us,exchanges,combined\n");
+    for (size_t m = 0; m < modes.count; m++) {
+        if (strcmp(modes.items[m], "mutex") != 0 && strcmp(modes.items[m], "elimination") != 0 && strcmp(modes.items[m], "combining") != 0) {
+            printf("Unknown mode: %s\n", modes.items[m]);
+            return 1;
+        }
+        for (size_t n = 0; n < threads.count; n++) {
+            for (size_t b = 0; b < sizes.count; b++) {
+                size_t num_senders = list_size_at(&threads, n);
+                size_t buffer_size = list_size_at(&sizes, b);
+                size_t total = num_senders * messages;
+                chan_t* channel = channel_create(buffer_size);
+                if (strcmp(modes.items[m], "elimination") == 0) {
+                    channel_set_elimination(channel, slots);
+                } else if (strcmp(modes.items[m], "combining") == 0) {
+                    channel_set_combining(channel, true);
+                }
+                uint64_t* send_waits = malloc(sizeof(uint64_t) * total);
+                uint64_t* receive_waits = malloc(sizeof(uint64_t) * total);
+                double elapsed_ms = run_senders_receivers(channel, num_senders, messages, send_waits, receive_waits);
+
+                fprintf(file, "contention,%s,%zu,%zu,%zu,%.3f,%.0f", modes.items[m], buffer_size, num_senders, total, elapsed_ms,
+                        (double)total / (elapsed_ms / 1e3));
+                write_wait_percentiles(file, send_waits, total);
+                write_wait_percentiles(file, receive_waits, total);
+                fprintf(file, ",%zu,%zu\n", channel_exchanges(channel), channel_combined(channel));
+                fflush(file);
+
+                channel_close(channel);
+                channel_destroy(channel);
+                free(send_waits);
+                free(receive_waits);
+            }
+        }
+    }
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+// Shared state of a pool run
+typedef struct {
+    size_t working_set_bytes; // Size of every worker's working set
+    pthread_key_t working_set; // Working set of the calling worker, allocated on its first job
+    atomic_size_t workers_used; // Workers that handled at least one job
+    uint64_t* job_nsec; // Time every job took in its handler
+    chan_t* done; // Receives every finished job
+} pool_bench_t;
+
+// Sweeps the worker's working set once, reading and writing a word per cache line
+void pool_bench_job(void* data, void* arg)
+{
+    pool_bench_t* bench = arg;
+    uint64_t start = monotonic_nsec();
+    size_t* working_set = pthread_getspecific(bench->working_set);
+    if (working_set == NULL) {
+        working_set = calloc(1, bench->working_set_bytes);
+        pthread_setspecific(bench->working_set, working_set);
+        atomic_fetch_add(&bench->workers_used, 1);
+    }
+    size_t stride = 64 / sizeof(size_t);
+    for (size_t i = 0; i < bench->working_set_bytes / sizeof(size_t); i += stride) {
+        working_set[i] += i;
+    }
+    size_t job = (size_t)data - 1;
+    bench->job_nsec[job] = monotonic_nsec() - start;
+    channel_send(bench->done, data, true);
+}
+
+// Feeds jobs to a worker pool whose workers each sweep a private working set, for every wake order and worker count
+// Only jobs_in_flight workers are busy at a time, so the wake order decides whether jobs keep landing on the same warm workers
+// Writes one CSV row per run with the throughput and the percentiles of the time jobs took
+int run_pool(int argc, char** argv)
+{
+    char default_orders[] = "barging,fifo,lifo";
+    char default_workers[] = "4,16";
+    arg_list_t orders;
+    arg_list_t workers;
+    parse_list(default_orders, &orders);
+    parse_list(default_workers, &workers);
+    size_t working_set_kb = 512;
+    size_t in_flight = 1;
+    size_t jobs = 5000;
+    const char* output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "O:n:W:k:m:o:")) != -1) {
+        switch (opt) {
+        case 'O':
+            parse_list(optarg, &orders);
+            break;
+        case 'n':
+            parse_list(optarg, &workers);
+            break;
+        case 'W':
+            working_set_kb = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            in_flight = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            jobs = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (jobs == 0 || in_flight == 0 || working_set_kb == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (in_flight > jobs) {
+        in_flight = jobs;
+    }
+
+    FILE* file = stdout;
+    if (output != NULL) {
+        file = fopen(output, "w");
+        if (file == NULL) {
+            printf("Could not open output file: %s\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(file, "workload,wake_order,workers,working_set_kb,jobs_in_flight,jobs,elapsed_ms,jobs_per_sec,job_p50_us,job_p99_us,"
+                  "job_p999_us,job_max_us,workers_used\n");
+    for (size_t o = 0; o < orders.count; o++) {
+        enum chan_wake_order order;
+        if (!parse_wake_order(orders.items[o], &order)) {
+            printf("Unknown wake order: %s\n", orders.items[o]);
+            return 1;
+        }
+        for (size_t w = 0; w < workers.count; w++) {
+            size_t num_workers = list_size_at(&workers, w);
+            pool_bench_t bench;
+            bench.working_set_bytes = working_set_kb * 1024;
+            pthread_key_create(&bench.working_set, free);
+            atomic_init(&bench.workers_used, 0);
+            bench.job_nsec = malloc(sizeof(uint64_t) * jobs);
+            bench.done = channel_create(in_flight);
+            chan_t* channel = channel_create(in_flight);
+            channel_set_wake_order(channel, order);
+
+            // a fixed number of workers, so that only the wake order decides who runs
+            worker_pool_options_t options;
+            worker_pool_options_init(&options);
+            options.min_workers = num_workers;
+            options.max_workers = num_workers;
+            options.max_wait_nsec = 0;
+            options.linger_nsec = 10000000000ull;
+            worker_pool_t* pool = worker_pool_create(channel, &options, pool_bench_job, &bench);
+
+            uint64_t start = monotonic_nsec();
+            size_t sent = 0;
+            for (; sent < in_flight; sent++) {
+                channel_send(channel, (void*)(sent + 1), true);
+            }
+            for (size_t finished = 0; finished < jobs; finished++) {
+                void* data;
+                channel_receive(bench.done, &data, true);
+                if (sent < jobs) {
+                    sent++;
+                    channel_send(channel, (void*)sent, true);
+                }
+            }
+            double elapsed_ms = (double)(monotonic_nsec() - start) / 1e6;
+
+            channel_close(channel);
+            worker_pool_destroy(pool);
+            fprintf(file, "pool,%s,%zu,%zu,%zu,%zu,%.3f,%.0f", orders.items[o], num_workers, working_set_kb, in_flight, jobs, elapsed_ms,
+                    (double)jobs / (elapsed_ms / 1e3));
+            write_wait_percentiles(file, bench.job_nsec, jobs);
+            fprintf(file, ",%zu\n", atomic_load(&bench.workers_used));
+            fflush(file);
+
+            channel_destroy(channel);
+            channel_close(bench.done);
+            channel_destroy(bench.done);
+            free(bench.job_nsec);
+            pthread_key_delete(bench.working_set);
+        }
+    }
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "sweep") == 0) {
+        return run_sweep(argc - 1, argv + 1);
+    }
+    if (strcmp(argv[1], "wakeup") == 0) {
+        return run_wakeup(argc - 1, argv + 1);
+    }
+    if (strcmp(argv[1], "pool") == 0) {
+        return run_pool(argc - 1, argv + 1);
+    }
+    if (strcmp(argv[1], "contention") == 0) {
+        return run_contention(argc - 1, argv + 1);
+    }
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "budget.h"
+
+// Moves the credits of an exiting thread's cache back to the pool and frees the cache
+static void cache_exit(void* arg)
+{
+    budget_cache_t* cache = arg;
+    chan_budget_t* budget = cache->budget;
+    pthread_mutex_lock(&budget->mutex);
+    for (budget_cache_t** link = &budget->caches; *link != NULL; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
+    }
+    atomic_fetch_add(&budget->available, atomic_exchange(&cache->credits, 0));
+    if (atomic_load(&budget->waiters) > 0) {
+        pthread_cond_broadcast(&budget->condition);
+    }
+    pthread_mutex_unlock(&budget->mutex);
+    free(cache);
+}
+
+// Returns the calling thread's cache, creating it on first use
+static budget_cache_t* get_cache(chan_budget_t* budget)
+{
+    budget_cache_t* cache = pthread_getspecific(budget->key);
+    if (cache != NULL) {
+        return cache;
+    }
+    cache = malloc(sizeof(budget_cache_t));
+    assert(cache != NULL);
+    atomic_init(&cache->credits, 0);
+    cache->budget = budget;
+    pthread_mutex_lock(&budget->mutex);
+    cache->next = budget->caches;
+    budget->caches = cache;
+    pthread_mutex_unlock(&budget->mutex);
+    pthread_setspecific(budget->key, cache);
+    return cache;
+}
+
+// Takes up to want credits from counter, but none unless at least need are there
+// Returns the number of credits taken
+static size_t take_credits(atomic_size_t* counter, size_t need, size_t want)
+{
+    size_t credits = atomic_load(counter);
+    while (credits >= need) {
+        size_t taken = (credits < want) ? credits : want;
+        if (atomic_compare_exchange_weak(counter, &credits, credits - taken)) {
+            return taken;
+        }
+    }
+    return 0;
+}
+
+// Creates a budget of limit credits whose thread caches move batch credits at a time (0 picks limit / 64)
+// Returns NULL if the budget could not be created
+chan_budget_t* budget_create(size_t limit, size_t batch)
+{
+    if (limit == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    chan_budget_t* budget = malloc(sizeof(chan_budget_t));
+    if (budget == NULL) {
+        return NULL;
+    }
+    if (pthread_key_create(&budget->key, cache_exit) != 0) {
+        free(budget);
+        return NULL;
+    }
+    budget->limit = limit;
+    budget->batch = (batch > 0) ? batch : limit / 64;
+    atomic_init(&budget->available, limit);
+    atomic_init(&budget->waiters, 0);
+    pthread_mutex_init(&budget->mutex, NULL);
+    pthread_cond_init(&budget->condition, NULL);
+    budget->caches = NULL;
+    return budget;
+}
+
+// Takes credits for between 1 and count messages costing cost credits each, as many as are available
+// Blocking calls wait until at least one message fits, or until cancel (if not NULL) returns true
+// Returns the number of messages credits were taken for, 0 if none fit (non-blocking) or the wait was cancelled
+size_t budget_acquire(chan_budget_t* budget, size_t count, size_t cost, bool blocking, budget_cancel_t cancel, void* cancel_arg)
+{
+    if (budget == NULL || count == 0 || cost == 0 || cost > budget->limit) {
+        return 0; // Taking invalid arguments
+    }
+    
+    // Fast path: the whole request from the thread's cache, refilled from the pool with a batch to spare
+    budget_cache_t* cache = get_cache(budget);
+    size_t want = (count > budget->limit / cost) ? budget->limit / cost * cost : count * cost;
+    if (take_credits(&cache->credits, want, want) == want) {
+        return want / cost;
+    }
+    size_t refill = take_credits(&budget->available, 1, want + budget->batch);
+    if (refill > 0) {
+        atomic_fetch_add(&cache->credits, refill);
+        size_t taken = take_credits(&cache->credits, cost, want);
+        if (taken > 0) {
+            // a partial grant hands back the remainder that is not a whole message
+            size_t granted = taken / cost;
+            if (taken > granted * cost) {
+                atomic_fetch_add(&cache->credits, taken - granted * cost);
+            }
+            return granted;
+        }
+    }
+    
+    // Slow path: collect the credits other threads hold back and wait for releases
+    // Counting as a waiter before looking makes releases that the collection misses wake us
+    pthread_mutex_lock(&budget->mutex);
+    atomic_fetch_add(&budget->waiters, 1);
+    while (true) {
+        for (budget_cache_t* other = budget->caches; other != NULL; other = other->next) {
+            atomic_fetch_add(&budget->available, atomic_exchange(&other->credits, 0));
+        }
+        size_t taken = take_credits(&budget->available, cost, want);
+        if (taken > 0) {
+            size_t granted = taken / cost;
+            if (taken > granted * cost) {
+                atomic_fetch_add(&budget->available, taken - granted * cost);
+            }
+            atomic_fetch_sub(&budget->waiters, 1);
+            pthread_mutex_unlock(&budget->mutex);
+            return granted;
+        }
+        if (!blocking || (cancel != NULL && cancel(cancel_arg))) {
+            atomic_fetch_sub(&budget->waiters, 1);
+            pthread_mutex_unlock(&budget->mutex);
+            return 0;
+        }
+        pthread_cond_wait(&budget->condition, &budget->mutex);
+    }
+}
+
+// Returns credits taken with budget_acquire
+void budget_release(chan_budget_t* budget, size_t credits)
+{
+    if (budget == NULL || credits == 0) {
+        return; // Taking invalid arguments
+    }
+    
+    if (atomic_load(&budget->waiters) > 0) {
+        // hand the credits straight to the blocked senders
+        pthread_mutex_lock(&budget->mutex);
+        atomic_fetch_add(&budget->available, credits);
+        pthread_cond_broadcast(&budget->condition);
+        pthread_mutex_unlock(&budget->mutex);
+        return;
+    }
+    
+    // Keep the credits in the thread's cache, returning what exceeds two batches to the pool
+    budget_cache_t* cache = get_cache(budget);
+    size_t held = atomic_fetch_add(&cache->credits, credits) + credits;
+    if (held > 2 * budget->batch) {
+        size_t excess = take_credits(&cache->credits, 1, held - budget->batch);
+        atomic_fetch_add(&budget->available, excess);
+    }
+    if (atomic_load(&budget->waiters) > 0) {
+        // a sender started waiting meanwhile and may have missed these credits
+        budget_wake(budget);
+    }
+}
+
+// Wakes blocked budget_acquire calls so that they check their cancel function
+void budget_wake(chan_budget_t* budget)
+{
+    if (budget == NULL) {
+        return; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&budget->mutex);
+    pthread_cond_broadcast(&budget->condition);
+    pthread_mutex_unlock(&budget->mutex);
+}
+
+// Returns the number of credits currently held by buffered messages
+size_t budget_used(chan_budget_t* budget)
+{
+    if (budget == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&budget->mutex);
+    size_t free_credits = atomic_load(&budget->available);
+    for (budget_cache_t* cache = budget->caches; cache != NULL; cache = cache->next) {
+        free_credits += atomic_load(&cache->credits);
+    }
+    pthread_mutex_unlock(&budget->mutex);
+    
+    return budget->limit - free_credits;
+}
+
+// Frees the budget, no channel may use it anymore
+void budget_destroy(chan_budget_t* budget)
+{
+    if (budget == NULL) {
+        return; // Taking invalid arguments
+    }
+    
+    // Deleting the key keeps the exit destructor from touching the caches freed here
+    pthread_key_delete(budget->key);
+    budget_cache_t* cache = budget->caches;
+    while (cache != NULL) {
+        budget_cache_t* next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    pthread_mutex_destroy(&budget->mutex);
+    pthread_cond_destroy(&budget->condition);
+    free(budget);
+}
@@ -0,0 +1,53 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Called by a blocked budget_acquire whenever it wakes, returns true to give up waiting
+typedef bool (*budget_cancel_t)(void* arg);
+
+// Credits a thread holds back from the shared pool, so that most acquires and releases touch only the thread's own counter
+typedef struct budget_cache {
+    atomic_size_t credits; // Credits held by the thread, taken by other threads when the pool runs dry
+    struct chan_budget* budget; // Budget the cache belongs to
+    struct budget_cache* next; // Next cache of the budget
+} budget_cache_t;
+
+// Limit on what all channels sharing the budget hold in their buffers at once, in credits
+// A channel charges a fixed number of credits per buffered message: 1 to count messages, or the payload size to count bytes
+typedef struct chan_budget {
+    size_t limit; // Credits in the budget
+    size_t batch; // Credits a thread cache takes from or returns to the pool at a time
+    atomic_size_t available; // Credits in the shared pool, not held by any cache or message
+    atomic_size_t waiters; // Senders blocked waiting for credits
+    pthread_key_t key; // The calling thread's budget_cache_t
+    pthread_mutex_t mutex; // Mutex protecting caches and blocking
+    pthread_cond_t condition; // Signalled when credits are returned while senders wait
+    budget_cache_t* caches; // Caches of the threads that used the budget
+} chan_budget_t;
+
+// Creates a budget of limit credits whose thread caches move batch credits at a time (0 picks limit / 64)
+// Returns NULL if the budget could not be created
+chan_budget_t* budget_create(size_t limit, size_t batch);
+
+// Takes credits for between 1 and count messages costing cost credits each, as many as are available
+// Blocking calls wait until at least one message fits, or until cancel (if not NULL) returns true
+// Returns the number of messages credits were taken for, 0 if none fit (non-blocking) or the wait was cancelled
+size_t budget_acquire(chan_budget_t* budget, size_t count, size_t cost, bool blocking, budget_cancel_t cancel, void* cancel_arg);
+
+// Returns credits taken with budget_acquire
+void budget_release(chan_budget_t* budget, size_t credits);
+
+// Wakes blocked budget_acquire calls so that they check their cancel function
+void budget_wake(chan_budget_t* budget);
+
+// Returns the number of credits currently held by buffered messages
+size_t budget_used(chan_budget_t* budget);
+
+// Frees the budget, no channel may use it anymore
+void budget_destroy(chan_budget_t* budget);
+
+#endif // BUDGET_H
@@ -1,5 +1,15 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "buffer.h"
 
+// A large ring holding at most this many values is moved back to its start
+#define LARGE_PACK_SLOTS 16
+// ... once its oldest value is this far from the start
+#define LARGE_PACK_DISTANCE 4096
+// Size of a transparent or explicit huge page
+#define HUGE_PAGE_BYTES (2u << 20)
+
 // Creates a buffer with the given capacity
 buffer_t* buffer_create(size_t capacity)
 {
@@ -9,9 +19,98 @@ buffer_t* buffer_create(size_t capacity)
     buffer->next = 0;
     buffer->capacity = capacity;
     buffer->data = data;
+    buffer->large = false;
+    buffer->release_idle = false;
+    buffer->mapped_bytes = 0;
+    buffer->page_bytes = 0;
+    buffer->touched = 0;
+    return buffer;
+}
+
+// Creates a buffer of the given capacity for very large rings
+// The ring is reserved with mmap and its pages are only committed once written;
+// the ring is kept packed at its start while it holds few values, so that memory follows the depth rather than the capacity
+// With release_idle, every page the oldest value moves past is returned to the system, as are the pages beyond the values
+// still held whenever the ring drains
+// With huge_pages, the ring is mapped on explicit huge pages if the pool can reserve the whole capacity at creation (else
+// normal pages are used); those pages stay reserved until the buffer is freed, so memory then follows the capacity
+// Without it, normal pages are used that the kernel may merge into transparent huge pages
+buffer_t* buffer_create_large(size_t capacity, bool release_idle, bool huge_pages)
+{
+    buffer_t* buffer = (buffer_t*) malloc(sizeof(buffer_t));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    size_t bytes = (capacity * sizeof(void*) + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    if (bytes == 0) {
+        bytes = HUGE_PAGE_BYTES;
+    }
+    // Explicit huge pages are reserved here, without MAP_NORESERVE, so that a short pool fails the mmap rather than a
+    // later write with SIGBUS
+    size_t page_bytes = HUGE_PAGE_BYTES;
+    void* data = MAP_FAILED;
+    if (huge_pages) {
+        data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (data == MAP_FAILED) {
+        page_bytes = (size_t)sysconf(_SC_PAGESIZE);
+        data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (data == MAP_FAILED) {
+            free(buffer);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    buffer->size = 0;
+    buffer->next = 0;
+    buffer->capacity = capacity;
+    buffer->data = data;
+    buffer->large = true;
+    buffer->release_idle = release_idle;
+    buffer->mapped_bytes = bytes;
+    buffer->page_bytes = page_bytes;
+    buffer->touched = 0;
     return buffer;
 }
 
+// Moves the few values of a large ring back to its start and, if enabled, releases the pages past them
+static void large_pack(buffer_t* buffer)
+{
+    if (buffer->size > 0) {
+        void* values[LARGE_PACK_SLOTS];
+        for (size_t i = 0; i < buffer->size; i++) {
+            size_t pos = buffer->next + i;
+            values[i] = buffer->data[(pos >= buffer->capacity) ? pos - buffer->capacity : pos];
+        }
+        memcpy(buffer->data, values, buffer->size * sizeof(void*));
+    }
+    buffer->next = 0;
+    if (!buffer->release_idle) {
+        return;
+    }
+    size_t keep = (buffer->size * sizeof(void*) + buffer->page_bytes - 1) / buffer->page_bytes * buffer->page_bytes;
+    size_t touched = buffer->touched * sizeof(void*);
+    if (touched > keep + buffer->page_bytes) {
+        madvise((char*)buffer->data + keep, touched - keep, MADV_DONTNEED);
+        buffer->touched = buffer->size;
+    }
+}
+
+// Returns the page of a large ring that ends at slot end to the system, unless values wrapped around into it are still held
+static void large_release_behind(buffer_t* buffer, size_t end)
+{
+    size_t page_slots = buffer->page_bytes / sizeof(void*);
+    size_t start = (end - 1) / page_slots * page_slots;
+    // values are held from next onwards, so the page's first slot is the last of them to be reached
+    size_t distance = (start + buffer->capacity - buffer->next) % buffer->capacity;
+    if (buffer->size > distance) {
+        return;
+    }
+    madvise((char*)buffer->data + start * sizeof(void*), buffer->page_bytes, MADV_DONTNEED);
+}
+
 // Adds the value into the buffer
 // Returns 'true' if the buffer is not full and a value was added
 // Returns 'false' otherwise
@@ -26,6 +125,9 @@ bool buffer_add(void* data, buffer_t* buffer)
     }
     buffer->data[pos] = data;
     buffer->size++;
+    if (buffer->large && pos >= buffer->touched) {
+        buffer->touched = pos + 1;
+    }
     return true;
 }
 
@@ -38,9 +140,16 @@ void *buffer_remove(buffer_t* buffer)
         void *data = buffer->data[buffer->next];
         buffer->size--;
         buffer->next++;
+        if (buffer->release_idle && (buffer->next == buffer->capacity || buffer->next % (buffer->page_bytes / sizeof(void*)) == 0)) {
+            // the oldest value just moved onto a new page, the one it left holds nothing
+            large_release_behind(buffer, buffer->next);
+        }
         if (buffer->next >= buffer->capacity) {
             buffer->next -= buffer->capacity;
         }
+        if (buffer->large && buffer->size <= LARGE_PACK_SLOTS && (buffer->size == 0 || buffer->next >= LARGE_PACK_DISTANCE)) {
+            large_pack(buffer);
+        }
         return data;
     }
     return BUFFER_EMPTY;
@@ -49,6 +158,11 @@ void *buffer_remove(buffer_t* buffer)
 // Frees the memory allocated to the buffer
 void buffer_free(buffer_t *buffer)
 {
+    if (buffer->large) {
+        munmap(buffer->data, buffer->mapped_bytes);
+        free(buffer);
+        return;
+    }
     free(buffer->data);
     free(buffer);
 }
@@ -4,11 +4,20 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     size_t size;
     size_t next;
     size_t capacity;
     void** data;
+    bool large; // Ring mapped with buffer_create_large rather than malloc'd
+    bool release_idle; // Return the pages of a large ring to the system once its values are removed (large buffers only)
+    size_t mapped_bytes; // Length of the mapping (large buffers only)
+    size_t page_bytes; // Page size of the mapping, huge pages when requested and available (large buffers only)
+    size_t touched; // Slots below this index may have been written since the last release (large buffers only)
 } buffer_t;
 
 #define BUFFER_EMPTY	((void *) -1L)
@@ -16,6 +25,16 @@ typedef struct {
 // Creates a buffer with the given capacity
 buffer_t* buffer_create(size_t capacity);
 
+// Creates a buffer of the given capacity for very large rings
+// The ring is reserved with mmap and its pages are only committed once written;
+// the ring is kept packed at its start while it holds few values, so that memory follows the depth rather than the capacity
+// With release_idle, every page the oldest value moves past is returned to the system, as are the pages beyond the values
+// still held whenever the ring drains
+// With huge_pages, the ring is mapped on explicit huge pages if the pool can reserve the whole capacity at creation (else
+// normal pages are used); those pages stay reserved until the buffer is freed, so memory then follows the capacity
+// Without it, normal pages are used that the kernel may merge into transparent huge pages
+buffer_t* buffer_create_large(size_t capacity, bool release_idle, bool huge_pages);
+
 // Adds the value into the buffer
 // Returns 'true' if the buffer is not full and a value was added
 // Returns 'false' otherwise
@@ -39,4 +58,8 @@ size_t buffer_current_size(buffer_t* buffer);
 // Only used for testing code; you should NOT use this
 void* peek_buffer(size_t index, buffer_t* buffer);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // BUFFER_H
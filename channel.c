@@ -1,34 +1,733 @@
+#include <time.h>
+#include <sched.h>
 #include "channel.h"
+#include "budget.h"
+#include "channel_inline.h"
+#include "time_nsec.h"
 
-// Creates a new channel with the provided size and returns it to the caller
-// A 0 size indicates an unbuffered channel, whereas a positive size indicates a buffered channel
-chan_t* channel_create(size_t size) {
+static struct timespec nsec_to_timespec(uint64_t nsec)
+{
+    struct timespec time;
+    time.tv_sec = (time_t)(nsec / 1000000000ull);
+    time.tv_nsec = (long)(nsec % 1000000000ull);
+    return time;
+}
+
+static void chan_waiters_init(chan_waiters_t* waiters)
+{
+    atomic_init(&waiters->head, NULL);
+    atomic_init(&waiters->count, 0);
+}
+
+// Frees every entry, no select may be registered anymore
+static void chan_waiters_free(chan_waiters_t* waiters)
+{
+    chan_waiter_t* waiter = atomic_load(&waiters->head);
+    while (waiter != NULL) {
+        chan_waiter_t* next = waiter->next;
+        free(waiter);
+        waiter = next;
+    }
+}
+
+// Registers sem to be posted by chan_waiters_notify, returns false if out of memory
+// The same sem may be registered more than once and is then posted once per registration
+bool chan_waiters_register(chan_waiters_t* waiters, sem_t* sem)
+{
+    // Counted first so that a notifier which sees the entry also walks the stack
+    atomic_fetch_add(&waiters->count, 1);
+
+    // Reuse an entry left behind by an earlier registration
+    for (chan_waiter_t* waiter = atomic_load(&waiters->head); waiter != NULL; waiter = waiter->next) {
+        sem_t* expected = NULL;
+        if (atomic_load_explicit(&waiter->sem, memory_order_relaxed) == NULL &&
+            atomic_compare_exchange_strong(&waiter->sem, &expected, sem)) {
+            return true;
+        }
+    }
+
+    // None free, push a new one
+    chan_waiter_t* waiter = (chan_waiter_t*)malloc(sizeof(chan_waiter_t));
+    if (waiter == NULL) {
+        atomic_fetch_sub(&waiters->count, 1);
+        return false;
+    }
+    atomic_init(&waiter->sem, sem);
+    atomic_init(&waiter->posting, 0);
+    waiter->next = atomic_load(&waiters->head);
+    while (!atomic_compare_exchange_weak(&waiters->head, &waiter->next, waiter)) {
+    }
+    return true;
+}
+
+// Removes one registration of sem; once this returns no notifier is posting it anymore
+void chan_waiters_unregister(chan_waiters_t* waiters, sem_t* sem)
+{
+    for (chan_waiter_t* waiter = atomic_load(&waiters->head); waiter != NULL; waiter = waiter->next) {
+        sem_t* expected = sem;
+        if (atomic_compare_exchange_strong(&waiter->sem, &expected, NULL)) {
+            // A notifier that read sem before it was cleared is still posting it
+            while (atomic_load(&waiter->posting) != 0) {
+                sched_yield();
+            }
+            atomic_fetch_sub(&waiters->count, 1);
+            return;
+        }
+    }
+}
+
+// Posts every registered semaphore, without blocking registrations running at the same time
+void chan_waiters_notify(chan_waiters_t* waiters)
+{
+    if (!chan_waiters_any(waiters)) {
+        return;
+    }
+    for (chan_waiter_t* waiter = atomic_load(&waiters->head); waiter != NULL; waiter = waiter->next) {
+        if (atomic_load_explicit(&waiter->sem, memory_order_relaxed) == NULL) {
+            continue; // Unregistered entry
+        }
+        // Announce the post before reading sem, unregister clears sem before checking posting
+        atomic_fetch_add(&waiter->posting, 1);
+        sem_t* sem = atomic_load(&waiter->sem);
+        if (sem != NULL) {
+            sem_post(sem);
+        }
+        atomic_fetch_sub_explicit(&waiter->posting, 1, memory_order_release);
+    }
+}
+
+// A thread blocked in a channel using a queued wake order, lives on the blocked thread's stack
+struct chan_wait_node {
+    pthread_cond_t condition; // Signalled once the wait is over
+    void* data; // Message to send, or the message handed over
+    enum chan_status status; // WOULDBLOCK while queued, then SUCCESS or CLOSED_ERROR
+    struct chan_wait_node* prev;
+    struct chan_wait_node* next;
+};
+
+static void wait_queue_init(chan_wait_queue_t* queue)
+{
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->count = 0;
+}
+
+static void wait_queue_push(chan_wait_queue_t* queue, struct chan_wait_node* node)
+{
+    node->prev = queue->tail;
+    node->next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->next = node;
+    } else {
+        queue->head = node;
+    }
+    queue->tail = node;
+    queue->count++;
+}
+
+static void wait_queue_unlink(chan_wait_queue_t* queue, struct chan_wait_node* node)
+{
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        queue->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        queue->tail = node->prev;
+    }
+    queue->count--;
+}
+
+// Ends the wait of a queued thread with status
+static void wait_queue_wake(chan_wait_queue_t* queue, struct chan_wait_node* node, enum chan_status status)
+{
+    wait_queue_unlink(queue, node);
+    node->status = status;
+    pthread_cond_signal(&node->condition);
+}
+
+// Queues the calling thread until it is handed room or a message, the channel is closed or deadline_nsec passes
+// data holds the message to send, or receives the message handed over; deadline_nsec is 0 to wait without limit
+// Must be called with the channel's mutex held
+// Returns SUCCESS, CLOSED_ERROR, or WOULDBLOCK if the deadline passed first
+static enum chan_status wait_in_queue(chan_t* channel, chan_wait_queue_t* queue, void** data, uint64_t deadline_nsec)
+{
+    struct chan_wait_node node;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&node.condition, &attr);
+    pthread_condattr_destroy(&attr);
+    node.data = *data;
+    node.status = WOULDBLOCK;
+    wait_queue_push(queue, &node);
+    while (node.status == WOULDBLOCK) {
+        if (deadline_nsec == 0) {
+            pthread_cond_wait(&node.condition, &channel->mutex);
+        } else if (monotonic_nsec() >= deadline_nsec) {
+            wait_queue_unlink(queue, &node);
+            break;
+        } else {
+            struct timespec wake = nsec_to_timespec(deadline_nsec);
+            pthread_cond_timedwait(&node.condition, &channel->mutex, &wake);
+        }
+    }
+    pthread_cond_destroy(&node.condition);
+    *data = node.data;
+    return node.status;
+}
+
+// Hands buffered messages to queued receivers, the longest waiting first or with CHAN_WAKE_LIFO the most recent first
+// Must be called with the channel's mutex held
+static void hand_to_receivers(chan_t* channel)
+{
+    chan_wait_queue_t* queue = &channel->receive_queue;
+    while (queue->head != NULL && buffer_current_size(channel->buffer) > 0) {
+        struct chan_wait_node* node = (channel->wake_order == CHAN_WAKE_LIFO) ? queue->tail : queue->head;
+        node->data = buffer_remove(channel->buffer);
+        wait_queue_wake(queue, node, SUCCESS);
+        channel->receive_wakeups++;
+    }
+}
+
+// Calls the send hook, if any, with the number of messages now buffered
+// Must be called with the channel's mutex held
+static void call_send_hook(chan_t* channel)
+{
+    if (channel->send_hook != NULL && channel->send_hook(channel->send_hook_arg, buffer_current_size(channel->buffer), false)) {
+        channel->send_hook_deferred = true; // Called again by channel_unlock
+    }
+}
+
+// Moves the messages of queued senders into free room of the buffer, in queue order
+// Must be called with the channel's mutex held
+static void hand_to_senders(chan_t* channel)
+{
+    while (channel->send_queue.head != NULL && buffer_current_size(channel->buffer) < buffer_capacity(channel->buffer)) {
+        buffer_add(channel->send_queue.head->data, channel->buffer);
+        call_send_hook(channel);
+        wait_queue_wake(&channel->send_queue, channel->send_queue.head, SUCCESS);
+    }
+}
+
+// Wakes blocked senders after removed messages were taken from the buffer
+// Must be called with the channel's mutex held
+static void notify_senders(chan_t* channel, size_t removed)
+{
+    if (channel->wake_order != CHAN_WAKE_BARGING) {
+        hand_to_senders(channel);
+    } else if (removed == 1) {
+        pthread_cond_signal(&channel->send_condition);
+    } else {
+        pthread_cond_broadcast(&channel->send_condition);
+    }
+}
+
+// States of an elimination slot; the thread that made a slot SENDER_WAITING or RECEIVER_WAITING is the one that empties it again
+enum exchange_state {
+    EXCHANGE_EMPTY = 0,
+    EXCHANGE_SENDER_WAITING, // data holds the message offered
+    EXCHANGE_RECEIVER_WAITING,
+    EXCHANGE_BUSY, // Claimed by a thread of the other side, which is reading or writing data
+    EXCHANGE_TAKEN, // The offered message was taken
+    EXCHANGE_FILLED // data holds the message delivered to the waiting receiver
+};
+
+// Attempts before a thread waiting in a slot gives up
+#define EXCHANGE_SPINS 32
+
+// Returns the slot a thread offers in, spread by the address of its stack
+static chan_exchange_t* exchange_home(chan_t* channel, void* local)
+{
+    // thread stacks differ in their high bits only, mix those down
+    uint64_t hash = ((uint64_t)(uintptr_t)local >> 12) * 0x9E3779B97F4A7C15ull;
+    return &channel->exchange[(size_t)(hash >> 32) % channel->exchange_slots];
+}
+
+// Waits for the thread that claimed a slot to finish with it
+static void exchange_wait_for(chan_exchange_t* slot, int state)
+{
+    while (atomic_load_explicit(&slot->state, memory_order_acquire) != state) {
+        sched_yield();
+    }
+}
+
+// Hands data to a receiver waiting in the elimination array, or (if offer) offers it there for a while
+// Non-blocking sends do not offer, they must not wait for a partner
+// Returns true if a receiver took it
+static bool exchange_send(chan_t* channel, void* data, bool offer)
+{
+    // A waiting receiver anywhere in the array gets the message straight away
+    for (size_t i = 0; i < channel->exchange_slots; i++) {
+        chan_exchange_t* slot = &channel->exchange[i];
+        int expected = EXCHANGE_RECEIVER_WAITING;
+        if (atomic_load_explicit(&slot->state, memory_order_relaxed) == expected &&
+            atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_BUSY)) {
+            slot->data = data;
+            atomic_store_explicit(&slot->state, EXCHANGE_FILLED, memory_order_release);
+            atomic_fetch_add_explicit(&channel->exchanges, 1, memory_order_relaxed);
+            return true;
+        }
+    }
+
+    if (!offer) {
+        return false;
+    }
+    
+    // Otherwise offer it in our slot
+    chan_exchange_t* slot = exchange_home(channel, &data);
+    int expected = EXCHANGE_EMPTY;
+    if (!atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_BUSY)) {
+        return false;
+    }
+    slot->data = data;
+    atomic_store_explicit(&slot->state, EXCHANGE_SENDER_WAITING, memory_order_release);
+    for (int spin = 0; spin < EXCHANGE_SPINS; spin++) {
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == EXCHANGE_TAKEN) {
+            atomic_store_explicit(&slot->state, EXCHANGE_EMPTY, memory_order_release);
+            return true;
+        }
+        sched_yield();
+    }
+    expected = EXCHANGE_SENDER_WAITING;
+    if (atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_EMPTY)) {
+        return false; // Withdrawn
+    }
+    // A receiver claimed it just now
+    exchange_wait_for(slot, EXCHANGE_TAKEN);
+    atomic_store_explicit(&slot->state, EXCHANGE_EMPTY, memory_order_release);
+    return true;
+}
+
+// Takes a message from a sender waiting in the elimination array, or (if wait) waits there for one for a while
+// Non-blocking receives do not wait, they must not hold out for a partner
+// Returns true if a message was stored in data
+static bool exchange_receive(chan_t* channel, void** data, bool wait)
+{
+    // A waiting sender anywhere in the array hands its message over straight away
+    for (size_t i = 0; i < channel->exchange_slots; i++) {
+        chan_exchange_t* slot = &channel->exchange[i];
+        int expected = EXCHANGE_SENDER_WAITING;
+        if (atomic_load_explicit(&slot->state, memory_order_relaxed) == expected &&
+            atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_BUSY)) {
+            *data = slot->data;
+            atomic_store_explicit(&slot->state, EXCHANGE_TAKEN, memory_order_release);
+            atomic_fetch_add_explicit(&channel->exchanges, 1, memory_order_relaxed);
+            return true;
+        }
+    }
+
+    if (!wait) {
+        return false;
+    }
+    
+    // Otherwise wait for one in our slot
+    chan_exchange_t* slot = exchange_home(channel, &data);
+    int expected = EXCHANGE_EMPTY;
+    if (!atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_RECEIVER_WAITING)) {
+        return false;
+    }
+    for (int spin = 0; spin < EXCHANGE_SPINS; spin++) {
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == EXCHANGE_FILLED) {
+            *data = slot->data;
+            atomic_store_explicit(&slot->state, EXCHANGE_EMPTY, memory_order_release);
+            return true;
+        }
+        sched_yield();
+    }
+    expected = EXCHANGE_RECEIVER_WAITING;
+    if (atomic_compare_exchange_strong(&slot->state, &expected, EXCHANGE_EMPTY)) {
+        return false; // Withdrawn
+    }
+    // A sender claimed it just now
+    exchange_wait_for(slot, EXCHANGE_FILLED);
+    *data = slot->data;
+    atomic_store_explicit(&slot->state, EXCHANGE_EMPTY, memory_order_release);
+    return true;
+}
+
+// Wakes blocked receivers after added messages were put in the buffer, as the wake policy allows
+// Must be called with the channel's mutex held
+static void notify_receivers(chan_t* channel, size_t added)
+{
+    if (channel->wake_order != CHAN_WAKE_BARGING) {
+        hand_to_receivers(channel);
+        return;
+    }
+    size_t depth = buffer_current_size(channel->buffer);
+    bool was_empty = (depth == added);
+    if (was_empty) {
+        channel->oldest_nsec = monotonic_nsec();
+    }
+    if (channel->wake_depth > 0 && !was_empty && depth < channel->wake_depth) {
+        // the receivers were already told about the oldest message and wait for its deadline
+        return;
+    }
+    if (added == 1) {
+        pthread_cond_signal(&channel->receive_condition);
+    } else {
+        pthread_cond_broadcast(&channel->receive_condition);
+    }
+}
+
+// States of a combining request; only the requester moves it between PENDING and PARKED, only a combiner makes it DONE
+enum combine_state {
+    COMBINE_PENDING = 0,
+    COMBINE_PARKED, // The requester sleeps on sem
+    COMBINE_DONE // status and data hold the outcome
+};
+
+// Yields before a requester parks until a combiner has applied its request
+#define COMBINE_SPINS 16
+
+// Published send or receive, lives on the requester's stack until it is done
+struct chan_combine_request {
+    bool is_send;
+    void* data; // Message to send, or the message received
+    enum chan_status status; // Outcome, WOULDBLOCK if the buffer was full or empty
+    CHAN_ATOMIC(int) state;
+    sem_t sem; // Posted when a parked request is done
+    struct chan_combine_request* next;
+};
+
+// Applies one request to the buffer and completes it
+// Must be called with the channel's mutex held
+static void combine_apply(chan_t* channel, struct chan_combine_request* request)
+{
+    if (channel->closed) {
+        request->status = CLOSED_ERROR;
+    } else if (request->is_send) {
+        if (buffer_current_size(channel->buffer) == buffer_capacity(channel->buffer)) {
+            request->status = WOULDBLOCK;
+        } else {
+            buffer_add(request->data, channel->buffer);
+            if (buffer_current_size(channel->buffer) > channel->peak_size) {
+                channel->peak_size = buffer_current_size(channel->buffer);
+            }
+            call_send_hook(channel);
+            notify_receivers(channel, 1);
+            request->status = SUCCESS;
+        }
+    } else {
+        if (buffer_current_size(channel->buffer) == 0) {
+            request->status = WOULDBLOCK;
+        } else {
+            request->data = buffer_remove(channel->buffer);
+            notify_senders(channel, 1);
+            request->status = SUCCESS;
+        }
+    }
+}
+
+// Applies every published request, in the order they were published, until no more arrive
+// Must be called with the channel's mutex held
+static void combine_requests(chan_t* channel, struct chan_combine_request* own)
+{
+    struct chan_combine_request* list;
+    while ((list = atomic_exchange(&channel->combine_head, NULL)) != NULL) {
+        // The list is most recent first
+        struct chan_combine_request* ordered = NULL;
+        while (list != NULL) {
+            struct chan_combine_request* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+        }
+        while (ordered != NULL) {
+            // The request may be gone as soon as it is done
+            struct chan_combine_request* next = ordered->next;
+            combine_apply(channel, ordered);
+            if (ordered != own) {
+                atomic_fetch_add_explicit(&channel->combined, 1, memory_order_relaxed);
+            }
+            if (atomic_exchange(&ordered->state, COMBINE_DONE) == COMBINE_PARKED) {
+                sem_post(&ordered->sem);
+            }
+            ordered = next;
+        }
+    }
+}
+
+// Unlocks the channel's mutex; with combining, first applies the requests published meanwhile, and then makes the send hook
+// call deferred while the mutex was held
+// A request published while the mutex is held counts on its holder, so with combining every path holding the mutex must
+// leave through here, and none may wait on a condition with it
+static void channel_unlock(chan_t* channel)
+{
+    chan_send_hook_t hook = NULL;
+    void* hook_arg = NULL;
+    size_t depth = 0;
+    bool locked = true;
+    while (locked) {
+        if (channel->combining) {
+            combine_requests(channel, NULL);
+        }
+        if (channel->send_hook_deferred) {
+            // One call covers every send that asked for it
+            channel->send_hook_deferred = false;
+            if (hook == NULL) {
+                hook = channel->send_hook;
+                hook_arg = channel->send_hook_arg;
+                atomic_fetch_add(&channel->send_hook_running, 1);
+            }
+            depth = buffer_current_size(channel->buffer);
+        }
+        pthread_mutex_unlock(&channel->mutex);
+        // A request published while we held the mutex may have found it taken and count on us; checked with a compare and
+        // exchange rather than a load, so that a request published after it is ordered after the unlock and finds the mutex free
+        struct chan_combine_request* head = NULL;
+        locked = channel->combining && !atomic_compare_exchange_strong(&channel->combine_head, &head, NULL) &&
+                 pthread_mutex_trylock(&channel->mutex) == 0;
+    }
+    if (hook != NULL) {
+        hook(hook_arg, depth, true);
+        atomic_fetch_sub(&channel->send_hook_running, 1);
+    }
+}
+
+// Waits in line for a message while the buffer is empty, for queued wake orders
+// Must be called with the channel's mutex held, which is released on return
+static enum chan_status receive_in_queue(chan_t* channel, void** data, uint64_t deadline_nsec)
+{
+    void* message = NULL;
+    enum chan_status status = wait_in_queue(channel, &channel->receive_queue, &message, deadline_nsec);
+    channel_unlock(channel);
+    if (status == SUCCESS) {
+        // The sender put the message in the buffer and took it out for us, so there is no new room to report
+        *data = message;
+        budget_release(channel->budget, channel->budget_cost);
+    }
+    return status;
+}
+
+// Publishes a send or receive and waits until a combiner, possibly the calling thread, has applied it
+// Returns the request's outcome, WOULDBLOCK meaning the buffer was full (sends) or empty (receives)
+static enum chan_status combine(chan_t* channel, bool is_send, void** data)
+{
+    struct chan_combine_request request;
+    request.is_send = is_send;
+    request.data = *data;
+    atomic_init(&request.state, COMBINE_PENDING);
+    sem_init(&request.sem, 0, 0);
+    request.next = atomic_load(&channel->combine_head);
+    while (!atomic_compare_exchange_weak(&channel->combine_head, &request.next, &request)) {
+    }
+    // Either we see the mutex free, or its holder sees our request after unlocking
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (int spin = 0; atomic_load_explicit(&request.state, memory_order_acquire) != COMBINE_DONE; spin++) {
+        if (pthread_mutex_trylock(&channel->mutex) == 0) {
+            combine_requests(channel, &request);
+            channel_unlock(channel);
+            continue;
+        }
+        if (spin < COMBINE_SPINS) {
+            sched_yield();
+            continue;
+        }
+        int expected = COMBINE_PENDING;
+        if (!atomic_compare_exchange_strong(&request.state, &expected, COMBINE_PARKED)) {
+            continue; // Done meanwhile
+        }
+        // The holder we lost the mutex to, or one after it, applies the request on unlocking and posts sem
+        while (sem_wait(&request.sem) != 0) {
+        }
+        break;
+    }
+    sem_destroy(&request.sem);
+    *data = request.data;
+    return request.status;
+}
+
+// Repeats a combined send or receive that found the buffer full or empty until it completes, sleeping in between on a
+// semaphore registered like a select's rather than on the channel's conditions, which would release the mutex unapplied
+// deadline_nsec is when to give up, 0 to wait without limit
+// Returns the request's outcome, WOULDBLOCK only once the deadline passed, or OTHER_ERROR if out of memory
+static enum chan_status combine_wait(chan_t* channel, bool is_send, void** data, uint64_t deadline_nsec)
+{
+    sem_t sem;
+    sem_init(&sem, 0, 0);
+    chan_waiters_t* waiters = is_send ? &channel->send_waiters : &channel->receive_waiters;
+    if (!chan_waiters_register(waiters, &sem)) {
+        sem_destroy(&sem);
+        return OTHER_ERROR;
+    }
+    
+    // Registered before trying again, so a send or receive completing after the attempt posts sem
+    enum chan_status status;
+    while ((status = combine(channel, is_send, data)) == WOULDBLOCK) {
+        if (deadline_nsec == 0) {
+            sem_wait(&sem);
+            continue;
+        }
+        uint64_t now_nsec = monotonic_nsec();
+        if (now_nsec >= deadline_nsec) {
+            break;
+        }
+        // sem_timedwait takes CLOCK_REALTIME
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake = nsec_to_timespec((uint64_t)wake.tv_sec * 1000000000ull + (uint64_t)wake.tv_nsec + (deadline_nsec - now_nsec));
+        sem_timedwait(&sem, &wake);
+    }
+    
+    chan_waiters_unregister(waiters, &sem);
+    sem_destroy(&sem);
+    return status;
+}
+
+// channel_receive and channel_receive_timeout with combining, deadline_nsec as for combine_wait
+static enum chan_status combine_receive(chan_t* channel, void** data, bool blocking, uint64_t deadline_nsec)
+{
+    void* message = NULL;
+    enum chan_status status = combine(channel, false, &message);
+    if (status == WOULDBLOCK && blocking) {
+        status = combine_wait(channel, false, &message, deadline_nsec);
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
+    *data = message;
+    budget_release(channel->budget, channel->budget_cost);
+    chan_waiters_notify(&channel->send_waiters);
+    return SUCCESS;
+}
+
+// Waits until a blocked receive can take a message from the buffer, as the wake policy allows
+// deadline_nsec is when to give up, 0 to wait without limit
+// Must be called with the channel's mutex held
+// Returns SUCCESS once there is a message to take, CLOSED_ERROR if the channel was closed, or WOULDBLOCK if the deadline passed first
+static enum chan_status wait_to_receive(chan_t* channel, uint64_t deadline_nsec)
+{
+    while (true) {
+        if (channel->closed) {
+            return CLOSED_ERROR;
+        }
+        size_t depth = buffer_current_size(channel->buffer);
+        uint64_t wake_nsec = deadline_nsec;
+        if (depth > 0) {
+            if (channel->wake_depth == 0 || channel->wake_order != CHAN_WAKE_BARGING || depth >= channel->wake_depth) {
+                return SUCCESS;
+            }
+            // hold off until the batch is complete or the oldest message waited long enough
+            uint64_t batch_nsec = channel->oldest_nsec + channel->wake_delay_nsec;
+            if (monotonic_nsec() >= batch_nsec) {
+                return SUCCESS;
+            }
+            if (wake_nsec == 0 || batch_nsec < wake_nsec) {
+                wake_nsec = batch_nsec;
+            }
+        }
+        if (deadline_nsec != 0 && monotonic_nsec() >= deadline_nsec) {
+            // take what is there rather than nothing
+            return (depth > 0) ? SUCCESS : WOULDBLOCK;
+        }
+        if (wake_nsec == 0) {
+            pthread_cond_wait(&channel->receive_condition, &channel->mutex);
+        } else {
+            struct timespec wake = nsec_to_timespec(wake_nsec);
+            pthread_cond_timedwait(&channel->receive_condition, &channel->mutex, &wake);
+        }
+        channel->receive_wakeups++;
+    }
+}
+
+// Cancels a sender waiting for budget credits once the channel is closed
+static bool channel_closed(void* arg)
+{
+    chan_t* channel = arg;
+    pthread_mutex_lock(&channel->mutex);
+    bool closed = channel->closed;
+    channel_unlock(channel);
+    return closed;
+}
+
+// Creates a channel around buffer, or returns NULL (freeing buffer) if that fails
+static chan_t* channel_create_buffer(buffer_t* buffer) {
+    if (buffer == NULL) {
+        return NULL;
+    }
     chan_t* channel = (chan_t*)malloc(sizeof(chan_t)); // Memory allocation for new channel struct
     
     if (channel == NULL) {
+        buffer_free(buffer);
         return NULL; // Check if memory allocation failed
     }
 
     // Initialize the buffer
-    channel->buffer = buffer_create(size); // Memory allocation for creating buffer under channel
+    channel->buffer = buffer;
 
     // Initialize mutex and conditions
     pthread_mutex_init(&channel->mutex, NULL);
-    pthread_mutex_init(&channel->send_list_mutex, NULL);
-    pthread_mutex_init(&channel->receive_list_mutex, NULL);
     pthread_cond_init(&channel->send_condition, NULL);
-    pthread_cond_init(&channel->receive_condition, NULL);
+    // Receive waits may time out, measure them on the monotonic clock
+    pthread_condattr_t receive_attr;
+    pthread_condattr_init(&receive_attr);
+    pthread_condattr_setclock(&receive_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&channel->receive_condition, &receive_attr);
+    pthread_condattr_destroy(&receive_attr);
     
-    // Initialize the lists for select
-    channel->send_list = list_create();
-    channel->receive_list = list_create();
+    // Wake whichever thread gets there first by default
+    channel->wake_order = CHAN_WAKE_BARGING;
+    wait_queue_init(&channel->send_queue);
+    wait_queue_init(&channel->receive_queue);
+    
+    // Operations lock the mutex themselves until combining is asked for
+    channel->combining = false;
+    atomic_init(&channel->combine_head, NULL);
+    atomic_init(&channel->combined, 0);
+    
+    // No elimination array until one is asked for
+    channel->exchange = NULL;
+    channel->exchange_slots = 0;
+    atomic_init(&channel->exchange_closed, false);
+    atomic_init(&channel->exchanges, 0);
+    
+    // Initialize the waiter stacks for select
+    chan_waiters_init(&channel->send_waiters);
+    chan_waiters_init(&channel->receive_waiters);
     
     // Initialize close flag
     channel->closed = false;
+    
+    // Initialize depth tracking
+    channel->peak_size = 0;
+    
+    // Wake receivers on every send by default
+    channel->wake_depth = 0;
+    channel->wake_delay_nsec = 0;
+    channel->oldest_nsec = 0;
+    channel->receive_wakeups = 0;
+    
+    // No send hook until one is installed
+    channel->send_hook = NULL;
+    channel->send_hook_arg = NULL;
+    channel->send_hook_deferred = false;
+    atomic_init(&channel->send_hook_running, 0);
+    
+    // No budget until one is set
+    channel->budget = NULL;
+    channel->budget_cost = 0;
 
     return channel;
 }
 
+// Creates a new channel with the provided size and returns it to the caller
+// A 0 size indicates an unbuffered channel, whereas a positive size indicates a buffered channel
+chan_t* channel_create(size_t size) {
+    return channel_create_buffer(buffer_create(size)); // Memory allocation for creating buffer under channel
+}
+
+// Creates a buffered channel whose ring is mapped with buffer_create_large, for sizes in the millions
+// Memory is committed as the channel fills rather than up front; with release_idle it is returned as receives move past it
+// huge_pages maps the ring on explicit huge pages, reserved for the whole size, when the pool has enough (see buffer_create_large)
+// Returns NULL if the ring could not be mapped
+chan_t* channel_create_large(size_t size, bool release_idle, bool huge_pages) {
+    return channel_create_buffer(buffer_create_large(size, release_idle, huge_pages));
+}
+
 // Writes data to the given channel
 // This can be both a blocking call i.e., the function only returns on a successful completion of send (blocking = true), and
 // a non-blocking call i.e., the function simply returns if the channel is full (blocking = false)
@@ -43,24 +742,73 @@ enum chan_status channel_send(chan_t* channel, void* data, bool blocking)
         return OTHER_ERROR; // Taking invalid arguments
     }
     
-    // Lock the buffer
-    if (blocking) {
-        pthread_mutex_lock(&channel->mutex);
-    } else {
-    	// Use trylock instead of lock in non blocking
-        if (pthread_mutex_lock(&channel->mutex) != 0) {
-            return WOULDBLOCK;
+    // Take the message's credits before locking, waiting for them must not hold up the channel's receivers
+    // A closed channel is reported as such even when the budget is used up
+    if (channel->budget != NULL) {
+        if (atomic_load_explicit(&channel->exchange_closed, memory_order_acquire)) {
+            return CLOSED_ERROR;
+        }
+        if (budget_acquire(channel->budget, 1, channel->budget_cost, blocking, channel_closed, channel) == 0) {
+            return blocking ? CLOSED_ERROR : WOULDBLOCK;
+        }
+    }
+    
+    // A send finding the mutex free keeps it, one finding it contended first tries to meet a receiver in the elimination array
+    bool locked = false;
+    if (channel->exchange != NULL) {
+        locked = (pthread_mutex_trylock(&channel->mutex) == 0);
+        if (!locked && !atomic_load_explicit(&channel->exchange_closed, memory_order_acquire) &&
+            exchange_send(channel, data, blocking)) {
+            return SUCCESS;
+        }
+    }
+    
+    // With combining, let the mutex holder apply the send; a blocking send finding the buffer full tries again once there is room
+    if (channel->combining) {
+        void* message = data;
+        enum chan_status status = combine(channel, true, &message);
+        if (status == WOULDBLOCK && blocking) {
+            status = combine_wait(channel, true, &message, 0);
+        }
+        if (status != SUCCESS) {
+            budget_release(channel->budget, channel->budget_cost);
+            return status;
+        }
+        chan_waiters_notify(&channel->receive_waiters);
+        return SUCCESS;
+    }
+    
+    // Lock the buffer, unless the elimination check above already holds it
+    if (!locked) {
+        if (blocking) {
+            pthread_mutex_lock(&channel->mutex);
+        } else {
+        	// Use trylock instead of lock in non blocking
+            if (pthread_mutex_lock(&channel->mutex) != 0) {
+                return WOULDBLOCK;
+            }
         }
     }
 
     // Initial check if the channel is closed
     if (channel->closed) {
-        pthread_mutex_unlock(&channel->mutex);
+        channel_unlock(channel);
+        budget_release(channel->budget, channel->budget_cost);
         return CLOSED_ERROR;
     }
 
     // Perform checks for space in the buffer
-    if (blocking) {
+    if (blocking && channel->wake_order != CHAN_WAKE_BARGING) {
+        if (buffer_capacity(channel->buffer) - buffer_current_size(channel->buffer) == 0) {
+            // Wait in line, a receive moves the message into the buffer for us
+            enum chan_status status = wait_in_queue(channel, &channel->send_queue, &data, 0);
+            channel_unlock(channel);
+            if (status != SUCCESS) {
+                budget_release(channel->budget, channel->budget_cost);
+            }
+            return status;
+        }
+    } else if (blocking) {
         // Blocking
         while (buffer_capacity(channel->buffer) - buffer_current_size(channel->buffer) == 0) {
             // Perform wait on send to wait for space in channel for data
@@ -68,38 +816,155 @@ enum chan_status channel_send(chan_t* channel, void* data, bool blocking)
             
             // Check if the channel is closed while channel_send is running
             if (channel->closed) {
-                pthread_mutex_unlock(&channel->mutex);
+                channel_unlock(channel);
+                budget_release(channel->budget, channel->budget_cost);
                 return CLOSED_ERROR;
             }
         }
     } else {
     	// Non-blocking
         if (buffer_capacity(channel->buffer) - buffer_current_size(channel->buffer) == 0) {
-            pthread_mutex_unlock(&channel->mutex);
+            channel_unlock(channel);
+            budget_release(channel->budget, channel->budget_cost);
             return WOULDBLOCK;
         }
     }
 
     // Perform the send operation
     buffer_add(data, channel->buffer);
+    
+    // Track the deepest the buffer has been
+    if (buffer_current_size(channel->buffer) > channel->peak_size) {
+        channel->peak_size = buffer_current_size(channel->buffer);
+    }
+    
+    // Let the hook see the new depth while it is still accurate
+    call_send_hook(channel);
 
     // Signal that there is a filled slot in the buffer
-    pthread_cond_signal(&channel->receive_condition);
+    notify_receivers(channel, 1);
     
     // Unlock the mutex
-    pthread_mutex_unlock(&channel->mutex);
+    channel_unlock(channel);
     
-    // Lock mutex of receive list
-    pthread_mutex_lock(&channel->receive_list_mutex);
+    // Notify receive waiters that there is filled slot in buffer (Channel is available to receive)
+    chan_waiters_notify(&channel->receive_waiters);
     
-    if (list_count(channel->receive_list) != 0) {
-        list_foreach(channel->receive_list, (void *) sem_post); // Notify receive list that there is filled slot in buffer (Channel is available to receive)
+    return SUCCESS;
+}
+
+// Writes count messages from data to the given channel in order, taking the lock and waking receivers once per run of messages that fit
+// Blocking calls wait for space until every message is written, non-blocking calls write as many as fit right away
+// sent (if not NULL) receives the number of messages written, which may be less than count on any return other than SUCCESS
+// Returns SUCCESS if every message was written,
+// WOULDBLOCK if the channel filled up before every message was written (non-blocking calls only),
+// CLOSED_ERROR if the channel is closed, and
+// OTHER_ERROR on encountering any other generic error of any sort
+// The send hook is called once per run of messages written; the messages always go through the buffer, never the elimination array
+// With combining, each message is a combined send of its own
+enum chan_status channel_send_batch(chan_t* channel, void** data, size_t count, bool blocking, size_t* sent)
+{
+    if (sent != NULL) {
+        *sent = 0;
+    }
+    if (channel == NULL || (data == NULL && count > 0)) {
+        return OTHER_ERROR; // Taking invalid arguments
     }
     
-    // Unlock mutex of receive list
-    pthread_mutex_unlock(&channel->receive_list_mutex);
+    size_t done = 0;
+    enum chan_status status = SUCCESS;
+    if (channel->combining) {
+        // One combined send per message, so that the batch takes its turn behind requests published before it
+        while (done < count && (status = channel_send(channel, data[done], blocking)) == SUCCESS) {
+            done++;
+        }
+        if (sent != NULL) {
+            *sent = done;
+        }
+        return status;
+    }
+    while (done < count) {
+        // Take credits for as much of the rest as the budget has room for
+        size_t granted = count - done;
+        if (channel->budget != NULL) {
+            if (atomic_load_explicit(&channel->exchange_closed, memory_order_acquire)) {
+                status = CLOSED_ERROR;
+                break;
+            }
+            granted = budget_acquire(channel->budget, count - done, channel->budget_cost, blocking, channel_closed, channel);
+            if (granted == 0) {
+                status = blocking ? CLOSED_ERROR : WOULDBLOCK;
+                break;
+            }
+        }
+        
+        pthread_mutex_lock(&channel->mutex);
+        
+        if (channel->wake_order != CHAN_WAKE_BARGING && blocking && !channel->closed &&
+            buffer_capacity(channel->buffer) - buffer_current_size(channel->buffer) == 0) {
+            // Wait in line for the next message, a receive moves it into the buffer for us
+            void* message = data[done];
+            status = wait_in_queue(channel, &channel->send_queue, &message, 0);
+            channel_unlock(channel);
+            if (status != SUCCESS) {
+                budget_release(channel->budget, granted * channel->budget_cost);
+                break;
+            }
+            done++;
+            budget_release(channel->budget, (granted - 1) * channel->budget_cost);
+            continue;
+        }
+        
+        // Check if the channel is closed, also after every wait
+        while (!channel->closed && buffer_capacity(channel->buffer) - buffer_current_size(channel->buffer) == 0 && blocking) {
+            pthread_cond_wait(&channel->send_condition, &channel->mutex);
+        }
+        if (channel->closed) {
+            channel_unlock(channel);
+            budget_release(channel->budget, granted * channel->budget_cost);
+            status = CLOSED_ERROR;
+            break;
+        }
+        
+        // Write as many messages as fit
+        size_t added = 0;
+        while (added < granted && buffer_current_size(channel->buffer) < buffer_capacity(channel->buffer)) {
+            buffer_add(data[done + added], channel->buffer);
+            added++;
+        }
+        if (added == 0) {
+            // Non-blocking and full
+            channel_unlock(channel);
+            budget_release(channel->budget, granted * channel->budget_cost);
+            status = WOULDBLOCK;
+            break;
+        }
+        done += added;
+        
+        // Track the deepest the buffer has been
+        if (buffer_current_size(channel->buffer) > channel->peak_size) {
+            channel->peak_size = buffer_current_size(channel->buffer);
+        }
+        
+        // Let the hook see the new depth while it is still accurate
+        call_send_hook(channel);
+        
+        // Signal the filled slots
+        notify_receivers(channel, added);
+        
+        channel_unlock(channel);
+        
+        // Return the credits of messages that did not fit
+        budget_release(channel->budget, (granted - added) * channel->budget_cost);
+        
+        // Notify receive waiters once for the whole run
+        chan_waiters_notify(&channel->receive_waiters);
+    }
     
-    return SUCCESS;
+    if (sent != NULL) {
+        *sent = done;
+    }
+    return status;
 }
 
 // Reads data from the given channel and stores it in the function’s input parameter, data (Note that it is a double pointer).
@@ -116,39 +981,54 @@ enum chan_status channel_receive(chan_t* channel, void** data, bool blocking)
         return OTHER_ERROR; // Taking invalid arguments
     }
     
-    // Lock the buffer
-    if (blocking) {
-        pthread_mutex_lock(&channel->mutex);
-    } else {
-    	// Use trylock instead of lock in non blocking
-        if (pthread_mutex_lock(&channel->mutex) != 0) {
-            return WOULDBLOCK;
+    // A receive finding the mutex free keeps it, one finding it contended first tries to meet a sender in the elimination array
+    bool locked = false;
+    if (channel->exchange != NULL) {
+        locked = (pthread_mutex_trylock(&channel->mutex) == 0);
+        if (!locked && !atomic_load_explicit(&channel->exchange_closed, memory_order_acquire) &&
+            exchange_receive(channel, data, blocking)) {
+            return SUCCESS;
+        }
+    }
+    
+    // With combining, let the mutex holder apply the receive; a blocking receive finding the buffer empty tries again once there is data
+    if (channel->combining) {
+        return combine_receive(channel, data, blocking, 0);
+    }
+    
+    // Lock the buffer, unless the elimination check above already holds it
+    if (!locked) {
+        if (blocking) {
+            pthread_mutex_lock(&channel->mutex);
+        } else {
+        	// Use trylock instead of lock in non blocking
+            if (pthread_mutex_lock(&channel->mutex) != 0) {
+                return WOULDBLOCK;
+            }
         }
     }
 
     // Initial check if the channel is closed
     if (channel->closed) {
-        pthread_mutex_unlock(&channel->mutex);
+        channel_unlock(channel);
         return CLOSED_ERROR;
     }
 
     // Perform checks for data in the buffer
-    if (blocking) {
-    	// Blocking
-        while (buffer_current_size(channel->buffer) == 0) {
-            // Perform wait on receive to wait for data present
-            pthread_cond_wait(&channel->receive_condition, &channel->mutex);
-            
-            // Check if the channel is closed while channel_receive is running
-            if (channel->closed) {
-                pthread_mutex_unlock(&channel->mutex);
-                return CLOSED_ERROR;
-            }
+    if (blocking && channel->wake_order != CHAN_WAKE_BARGING && buffer_current_size(channel->buffer) == 0) {
+        // Wait in line, a send hands the message to us
+        return receive_in_queue(channel, data, 0);
+    } else if (blocking) {
+    	// Blocking, wait for data present
+        if (wait_to_receive(channel, 0) == CLOSED_ERROR) {
+            // The channel was closed while channel_receive is running
+            channel_unlock(channel);
+            return CLOSED_ERROR;
         }
     } else {
     	// Non blocking
         if (buffer_current_size(channel->buffer) == 0) {
-            pthread_mutex_unlock(&channel->mutex);
+            channel_unlock(channel);
             return WOULDBLOCK;
         }
     }
@@ -157,19 +1037,16 @@ enum chan_status channel_receive(chan_t* channel, void** data, bool blocking)
     *data = buffer_remove(channel->buffer);
 
     // Signal that there is an empty slot in the buffer
-    pthread_cond_signal(&channel->send_condition);
+    notify_senders(channel, 1);
     
     // Unlock the mutex
-    pthread_mutex_unlock(&channel->mutex);
+    channel_unlock(channel);
     
-    // Lock mutex for send list
-    pthread_mutex_lock(&channel->send_list_mutex);
+    // Return the message's credits
+    budget_release(channel->budget, channel->budget_cost);
     
-    if (list_count(channel->send_list) != 0) {
-        list_foreach(channel->send_list, (void *) sem_post); // Notify send list that there is empty slot in buffer (Channel is available to send)
-    }
-    // Lock mutex for send list
-    pthread_mutex_unlock(&channel->send_list_mutex);
+    // Notify send waiters that there is empty slot in buffer (Channel is available to send)
+    chan_waiters_notify(&channel->send_waiters);
     
     return SUCCESS;
 }
@@ -189,41 +1066,37 @@ enum chan_status channel_close(chan_t* channel)
     pthread_mutex_lock(&channel->mutex);
     
     if (channel->closed == true) {
-        pthread_mutex_unlock(&channel->mutex);
+        channel_unlock(channel);
         return CLOSED_ERROR; // Called close on closed channel
     }
 
 
     // Set the closed flag
     channel->closed = true;
+    atomic_store_explicit(&channel->exchange_closed, true, memory_order_release);
     
 
     // Broadcast to wake up any waiting threads
     pthread_cond_broadcast(&channel->send_condition);
     pthread_cond_broadcast(&channel->receive_condition);
     
-    // Unlock the mutex
-    pthread_mutex_unlock(&channel->mutex);
-    
-    // Update send list
-    // Lock mutex for send list
-    pthread_mutex_lock(&channel->send_list_mutex);
-    
-    if (list_count(channel->send_list) != 0) {
-        list_foreach(channel->send_list, (void *) sem_post); // Notify send list that channel is closed
+    // Queued threads give up too
+    while (channel->send_queue.head != NULL) {
+        wait_queue_wake(&channel->send_queue, channel->send_queue.head, CLOSED_ERROR);
+    }
+    while (channel->receive_queue.head != NULL) {
+        wait_queue_wake(&channel->receive_queue, channel->receive_queue.head, CLOSED_ERROR);
     }
-    // Unlock mutex for send list
-    pthread_mutex_unlock(&channel->send_list_mutex);
     
-    // Update receive list
-    // Lock mutex for receive list
-    pthread_mutex_lock(&channel->receive_list_mutex);
+    // Unlock the mutex
+    channel_unlock(channel);
     
-    if (list_count(channel->receive_list) != 0) {
-        list_foreach(channel->receive_list, (void *) sem_post); // Notify receive list that channel is closed
-    }
-    // Unlock mutex for receive list
-    pthread_mutex_unlock(&channel->receive_list_mutex);
+    // Senders waiting for budget credits give up too
+    budget_wake(channel->budget);
+    
+    // Notify send and receive waiters that channel is closed
+    chan_waiters_notify(&channel->send_waiters);
+    chan_waiters_notify(&channel->receive_waiters);
 
     return SUCCESS;
     
@@ -244,19 +1117,23 @@ enum chan_status channel_destroy(chan_t* channel)
     	return DESTROY_ERROR; // Called destroy on open channel
     }
 
+    // Return the credits of messages never received
+    budget_release(channel->budget, buffer_current_size(channel->buffer) * channel->budget_cost);
+    
     // Free the buffer
     buffer_free(channel->buffer);
     
     // Destroy mutex and cond
     pthread_mutex_destroy(&channel->mutex);
-    pthread_mutex_destroy(&channel->send_list_mutex);
-    pthread_mutex_destroy(&channel->receive_list_mutex);
     pthread_cond_destroy(&channel->send_condition);
     pthread_cond_destroy(&channel->receive_condition);
     
-    // Destroy lists
-    list_destroy(channel->send_list);
-    list_destroy(channel->receive_list);
+    // Free the elimination array
+    free(channel->exchange);
+    
+    // Free the waiter stacks
+    chan_waiters_free(&channel->send_waiters);
+    chan_waiters_free(&channel->receive_waiters);
 
     // Free the channel structure
     free(channel);
@@ -264,6 +1141,342 @@ enum chan_status channel_destroy(chan_t* channel)
     return SUCCESS;
 }
 
+// Same as a blocking channel_receive, but gives up once timeout_nsec nanoseconds have passed without data
+// Returns WOULDBLOCK if the timeout expired before any data arrived, otherwise the same as channel_receive
+enum chan_status channel_receive_timeout(chan_t* channel, void** data, uint64_t timeout_nsec)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    // Compute the deadline on the clock receive_condition waits on
+    uint64_t deadline_nsec = monotonic_nsec() + timeout_nsec;
+    
+    if (channel->combining) {
+        return combine_receive(channel, data, true, deadline_nsec);
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    
+    if (!channel->closed && channel->wake_order != CHAN_WAKE_BARGING && buffer_current_size(channel->buffer) == 0) {
+        // Wait in line until the deadline
+        return receive_in_queue(channel, data, deadline_nsec);
+    }
+    
+    // Wait for data until the deadline
+    enum chan_status status = wait_to_receive(channel, deadline_nsec);
+    if (status != SUCCESS) {
+        channel_unlock(channel);
+        return status;
+    }
+    
+    // Perform the receive operation
+    *data = buffer_remove(channel->buffer);
+
+    // Signal that there is an empty slot in the buffer
+    notify_senders(channel, 1);
+    
+    // Unlock the mutex
+    channel_unlock(channel);
+    
+    // Return the message's credits
+    budget_release(channel->budget, channel->budget_cost);
+    
+    // Notify send waiters that there is empty slot in buffer
+    chan_waiters_notify(&channel->send_waiters);
+    
+    return SUCCESS;
+}
+
+// Reads up to max messages from the given channel into data under one lock, in FIFO order
+// Blocking calls wait for at least one message (subject to the wake policy), non-blocking calls return what is buffered
+// received (if not NULL) receives the number of messages read
+// Returns SUCCESS if at least one message was read, WOULDBLOCK if the channel was empty (non-blocking calls only),
+// CLOSED_ERROR if the channel is closed, and OTHER_ERROR on encountering any other generic error of any sort
+// Messages are only taken from the buffer, never from senders waiting in the elimination array
+// With combining, each message is a combined receive of its own
+enum chan_status channel_receive_batch(chan_t* channel, void** data, size_t max, bool blocking, size_t* received)
+{
+    if (received != NULL) {
+        *received = 0;
+    }
+    if (channel == NULL || data == NULL || max == 0) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    if (channel->combining) {
+        // One combined receive per message, so that the batch takes its turn behind requests published before it
+        enum chan_status status = channel_receive(channel, &data[0], blocking);
+        size_t count = (status == SUCCESS) ? 1 : 0;
+        while (status == SUCCESS && count < max && channel_receive(channel, &data[count], false) == SUCCESS) {
+            count++;
+        }
+        if (received != NULL) {
+            *received = count;
+        }
+        return status;
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    
+    enum chan_status status = SUCCESS;
+    if (channel->closed) {
+        status = CLOSED_ERROR;
+    } else if (blocking && channel->wake_order != CHAN_WAKE_BARGING && buffer_current_size(channel->buffer) == 0) {
+        // Wait in line, a send hands one message to us
+        status = receive_in_queue(channel, data, 0);
+        if (status == SUCCESS && received != NULL) {
+            *received = 1;
+        }
+        return status;
+    } else if (blocking) {
+        status = wait_to_receive(channel, 0);
+    } else if (buffer_current_size(channel->buffer) == 0) {
+        status = WOULDBLOCK;
+    }
+    if (status != SUCCESS) {
+        channel_unlock(channel);
+        return status;
+    }
+    
+    // Take everything up to max
+    size_t count = 0;
+    while (count < max && buffer_current_size(channel->buffer) > 0) {
+        data[count++] = buffer_remove(channel->buffer);
+    }
+    
+    // Signal the empty slots
+    notify_senders(channel, count);
+    
+    channel_unlock(channel);
+    
+    // Return the batch's credits
+    budget_release(channel->budget, count * channel->budget_cost);
+    
+    // Notify send waiters once for the whole batch
+    chan_waiters_notify(&channel->send_waiters);
+    
+    if (received != NULL) {
+        *received = count;
+    }
+    return SUCCESS;
+}
+
+// Makes blocked receivers sleep until depth messages are buffered or the oldest buffered message has waited delay_nsec,
+// so that they wake up to a batch rather than to every message
+// A blocked receiver is still woken once when the first message arrives, to start waiting for the delay
+// depth 0 (the default) restores waking receivers on every send; select calls are not affected
+void channel_set_wake_policy(chan_t* channel, size_t depth, uint64_t delay_nsec)
+{
+    if (channel == NULL) {
+        return; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    if (channel->wake_depth == 0 && depth > 0 && buffer_current_size(channel->buffer) > 0) {
+        // The inline send path does not stamp the oldest message, start its delay now
+        channel->oldest_nsec = monotonic_nsec();
+    }
+    channel->wake_depth = depth;
+    channel->wake_delay_nsec = delay_nsec;
+    // Receivers waiting under the old policy re-evaluate it
+    pthread_cond_broadcast(&channel->receive_condition);
+    channel_unlock(channel);
+}
+
+// Chooses which blocked sender gets room freed by a receive and which blocked receiver gets a new message
+// CHAN_WAKE_BARGING (the default) wakes any of them and lets them race non-waiting threads for it, which gives the best throughput;
+// CHAN_WAKE_FIFO hands it to the longest waiting thread, bounding how long an unlucky one waits under contention
+// CHAN_WAKE_LIFO hands messages to the most recently blocked receiver instead (senders stay FIFO), so that a pool of workers
+// keeps reusing the few with warm caches while the others stay asleep, or time out of channel_receive_timeout and retire
+// Queued orders ignore the wake policy; must be called before other threads block on the channel
+// Returns SUCCESS, or OTHER_ERROR if order is unknown, threads are blocked on the channel or it uses elimination or combining
+enum chan_status channel_set_wake_order(chan_t* channel, enum chan_wake_order order)
+{
+    if (channel == NULL || (order != CHAN_WAKE_BARGING && order != CHAN_WAKE_FIFO && order != CHAN_WAKE_LIFO)) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    if (channel->send_queue.count != 0 || channel->receive_queue.count != 0) {
+        channel_unlock(channel);
+        return OTHER_ERROR; // Queued threads would be left behind
+    }
+    if (order != CHAN_WAKE_BARGING && (channel->exchange != NULL || channel->combining)) {
+        channel_unlock(channel);
+        return OTHER_ERROR; // Exchanged or combined messages would bypass the queue
+    }
+    channel->wake_order = order;
+    channel_unlock(channel);
+    return SUCCESS;
+}
+
+// Gives the channel an elimination array of slots slots, 0 removing it
+// A send or receive that finds the channel's mutex held first looks for the opposite operation in the array and, if one is
+// waiting or turns up shortly, hands the message over directly instead of queueing for the mutex; a non-blocking call only pairs
+// with an operation already waiting there. channel_send_batch, channel_receive_batch and channel_receive_timeout always go
+// through the buffer, a batch would gain nothing from pairing off one message at a time
+// This mode is explicitly relaxed: a message exchanged this way overtakes messages still buffered, even ones from the same sender,
+// and is never seen by the send hook; use it for channels whose receivers do not depend on the order of messages
+// Must be called before other threads use the channel
+// Returns SUCCESS, or OTHER_ERROR if the channel has a budget, a queued wake order or combining, or out of memory
+enum chan_status channel_set_elimination(chan_t* channel, size_t slots)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    chan_exchange_t* exchange = NULL;
+    if (slots > 0) {
+        exchange = (chan_exchange_t*)calloc(slots, sizeof(chan_exchange_t));
+        if (exchange == NULL) {
+            return OTHER_ERROR;
+        }
+        for (size_t i = 0; i < slots; i++) {
+            atomic_init(&exchange[i].state, EXCHANGE_EMPTY);
+        }
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    if (slots > 0 && (channel->budget != NULL || channel->wake_order != CHAN_WAKE_BARGING || channel->combining)) {
+        channel_unlock(channel);
+        free(exchange);
+        return OTHER_ERROR; // Exchanged messages would bypass the budget, the queue or the combiner
+    }
+    free(channel->exchange);
+    channel->exchange = exchange;
+    channel->exchange_slots = slots;
+    channel_unlock(channel);
+    return SUCCESS;
+}
+
+// Returns the number of messages passed through the channel's elimination array
+size_t channel_exchanges(chan_t* channel)
+{
+    if (channel == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    return atomic_load_explicit(&channel->exchanges, memory_order_relaxed);
+}
+
+// Switches the channel to flat combining (or back, enabled = false)
+// A send or receive publishes its request on the channel; whichever thread gets the mutex applies every published request to the
+// buffer in one pass and completes them, while the others spin briefly and then park until theirs is done. Under heavy contention
+// the mutex and the buffer's indices then stay in one core's cache instead of moving with every operation
+// Every call that takes the mutex applies the published requests before releasing it. Batches are combined one message at a
+// time, and a blocking call that cannot complete right away sleeps like a select and publishes again once woken, ignoring the
+// wake policy
+// Must be called before other threads use the channel
+// Returns SUCCESS, or OTHER_ERROR if the channel has a queued wake order or an elimination array
+enum chan_status channel_set_combining(chan_t* channel, bool enabled)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    if (enabled && (channel->wake_order != CHAN_WAKE_BARGING || channel->exchange != NULL)) {
+        channel_unlock(channel);
+        return OTHER_ERROR; // The combiner would bypass the queue or race the exchanges
+    }
+    channel->combining = enabled;
+    channel_unlock(channel);
+    return SUCCESS;
+}
+
+// Returns the number of sends and receives a combiner applied on behalf of another thread
+size_t channel_combined(chan_t* channel)
+{
+    if (channel == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    return atomic_load_explicit(&channel->combined, memory_order_relaxed);
+}
+
+// Returns the number of times a receiver blocked in channel_receive, channel_receive_timeout or channel_receive_batch was woken
+size_t channel_receive_wakeups(chan_t* channel)
+{
+    if (channel == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    size_t wakeups = channel->receive_wakeups;
+    channel_unlock(channel);
+    
+    return wakeups;
+}
+
+// Installs hook to be called on every successful send to the channel, replacing any previous hook
+// Passing NULL removes the hook; once this returns the previous hook is no longer running or going to be called
+void channel_set_send_hook(chan_t* channel, chan_send_hook_t hook, void* arg)
+{
+    if (channel == NULL) {
+        return; // Taking invalid arguments
+    }
+    
+    // Hooks run with the mutex held, so swapping under it waits out a running hook; deferred calls are waited out after
+    pthread_mutex_lock(&channel->mutex);
+    channel->send_hook = hook;
+    channel->send_hook_arg = arg;
+    channel->send_hook_deferred = false;
+    channel_unlock(channel);
+    while (atomic_load(&channel->send_hook_running) != 0) {
+        sched_yield();
+    }
+}
+
+// Charges every message buffered in the channel cost credits of budget, shared with the other channels using it
+// Sends wait for credits (or return WOULDBLOCK if non-blocking) once the budget is used up, receives return the credits
+// Passing NULL removes the budget; must be called while the channel is empty and before other threads use it
+// Returns SUCCESS, or OTHER_ERROR if the channel holds messages, uses elimination, or cost is 0 or more than the budget's limit
+enum chan_status channel_set_budget(chan_t* channel, struct chan_budget* budget, size_t cost)
+{
+    if (channel == NULL || (budget != NULL && (cost == 0 || cost > budget->limit))) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    if (buffer_current_size(channel->buffer) > 0 || (budget != NULL && channel->exchange != NULL)) {
+        // Their credits were never taken, or exchanged messages would never be charged
+        channel_unlock(channel);
+        return OTHER_ERROR;
+    }
+    channel->budget = budget;
+    channel->budget_cost = (budget != NULL) ? cost : 0;
+    channel_unlock(channel);
+    
+    return SUCCESS;
+}
+
+// Returns the number of messages currently buffered in the channel
+size_t channel_depth(chan_t* channel)
+{
+    if (channel == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    size_t depth = buffer_current_size(channel->buffer);
+    channel_unlock(channel);
+    
+    return depth;
+}
+
+// Returns the largest number of messages the channel's buffer has held at once since it was created
+size_t channel_peak_size(chan_t* channel)
+{
+    if (channel == NULL) {
+        return 0; // Taking invalid arguments
+    }
+    
+    pthread_mutex_lock(&channel->mutex);
+    size_t peak_size = channel->peak_size;
+    channel_unlock(channel);
+    
+    return peak_size;
+}
+
 // Takes an array of channels, channel_list, of type select_t and the array length, channel_count, as inputs
 // This API iterates over the provided list and finds the set of possible channels which can be used to invoke the required operation (send or receive) specified in select_t
 // If multiple options are available, it selects the first option and performs its corresponding action
@@ -272,6 +1485,36 @@ enum chan_status channel_destroy(chan_t* channel)
 // In the event that a channel is closed or encounters any error, the error should be propagated and returned through select
 // Additionally, selected_index is set to the index of the channel that generated the error
 enum chan_status channel_select(size_t channel_count, select_t* channel_list, size_t* selected_index)
+{
+    return channel_select_wakeups(channel_count, channel_list, selected_index, NULL);
+}
+
+// Returns whether entry index is the first one of the list on its channel and direction
+static bool select_first_entry(select_t* channel_list, size_t index)
+{
+    for (size_t i = 0; i < index; i++) {
+        if (channel_list[i].channel == channel_list[index].channel && channel_list[i].is_send == channel_list[index].is_send) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Unregisters sem from the channels of the first count entries
+static void select_unregister(select_t* channel_list, size_t count, sem_t* sem)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!select_first_entry(channel_list, i)) {
+            continue;
+        }
+        chan_t* channel = channel_list[i].channel;
+        chan_waiters_unregister(channel_list[i].is_send ? &channel->send_waiters : &channel->receive_waiters, sem);
+    }
+}
+
+// Same as channel_select, additionally stores in wakeups (if not NULL) the number of times the caller was woken while blocked
+// When it is non-zero, every wakeup except the last one found no channel ready and was spurious
+enum chan_status channel_select_wakeups(size_t channel_count, select_t* channel_list, size_t* selected_index, size_t* wakeups)
 {
 
     if (channel_count == 0 || channel_list == NULL) {
@@ -279,6 +1522,8 @@ enum chan_status channel_select(size_t channel_count, select_t* channel_list, si
     }
     // Initialize status to return, OTHER_ERROR by default for debug
     enum chan_status status = OTHER_ERROR;
+    // Number of times sem_local woke this call up
+    size_t wake_count = 0;
     
     // Initialize local semaphore
     sem_t sem_local;
@@ -287,29 +1532,17 @@ enum chan_status channel_select(size_t channel_count, select_t* channel_list, si
     }
     
     for (size_t i = 0; i < channel_count; i++) {
-        // Insert channels into send or receive list based on value of is_send
-        if (channel_list[i].is_send == true) {
-            // Send channels
-            // Lock mutex
-            pthread_mutex_lock(&channel_list[i].channel->send_list_mutex);
-            
-            // Check if channel's semaphore is already in the send list
-            if (list_find(channel_list[i].channel->send_list, &sem_local) == NULL) {
-                list_insert(channel_list[i].channel->send_list, &sem_local); // Insert its semaphore if not in list
-            }
-            // Unlock mutex
-            pthread_mutex_unlock(&channel_list[i].channel->send_list_mutex);
-        } else {
-            // Receive channels
-            // Lock mutex
-            pthread_mutex_lock(&channel_list[i].channel->receive_list_mutex);
-            
-            // Check if channel is already in the receive list
-            if (list_find(channel_list[i].channel->receive_list, &sem_local) == NULL) {
-                list_insert(channel_list[i].channel->receive_list, &sem_local); // Insert its semaphore if not in list
-            }
-            // Unlock mutex
-            pthread_mutex_unlock(&channel_list[i].channel->receive_list_mutex);
+        // Register the semaphore with each channel once per direction
+        if (!select_first_entry(channel_list, i)) {
+            continue;
+        }
+        chan_t* channel = channel_list[i].channel;
+        chan_waiters_t* waiters = channel_list[i].is_send ? &channel->send_waiters : &channel->receive_waiters;
+        if (!chan_waiters_register(waiters, &sem_local)) {
+            select_unregister(channel_list, i, &sem_local);
+            sem_destroy(&sem_local);
+            *selected_index = i;
+            return OTHER_ERROR; // Out of memory
         }
     }
     while (true) {
@@ -317,54 +1550,33 @@ enum chan_status channel_select(size_t channel_count, select_t* channel_list, si
             // Loop through channel_list to perform send/receive on first available channel in list
             if (channel_list[i].is_send == true) {
                 // Do send if can send
-                status = channel_send(channel_list[i].channel, channel_list[i].data, false);
+                status = channel_try_send(channel_list[i].channel, channel_list[i].data);
             } else {
                 // Do receive if not (can receive)
-                status = channel_receive(channel_list[i].channel, &channel_list[i].data, false);
+                status = channel_try_receive(channel_list[i].channel, &channel_list[i].data);
             }
-        
+
             if (status != WOULDBLOCK) {
                 // Return if status is not WOULDBLOCK
                 // set selected_index to channel that perform action
                 *selected_index = i;
-                for (size_t i = 0; i < channel_count; i++) {
-                    // Remove channel from send list since it is not available to send anymore
-                    if (channel_list[i].is_send == true) {
-                        // Lock mutex
-        	        pthread_mutex_lock(&channel_list[i].channel->send_list_mutex);
-        	        
-        	        // Create node for removing node in list that contains semaphore needed
-        	        list_node_t* new_node = list_find(channel_list[i].channel->send_list, &sem_local);
-        	        // Remove node if node is in the list
-        	        if (new_node != NULL) {
-                	    list_remove(channel_list[i].channel->send_list, new_node);
-            	        }
-            	        // Unlock the mutex
-            	        pthread_mutex_unlock(&channel_list[i].channel->send_list_mutex);
-            	    // Remove channel from receive list since it is not available to receive anymore
-        	    } else {
-        	        // Lock mutex
-        	        pthread_mutex_lock(&channel_list[i].channel->receive_list_mutex);
-        	        
-        	        // Create node for removing node in list that contains semaphore needed
-        	        list_node_t* new_node = list_find(channel_list[i].channel->receive_list, &sem_local);
-        	        // Remove node if node is in the list
-            	        if (new_node != NULL) {
-                	    list_remove(channel_list[i].channel->receive_list, new_node);
-            	        }
-            	        // Unlock the mutex
-            	        pthread_mutex_unlock(&channel_list[i].channel->receive_list_mutex);
-                    }
+                // Not waiting anymore, unregister from every channel
+                select_unregister(channel_list, channel_count, &sem_local);
+                // Destroy local semaphore
+                sem_destroy(&sem_local);
+
+                // Report wakeups if requested
+                if (wakeups != NULL) {
+                    *wakeups = wake_count;
                 }
-            // Destroy local semaphore
-            sem_destroy(&sem_local);
-            
-            // Return status
-            return status;
+
+                // Return status
+                return status;
+            }
         }
-    }
-    // Wait if status is WOULDBLOCK
-    sem_wait(&sem_local);
+        // Wait if status is WOULDBLOCK
+        sem_wait(&sem_local);
+        wake_count++;
     }
     // Should never be reached, return OTHER_ERROR
     return OTHER_ERROR;
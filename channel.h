@@ -7,10 +7,41 @@
 #include <semaphore.h>
 #include "buffer.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include "linked_list.h"
 
+#ifdef __cplusplus
+#include <atomic>
+#define CHAN_ATOMIC(type) std::atomic<type>
+#else
+#include <stdatomic.h>
+#define CHAN_ATOMIC(type) _Atomic(type)
+#endif
+
+// C and C++ translation units share the structs below, so every atomic member must have the size and alignment of its plain
+// type in both languages (and in C++ need no lock), which leaves the members' offsets the same either way
+#ifdef __cplusplus
+#define CHAN_ATOMIC_LAYOUT(type)                                                                                        \
+    static_assert(sizeof(std::atomic<type>) == sizeof(type) && alignof(std::atomic<type>) == alignof(type) &&          \
+                  std::atomic<type>::is_always_lock_free, "std::atomic<" #type "> is not laid out like " #type)
+#else
+#define CHAN_ATOMIC_LAYOUT(type)                                                                                        \
+    _Static_assert(sizeof(_Atomic(type)) == sizeof(type) && _Alignof(_Atomic(type)) == _Alignof(type),                 \
+                   "_Atomic(" #type ") is not laid out like " #type)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Budget shared by channels, see budget.h
+struct chan_budget;
+
+// Send or receive waiting for a combiner, see channel.c
+struct chan_combine_request;
+
 // Defines possible return values from channel functions
 enum chan_status {
     SUCCESS = 1,
@@ -20,6 +51,46 @@ enum chan_status {
     DESTROY_ERROR = -3
 };
 
+// A select call waiting on a channel, entry of a chan_waiters_t
+typedef struct chan_waiter {
+    CHAN_ATOMIC(sem_t*) sem; // Semaphore of the waiting select, NULL once unregistered (free for the next registration)
+    CHAN_ATOMIC(unsigned) posting; // Notifiers currently posting sem, unregister waits for them before the sem goes away
+    struct chan_waiter* next; // Next entry, fixed once the entry is pushed
+} chan_waiter_t;
+
+// Lock-free stack of select waiters: registering never waits for notifiers and notifiers never wait for registrants
+// Entries are never unlinked while the channel lives, unregistered ones are reused by later registrations
+typedef struct {
+    CHAN_ATOMIC(chan_waiter_t*) head; // Most recently pushed entry
+    CHAN_ATOMIC(size_t) count; // Number of registered semaphores, lets notifiers skip the walk when nobody waits
+} chan_waiters_t;
+
+// Which blocked sender or receiver gets freed room or a new message
+enum chan_wake_order {
+    CHAN_WAKE_BARGING = 0, // Whichever thread gets the mutex first, including ones that never waited; the throughput option
+    CHAN_WAKE_FIFO, // The longest waiting one, handed the room or message directly so that newcomers cannot barge ahead
+    CHAN_WAKE_LIFO // Like CHAN_WAKE_FIFO, except that messages go to the most recently blocked receiver
+};
+
+// Threads blocked in a channel using a queued wake order, see channel_set_wake_order
+typedef struct {
+    struct chan_wait_node* head; // Longest waiting thread
+    struct chan_wait_node* tail; // Most recently queued thread
+    size_t count; // Number of queued threads
+} chan_wait_queue_t;
+
+// Slot of a channel's elimination array, where a contended send and a contended receive can pair off without the mutex
+typedef struct {
+    CHAN_ATOMIC(int) state; // Who waits in the slot, see channel.c
+    void* data; // Message offered by a waiting sender or delivered to a waiting receiver
+    char padding[64 - sizeof(int) - sizeof(void*)]; // Keeps every slot on its own cache line
+} chan_exchange_t;
+
+// Called by channel_send after a message was added, with the number of messages now buffered
+// The channel is locked during the call (unlocked = false), so the hook must not use the channel or do anything slow; returning
+// true asks for one more call with unlocked = true once the mutex is released, where the hook may take its time
+typedef bool (*chan_send_hook_t)(void* arg, size_t depth, bool unlocked);
+
 // Defines channel object
 typedef struct {
     // DO NOT REMOVE buffer (OR CHANGE ITS NAME) FROM THE STRUCT
@@ -27,15 +98,43 @@ typedef struct {
     buffer_t* buffer;
     /* ADD ANY STRUCT ENTRIES YOU NEED HERE */
     pthread_mutex_t mutex; // Mutex for protecting the channel state
-    pthread_mutex_t send_list_mutex; // Mutex for protecting the channel state
-    pthread_mutex_t receive_list_mutex; // Mutex for protecting the channel state
     pthread_cond_t send_condition; // Condition variable for sender blocking
     pthread_cond_t receive_condition; //Condition variable for receiver blocking
     bool closed; // Flag indicating if the channel is closed
-    list_t* send_list; // List for send channels
-    list_t* receive_list; // List for receive channels
+    size_t peak_size; // Largest number of messages held in buffer at once
+    chan_send_hook_t send_hook; // Hook called on every successful send, NULL if none
+    void* send_hook_arg; // Argument passed to send_hook
+    bool send_hook_deferred; // send_hook asked for a call once the mutex is released
+    CHAN_ATOMIC(size_t) send_hook_running; // Deferred send_hook calls in progress
+    size_t wake_depth; // Blocked receivers are woken once this many messages are buffered, 0 wakes them on every send
+    uint64_t wake_delay_nsec; // ... or once the oldest buffered message has waited this long
+    uint64_t oldest_nsec; // When the buffer last went from empty to holding a message
+    size_t receive_wakeups; // Number of times a blocked receiver was woken
+    struct chan_budget* budget; // Budget buffered messages are charged to, NULL if none
+    size_t budget_cost; // Credits charged per buffered message
+    enum chan_wake_order wake_order; // Which blocked thread gets freed room or a new message
+    chan_wait_queue_t send_queue; // Senders blocked for room, unless barging
+    chan_wait_queue_t receive_queue; // Receivers blocked for a message, unless barging
+    chan_exchange_t* exchange; // Elimination array, NULL unless enabled
+    size_t exchange_slots; // Number of slots in exchange
+    CHAN_ATOMIC(bool) exchange_closed; // Set by channel_close, so that exchanges and budgeted sends see it without taking the mutex
+    CHAN_ATOMIC(size_t) exchanges; // Messages passed through exchange
+    bool combining; // Whether sends and receives are applied by a combiner, see channel_set_combining
+    CHAN_ATOMIC(struct chan_combine_request*) combine_head; // Requests published for the next combiner, most recent first
+    CHAN_ATOMIC(size_t) combined; // Requests applied by a thread other than the one that made them
+    chan_waiters_t send_waiters; // Select calls waiting to send
+    chan_waiters_t receive_waiters; // Select calls waiting to receive
 } chan_t;
 
+// Every type used with CHAN_ATOMIC above
+CHAN_ATOMIC_LAYOUT(sem_t*);
+CHAN_ATOMIC_LAYOUT(unsigned);
+CHAN_ATOMIC_LAYOUT(chan_waiter_t*);
+CHAN_ATOMIC_LAYOUT(size_t);
+CHAN_ATOMIC_LAYOUT(int);
+CHAN_ATOMIC_LAYOUT(bool);
+CHAN_ATOMIC_LAYOUT(struct chan_combine_request*);
+
 typedef struct {
     // Channel on which we want to perform operation
     chan_t* channel;
@@ -50,6 +149,12 @@ typedef struct {
 // A 0 size indicates an unbuffered channel, whereas a positive size indicates a buffered channel
 chan_t* channel_create(size_t size);
 
+// Creates a buffered channel whose ring is mapped with buffer_create_large, for sizes in the millions
+// Memory is committed as the channel fills rather than up front; with release_idle it is returned as receives move past it
+// huge_pages maps the ring on explicit huge pages, reserved for the whole size, when the pool has enough (see buffer_create_large)
+// Returns NULL if the ring could not be mapped
+chan_t* channel_create_large(size_t size, bool release_idle, bool huge_pages);
+
 // Writes data to the given channel
 // This can be both a blocking call i.e., the function only returns on a successful completion of send (blocking = true), and
 // a non-blocking call i.e., the function simply returns if the channel is full (blocking = false)
@@ -60,6 +165,17 @@ chan_t* channel_create(size_t size);
 // OTHER_ERROR on encountering any other generic error of any sort
 enum chan_status channel_send(chan_t* channel, void* data, bool blocking);
 
+// Writes count messages from data to the given channel in order, taking the lock and waking receivers once per run of messages that fit
+// Blocking calls wait for space until every message is written, non-blocking calls write as many as fit right away
+// sent (if not NULL) receives the number of messages written, which may be less than count on any return other than SUCCESS
+// Returns SUCCESS if every message was written,
+// WOULDBLOCK if the channel filled up before every message was written (non-blocking calls only),
+// CLOSED_ERROR if the channel is closed, and
+// OTHER_ERROR on encountering any other generic error of any sort
+// The send hook is called once per run of messages written; the messages always go through the buffer, never the elimination array
+// With combining, each message is a combined send of its own
+enum chan_status channel_send_batch(chan_t* channel, void** data, size_t count, bool blocking, size_t* sent);
+
 // Reads data from the given channel and stores it in the function’s input parameter, data (Note that it is a double pointer).
 // This can be both a blocking call i.e., the function only returns on a successful completion of receive (blocking = true), and
 // a non-blocking call i.e., the function simply returns if the channel is empty (blocking = false)
@@ -93,4 +209,107 @@ enum chan_status channel_destroy(chan_t* channel);
 // Additionally, selected_index is set to the index of the channel that generated the error
 enum chan_status channel_select(size_t channel_count, select_t* channel_list, size_t* selected_index);
 
+// Same as channel_select, additionally stores in wakeups (if not NULL) the number of times the caller was woken while blocked
+// When it is non-zero, every wakeup except the last one found no channel ready and was spurious
+enum chan_status channel_select_wakeups(size_t channel_count, select_t* channel_list, size_t* selected_index, size_t* wakeups);
+
+// Same as a blocking channel_receive, but gives up once timeout_nsec nanoseconds have passed without data
+// Returns WOULDBLOCK if the timeout expired before any data arrived, otherwise the same as channel_receive
+enum chan_status channel_receive_timeout(chan_t* channel, void** data, uint64_t timeout_nsec);
+
+// Installs hook to be called on every successful send to the channel, replacing any previous hook
+// Passing NULL removes the hook; once this returns the previous hook is no longer running or going to be called
+void channel_set_send_hook(chan_t* channel, chan_send_hook_t hook, void* arg);
+
+// Reads up to max messages from the given channel into data under one lock, in FIFO order
+// Blocking calls wait for at least one message (subject to the wake policy), non-blocking calls return what is buffered
+// received (if not NULL) receives the number of messages read
+// Returns SUCCESS if at least one message was read, WOULDBLOCK if the channel was empty (non-blocking calls only),
+// CLOSED_ERROR if the channel is closed, and OTHER_ERROR on encountering any other generic error of any sort
+// Messages are only taken from the buffer, never from senders waiting in the elimination array
+// With combining, each message is a combined receive of its own
+enum chan_status channel_receive_batch(chan_t* channel, void** data, size_t max, bool blocking, size_t* received);
+
+// Makes blocked receivers sleep until depth messages are buffered or the oldest buffered message has waited delay_nsec,
+// so that they wake up to a batch rather than to every message
+// A blocked receiver is still woken once when the first message arrives, to start waiting for the delay
+// depth 0 (the default) restores waking receivers on every send; select calls are not affected
+void channel_set_wake_policy(chan_t* channel, size_t depth, uint64_t delay_nsec);
+
+// Chooses which blocked sender gets room freed by a receive and which blocked receiver gets a new message
+// CHAN_WAKE_BARGING (the default) wakes any of them and lets them race non-waiting threads for it, which gives the best throughput;
+// CHAN_WAKE_FIFO hands it to the longest waiting thread, bounding how long an unlucky one waits under contention
+// CHAN_WAKE_LIFO hands messages to the most recently blocked receiver instead (senders stay FIFO), so that a pool of workers
+// keeps reusing the few with warm caches while the others stay asleep, or time out of channel_receive_timeout and retire
+// Queued orders ignore the wake policy; must be called before other threads block on the channel
+// Returns SUCCESS, or OTHER_ERROR if order is unknown, threads are blocked on the channel or it uses elimination or combining
+enum chan_status channel_set_wake_order(chan_t* channel, enum chan_wake_order order);
+
+// Gives the channel an elimination array of slots slots, 0 removing it
+// A send or receive that finds the channel's mutex held first looks for the opposite operation in the array and, if one is
+// waiting or turns up shortly, hands the message over directly instead of queueing for the mutex; a non-blocking call only pairs
+// with an operation already waiting there. channel_send_batch, channel_receive_batch and channel_receive_timeout always go
+// through the buffer, a batch would gain nothing from pairing off one message at a time
+// This mode is explicitly relaxed: a message exchanged this way overtakes messages still buffered, even ones from the same sender,
+// and is never seen by the send hook; use it for channels whose receivers do not depend on the order of messages
+// Must be called before other threads use the channel
+// Returns SUCCESS, or OTHER_ERROR if the channel has a budget, a queued wake order or combining, or out of memory
+enum chan_status channel_set_elimination(chan_t* channel, size_t slots);
+
+// Returns the number of messages passed through the channel's elimination array
+size_t channel_exchanges(chan_t* channel);
+
+// Switches the channel to flat combining (or back, enabled = false)
+// A send or receive publishes its request on the channel; whichever thread gets the mutex applies every published request to the
+// buffer in one pass and completes them, while the others spin briefly and then park until theirs is done. Under heavy contention
+// the mutex and the buffer's indices then stay in one core's cache instead of moving with every operation
+// Every call that takes the mutex applies the published requests before releasing it. Batches are combined one message at a
+// time, and a blocking call that cannot complete right away sleeps like a select and publishes again once woken, ignoring the
+// wake policy
+// Must be called before other threads use the channel
+// Returns SUCCESS, or OTHER_ERROR if the channel has a queued wake order or an elimination array
+enum chan_status channel_set_combining(chan_t* channel, bool enabled);
+
+// Returns the number of sends and receives a combiner applied on behalf of another thread
+size_t channel_combined(chan_t* channel);
+
+// Returns the number of times a receiver blocked in channel_receive, channel_receive_timeout or channel_receive_batch was woken
+size_t channel_receive_wakeups(chan_t* channel);
+
+// Charges every message buffered in the channel cost credits of budget, shared with the other channels using it
+// Sends wait for credits (or return WOULDBLOCK if non-blocking) once the budget is used up, receives return the credits
+// Passing NULL removes the budget; must be called while the channel is empty and before other threads use it
+// Returns SUCCESS, or OTHER_ERROR if the channel holds messages, uses elimination, or cost is 0 or more than the budget's limit
+enum chan_status channel_set_budget(chan_t* channel, struct chan_budget* budget, size_t cost);
+
+// Registers sem to be posted by chan_waiters_notify, returns false if out of memory
+// The same sem may be registered more than once and is then posted once per registration
+bool chan_waiters_register(chan_waiters_t* waiters, sem_t* sem);
+
+// Removes one registration of sem; once this returns no notifier is posting it anymore
+void chan_waiters_unregister(chan_waiters_t* waiters, sem_t* sem);
+
+// Posts every registered semaphore, without blocking registrations running at the same time
+void chan_waiters_notify(chan_waiters_t* waiters);
+
+// Returns whether any semaphore may be registered, for callers that only need to notify when someone waits
+static inline bool chan_waiters_any(chan_waiters_t* waiters)
+{
+#ifdef __cplusplus
+    return waiters->count.load(std::memory_order_relaxed) != 0;
+#else
+    return atomic_load_explicit(&waiters->count, memory_order_relaxed) != 0;
+#endif
+}
+
+// Returns the number of messages currently buffered in the channel
+size_t channel_depth(chan_t* channel);
+
+// Returns the largest number of messages the channel's buffer has held at once since it was created
+size_t channel_peak_size(chan_t* channel);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // CHANNEL_H
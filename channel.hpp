@@ -0,0 +1,326 @@
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "channel.h"
+
+namespace chan {
+
+// How many threads may send, and how many may receive, at the same time
+enum class Producers { Single, Multi };
+enum class Consumers { Single, Multi };
+
+// What a blocked send or receive does until it can go on
+enum class Wait {
+    Park, // Sleep on a condition variable, woken by the other side only when someone sleeps
+    Spin // Retry, yielding the CPU between attempts
+};
+
+// Compile-time channel policy, every combination is its own specialisation without runtime dispatch
+template <Producers P, Consumers C, Wait W = Wait::Park>
+struct Policy {
+    static constexpr bool multi_producer = (P == Producers::Multi);
+    static constexpr bool multi_consumer = (C == Consumers::Multi);
+    static constexpr bool park = (W == Wait::Park);
+};
+
+using SPSC = Policy<Producers::Single, Consumers::Single>;
+using MPSC = Policy<Producers::Multi, Consumers::Single>;
+using MPMC = Policy<Producers::Multi, Consumers::Multi>;
+using SPSCSpin = Policy<Producers::Single, Consumers::Single, Wait::Spin>;
+using MPSCSpin = Policy<Producers::Multi, Consumers::Single, Wait::Spin>;
+using MPMCSpin = Policy<Producers::Multi, Consumers::Multi, Wait::Spin>;
+
+// Typed bounded channel storing its values inline, without boxing them into void*
+// Capacity must be a power of two so that ring positions are masked rather than divided
+// Values are moved in and out, so move-only types work; a failed try_send leaves its argument untouched
+// Operations return the same enum chan_status as the C API; like chan_t, a closed channel fails sends and receives with CLOSED_ERROR
+// The ring is a sequenced slot array: a position is claimed with a CAS only on the sides the policy makes concurrent
+template <class T, std::size_t Capacity, class P = MPMC>
+class Channel {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Channel capacity must be a power of two");
+    static_assert(std::is_move_constructible<T>::value, "Channel values must be move constructible");
+
+public:
+    Channel()
+    {
+        for (std::size_t i = 0; i < Capacity; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Destroys the values still buffered and the select handle, no other thread may use the channel anymore
+    ~Channel()
+    {
+        std::size_t end = send_position_.load(std::memory_order_acquire);
+        for (std::size_t pos = receive_position_.load(std::memory_order_acquire); pos != end; pos++) {
+            std::launder(reinterpret_cast<T*>(cells_[pos & mask_].storage))->~T();
+        }
+        chan_t* ready = ready_.load(std::memory_order_acquire);
+        if (ready != nullptr) {
+            channel_close(ready);
+            channel_destroy(ready);
+        }
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+    // Sends value if there is room right away
+    // Returns SUCCESS, WOULDBLOCK if the channel is full, or CLOSED_ERROR if it is closed
+    template <class U>
+    enum chan_status try_send(U&& value)
+    {
+        if (closed_.load(std::memory_order_acquire)) {
+            return CLOSED_ERROR;
+        }
+        if (!push(std::forward<U>(value))) {
+            return WOULDBLOCK;
+        }
+        after_push();
+        return SUCCESS;
+    }
+
+    // Sends value, waiting for room as the policy says
+    // Returns SUCCESS, or CLOSED_ERROR if the channel is or gets closed
+    template <class U>
+    enum chan_status send(U&& value)
+    {
+        while (true) {
+            enum chan_status status = try_send(std::forward<U>(value));
+            if (status != WOULDBLOCK) {
+                return status;
+            }
+            wait(send_waiters_, send_condition_, [this] { return !full(); });
+        }
+    }
+
+    // Moves the oldest value into out if there is one
+    // Returns SUCCESS, WOULDBLOCK if the channel is empty, or CLOSED_ERROR if it is closed
+    enum chan_status try_receive(T& out)
+    {
+        if (closed_.load(std::memory_order_acquire)) {
+            return CLOSED_ERROR;
+        }
+        if (!pop(out)) {
+            return WOULDBLOCK;
+        }
+        after_pop();
+        return SUCCESS;
+    }
+
+    // Moves the oldest value into out, waiting for one as the policy says
+    // Returns SUCCESS, or CLOSED_ERROR if the channel is or gets closed
+    enum chan_status receive(T& out)
+    {
+        while (true) {
+            enum chan_status status = try_receive(out);
+            if (status != WOULDBLOCK) {
+                return status;
+            }
+            wait(receive_waiters_, receive_condition_, [this] { return !empty(); });
+        }
+    }
+
+    // Closes the channel, waking every blocked call
+    // Returns SUCCESS, or CLOSED_ERROR if the channel was already closed
+    enum chan_status close()
+    {
+        if (closed_.exchange(true, std::memory_order_acq_rel)) {
+            return CLOSED_ERROR;
+        }
+        if constexpr (P::park) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            send_condition_.notify_all();
+            receive_condition_.notify_all();
+        }
+        chan_t* ready = ready_.load(std::memory_order_acquire);
+        if (ready != nullptr) {
+            channel_close(ready);
+        }
+        return SUCCESS;
+    }
+
+    // Returns a C channel to pass to channel_select as a RECV entry standing in for this channel
+    // It carries a token whenever this channel may have a value; once select picks it, call try_receive,
+    // which may still return WOULDBLOCK if another receiver was faster. Select reports CLOSED_ERROR once this channel is closed
+    // Sends only pay for the token after the first call
+    chan_t* select_handle()
+    {
+        chan_t* ready = ready_.load(std::memory_order_acquire);
+        if (ready != nullptr) {
+            return ready;
+        }
+        chan_t* created = channel_create(1);
+        if (!ready_.compare_exchange_strong(ready, created, std::memory_order_acq_rel)) {
+            // another thread installed its handle first
+            channel_close(created);
+            channel_destroy(created);
+            return ready;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (closed_.load(std::memory_order_acquire)) {
+            channel_close(created);
+        } else if (!empty()) {
+            channel_send(created, nullptr, false);
+        }
+        return created;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence; // Position the cell is ready to be written at, or that plus one once written
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static constexpr std::size_t mask_ = Capacity - 1;
+    static constexpr std::size_t cache_line_ = 64;
+
+    // Claims the next position of one side of the ring, returning the cell or nullptr if the ring is full or empty
+    // offset is 0 for the producer side and 1 for the consumer side
+    template <bool Shared>
+    Cell* claim(std::atomic<std::size_t>& position, std::size_t offset, std::size_t& claimed)
+    {
+        std::size_t pos = position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &cells_[pos & mask_];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = (std::intptr_t)sequence - (std::intptr_t)(pos + offset);
+            if (diff < 0) {
+                return nullptr;
+            }
+            if (diff > 0) {
+                // another thread of this side took the position
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+            if constexpr (Shared) {
+                if (!position.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    continue;
+                }
+            } else {
+                position.store(pos + 1, std::memory_order_relaxed);
+            }
+            claimed = pos;
+            return cell;
+        }
+    }
+
+    template <class U>
+    bool push(U&& value)
+    {
+        std::size_t pos;
+        Cell* cell = claim<P::multi_producer>(send_position_, 0, pos);
+        if (cell == nullptr) {
+            return false;
+        }
+        new (cell->storage) T(std::forward<U>(value));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out)
+    {
+        std::size_t pos;
+        Cell* cell = claim<P::multi_consumer>(receive_position_, 1, pos);
+        if (cell == nullptr) {
+            return false;
+        }
+        T* value = std::launder(reinterpret_cast<T*>(cell->storage));
+        out = std::move(*value);
+        value->~T();
+        cell->sequence.store(pos + Capacity, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        std::size_t pos = receive_position_.load(std::memory_order_acquire);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    bool full() const
+    {
+        std::size_t pos = send_position_.load(std::memory_order_acquire);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) != pos;
+    }
+
+    void after_push()
+    {
+        // pairs with the fences of wait and select_handle: either they see the value or we see them
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake(receive_waiters_, receive_condition_);
+        chan_t* ready = ready_.load(std::memory_order_acquire);
+        if (ready != nullptr) {
+            // a token already waiting covers this value too
+            channel_send(ready, nullptr, false);
+        }
+    }
+
+    void after_pop()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake(send_waiters_, send_condition_);
+        chan_t* ready = ready_.load(std::memory_order_acquire);
+        if (ready != nullptr && !empty()) {
+            // select took the token for the value just received, put it back for the rest
+            channel_send(ready, nullptr, false);
+        }
+    }
+
+    // Wakes one sleeper of the other side, touching the mutex only if one is registered
+    // Must follow a seq_cst fence
+    void wake(std::atomic<std::size_t>& waiters, std::condition_variable& condition)
+    {
+        if constexpr (P::park) {
+            if (waiters.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                condition.notify_one();
+            }
+        }
+    }
+
+    // Waits until ready() or the channel closes
+    template <class Ready>
+    void wait(std::atomic<std::size_t>& waiters, std::condition_variable& condition, Ready ready)
+    {
+        if constexpr (P::park) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            condition.wait(lock, [&] { return ready() || closed_.load(std::memory_order_acquire); });
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        } else {
+            for (unsigned spins = 0; !ready() && !closed_.load(std::memory_order_acquire); spins++) {
+                if (spins >= 64) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    Cell cells_[Capacity];
+    alignas(cache_line_) std::atomic<std::size_t> send_position_{0};
+    alignas(cache_line_) std::atomic<std::size_t> receive_position_{0};
+    alignas(cache_line_) std::atomic<bool> closed_{false};
+    std::atomic<chan_t*> ready_{nullptr}; // Token channel handed to channel_select, created on first use
+    std::atomic<std::size_t> send_waiters_{0}; // Senders parked on send_condition_
+    std::atomic<std::size_t> receive_waiters_{0}; // Receivers parked on receive_condition_
+    std::mutex mutex_;
+    std::condition_variable send_condition_;
+    std::condition_variable receive_condition_;
+};
+
+} // namespace chan
+
+#endif // CHANNEL_HPP
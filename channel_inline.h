@@ -0,0 +1,112 @@
+#ifndef CHANNEL_INLINE_H
+#define CHANNEL_INLINE_H
+
+#include "channel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Inline non-blocking fast paths, so that polling loops in other translation units skip the call into channel.c
+// The uncontended case is handled right here; a contended mutex or a channel with a send hook, budget, wake policy,
+// queued wake order, large ring, elimination array or combining falls back to channel_send / channel_receive
+// Select waiters are still notified, with a call only when there are any
+
+// Same as channel_send(channel, data, false)
+static inline enum chan_status channel_try_send(chan_t* channel, void* data)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    if (channel->combining) {
+        // Publish the request instead, a mutex taken here would have to be left through the combiner
+        return channel_send(channel, data, false);
+    }
+    if (pthread_mutex_trylock(&channel->mutex) != 0) {
+        // Contended, let the out-of-line path wait for the mutex
+        return channel_send(channel, data, false);
+    }
+    if (channel->send_hook != NULL || channel->budget != NULL || channel->wake_depth > 0 || channel->buffer->large ||
+        channel->wake_order != CHAN_WAKE_BARGING || channel->exchange != NULL) {
+        pthread_mutex_unlock(&channel->mutex);
+        return channel_send(channel, data, false);
+    }
+    if (channel->closed) {
+        pthread_mutex_unlock(&channel->mutex);
+        return CLOSED_ERROR;
+    }
+    buffer_t* buffer = channel->buffer;
+    if (buffer->size >= buffer->capacity) {
+        pthread_mutex_unlock(&channel->mutex);
+        return WOULDBLOCK;
+    }
+
+    // Same ring arithmetic as buffer_add
+    size_t pos = buffer->next + buffer->size;
+    if (pos >= buffer->capacity) {
+        pos -= buffer->capacity;
+    }
+    buffer->data[pos] = data;
+    buffer->size++;
+    if (buffer->size > channel->peak_size) {
+        channel->peak_size = buffer->size;
+    }
+    pthread_cond_signal(&channel->receive_condition);
+    pthread_mutex_unlock(&channel->mutex);
+
+    if (chan_waiters_any(&channel->receive_waiters)) {
+        chan_waiters_notify(&channel->receive_waiters);
+    }
+    return SUCCESS;
+}
+
+// Same as channel_receive(channel, data, false)
+static inline enum chan_status channel_try_receive(chan_t* channel, void** data)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    if (channel->combining) {
+        // Publish the request instead, a mutex taken here would have to be left through the combiner
+        return channel_receive(channel, data, false);
+    }
+    if (pthread_mutex_trylock(&channel->mutex) != 0) {
+        // Contended, let the out-of-line path wait for the mutex
+        return channel_receive(channel, data, false);
+    }
+    if (channel->budget != NULL || channel->buffer->large || channel->wake_order != CHAN_WAKE_BARGING ||
+        channel->exchange != NULL) {
+        pthread_mutex_unlock(&channel->mutex);
+        return channel_receive(channel, data, false);
+    }
+    if (channel->closed) {
+        pthread_mutex_unlock(&channel->mutex);
+        return CLOSED_ERROR;
+    }
+    buffer_t* buffer = channel->buffer;
+    if (buffer->size == 0) {
+        pthread_mutex_unlock(&channel->mutex);
+        return WOULDBLOCK;
+    }
+
+    // Same ring arithmetic as buffer_remove
+    *data = buffer->data[buffer->next];
+    buffer->size--;
+    buffer->next++;
+    if (buffer->next >= buffer->capacity) {
+        buffer->next -= buffer->capacity;
+    }
+    pthread_cond_signal(&channel->send_condition);
+    pthread_mutex_unlock(&channel->mutex);
+
+    if (chan_waiters_any(&channel->send_waiters)) {
+        chan_waiters_notify(&channel->send_waiters);
+    }
+    return SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHANNEL_INLINE_H
@@ -0,0 +1,306 @@
+#include <assert.h>
+#include "distance_vector.h"
+
+// Creates a pool of vectors holding length distances each
+vector_pool_t* vector_pool_create(size_t length)
+{
+    vector_pool_t* pool = malloc(sizeof(vector_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->free_list = NULL;
+    pool->all = NULL;
+    pool->allocated = 0;
+    pool->capacity = 0;
+    pool->length = length;
+    return pool;
+}
+
+// Frees the pool and all its vectors
+// Every vector must have been released back to the pool
+void vector_pool_destroy(vector_pool_t* pool)
+{
+    size_t free_count = 0;
+    for (distance_vector_t* vector = pool->free_list; vector != NULL; vector = vector->next_free) {
+        free_count++;
+    }
+    assert(free_count == pool->allocated);
+    for (size_t i = 0; i < pool->allocated; i++) {
+        free(pool->all[i]);
+    }
+    free(pool->all);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+// Takes a vector from the pool (allocating one if the pool is empty) with a reference count of one
+distance_vector_t* vector_pool_acquire(vector_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    distance_vector_t* vector = pool->free_list;
+    if (vector != NULL) {
+        pool->free_list = vector->next_free;
+    } else {
+        // grow the pool
+        if (pool->allocated == pool->capacity) {
+            pool->capacity = (pool->capacity == 0) ? 4 : pool->capacity * 2;
+            pool->all = realloc(pool->all, sizeof(distance_vector_t*) * pool->capacity);
+            assert(pool->all != NULL);
+        }
+        // room for the largest encoding, sparse with 32-bit distances
+        vector = malloc(sizeof(distance_vector_t) + sizeof(uint32_t) * 2 * (pool->length + 1));
+        assert(vector != NULL);
+        vector->pool = pool;
+        vector->length = pool->length;
+        pool->all[pool->allocated++] = vector;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    vector->next_free = NULL;
+    atomic_store(&vector->refcount, 1);
+    return vector;
+}
+
+// Adds count references to the vector
+void vector_retain(distance_vector_t* vector, size_t count)
+{
+    atomic_fetch_add(&vector->refcount, count);
+}
+
+// Drops one reference to the vector, returning it to its pool when no references remain
+void vector_release(distance_vector_t* vector)
+{
+    size_t previous = atomic_fetch_sub(&vector->refcount, 1);
+    assert(previous > 0);
+    if (previous == 1) {
+        vector_pool_t* pool = vector->pool;
+        pthread_mutex_lock(&pool->mutex);
+        vector->next_free = pool->free_list;
+        pool->free_list = vector;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+// Returns the number of payload bytes an encoding needs
+static size_t encoded_bytes(enum vector_encoding encoding, bool wide, size_t length, size_t finite, size_t runs)
+{
+    size_t width = wide ? sizeof(distance_t) : sizeof(uint16_t);
+    switch (encoding) {
+    case VECTOR_SPARSE:
+        return finite * (sizeof(uint32_t) + width);
+    case VECTOR_RUNS:
+        return runs * 2 * sizeof(uint32_t) + finite * width;
+    default:
+        return length * width;
+    }
+}
+
+// Returns where the distances start in the vector's payload
+static inline void* vector_values(const distance_vector_t* vector)
+{
+    switch (vector->encoding) {
+    case VECTOR_SPARSE:
+        return (void*)(vector->payload + vector->count);
+    case VECTOR_RUNS:
+        return (void*)(vector->payload + 2 * vector->count);
+    default:
+        return (void*)vector->payload;
+    }
+}
+
+// Reads the distance at position i of a values array
+static inline distance_t value_at(const void* values, bool wide, size_t i)
+{
+    if (wide) {
+        return ((const distance_t*)values)[i];
+    }
+    uint16_t value = ((const uint16_t*)values)[i];
+    return (value == NARROW_INF_DISTANCE) ? inf_distance : value;
+}
+
+// Writes the distance at position i of a values array
+static inline void set_value_at(void* values, bool wide, size_t i, distance_t distance)
+{
+    if (wide) {
+        ((distance_t*)values)[i] = distance;
+    } else {
+        ((uint16_t*)values)[i] = (distance == inf_distance) ? (uint16_t)NARROW_INF_DISTANCE : (uint16_t)distance;
+    }
+}
+
+// Lowers dist[i] to candidate if that is shorter, recording hop in next_hop (if not NULL)
+// Returns true if dist[i] changed
+static inline bool merge_entry(distance_t* dist, size_t i, distance_t candidate, size_t* next_hop, size_t hop)
+{
+    if (candidate < dist[i]) {
+        dist[i] = candidate;
+        if (next_hop != NULL) {
+            next_hop[i] = hop;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Stores the pool's length distances from dist in the vector using the given encoding
+// Distances are stored in 16 bits when every finite one fits, except with VECTOR_DENSE which keeps the 32-bit layout
+void vector_encode(distance_vector_t* vector, const distance_t* dist, enum vector_encoding encoding)
+{
+    vector_encode_keep(vector, dist, NULL, encoding);
+}
+
+// Returns whether entry i is stored by the sparse and runs encodings
+static inline bool entry_present(const distance_t* dist, const bool* keep, size_t i)
+{
+    return (dist[i] != inf_distance) || (keep != NULL && keep[i]);
+}
+
+// Same as vector_encode, but the inf_distance entries of dist marked in keep (if not NULL) are stored explicitly
+// rather than skipped by the sparse and runs encodings
+void vector_encode_keep(distance_vector_t* vector, const distance_t* dist, const bool* keep, enum vector_encoding encoding)
+{
+    size_t length = vector->length;
+    // measure the vector
+    size_t stored = 0;
+    size_t runs = 0;
+    distance_t max_distance = 0;
+    bool in_run = false;
+    for (size_t i = 0; i < length; i++) {
+        if (entry_present(dist, keep, i)) {
+            if (!in_run) {
+                runs++;
+            }
+            in_run = true;
+            stored++;
+            if (dist[i] != inf_distance && dist[i] > max_distance) {
+                max_distance = dist[i];
+            }
+        } else {
+            in_run = false;
+        }
+    }
+    bool wide = (encoding == VECTOR_DENSE) || (max_distance >= NARROW_INF_DISTANCE);
+    if (encoding == VECTOR_AUTO) {
+        // pick the smallest encoding
+        encoding = VECTOR_DENSE;
+        if (encoded_bytes(VECTOR_SPARSE, wide, length, stored, runs) < encoded_bytes(encoding, wide, length, stored, runs)) {
+            encoding = VECTOR_SPARSE;
+        }
+        if (encoded_bytes(VECTOR_RUNS, wide, length, stored, runs) < encoded_bytes(encoding, wide, length, stored, runs)) {
+            encoding = VECTOR_RUNS;
+        }
+    }
+    vector->encoding = encoding;
+    vector->wide = wide;
+    vector->bytes = encoded_bytes(encoding, wide, length, stored, runs);
+    switch (encoding) {
+    case VECTOR_SPARSE:
+        vector->count = stored;
+        break;
+    case VECTOR_RUNS:
+        vector->count = runs;
+        break;
+    default:
+        vector->count = length;
+        break;
+    }
+    // fill the payload
+    void* values = vector_values(vector);
+    if (encoding == VECTOR_DENSE) {
+        for (size_t i = 0; i < length; i++) {
+            set_value_at(values, wide, i, dist[i]);
+        }
+    } else if (encoding == VECTOR_SPARSE) {
+        size_t entry = 0;
+        for (size_t i = 0; i < length; i++) {
+            if (entry_present(dist, keep, i)) {
+                vector->payload[entry] = (uint32_t)i;
+                set_value_at(values, wide, entry, dist[i]);
+                entry++;
+            }
+        }
+    } else {
+        size_t run = 0;
+        size_t entry = 0;
+        for (size_t i = 0; i < length; i++) {
+            if (entry_present(dist, keep, i)) {
+                if (i == 0 || !entry_present(dist, keep, i - 1)) {
+                    // start a new run
+                    vector->payload[2 * run] = (uint32_t)i;
+                    vector->payload[2 * run + 1] = 0;
+                    run++;
+                }
+                vector->payload[2 * (run - 1) + 1]++;
+                set_value_at(values, wide, entry, dist[i]);
+                entry++;
+            }
+        }
+    }
+}
+
+// Writes the vector's distances into dist, which must hold length entries
+void vector_decode(const distance_vector_t* vector, distance_t* dist)
+{
+    const void* values = vector_values(vector);
+    if (vector->encoding == VECTOR_DENSE) {
+        for (size_t i = 0; i < vector->length; i++) {
+            dist[i] = value_at(values, vector->wide, i);
+        }
+        return;
+    }
+    for (size_t i = 0; i < vector->length; i++) {
+        dist[i] = inf_distance;
+    }
+    if (vector->encoding == VECTOR_SPARSE) {
+        for (size_t entry = 0; entry < vector->count; entry++) {
+            dist[vector->payload[entry]] = value_at(values, vector->wide, entry);
+        }
+    } else {
+        size_t entry = 0;
+        for (size_t run = 0; run < vector->count; run++) {
+            size_t start = vector->payload[2 * run];
+            size_t run_length = vector->payload[2 * run + 1];
+            for (size_t i = start; i < start + run_length; i++) {
+                dist[i] = value_at(values, vector->wide, entry++);
+            }
+        }
+    }
+}
+
+// Lowers each entry of dist to offset + the vector's distance where that is shorter, skipping inf_distance entries
+// If next_hop is not NULL, the matching entries of next_hop are set to hop for every lowered distance
+// Returns true if any entry of dist changed
+bool vector_merge(const distance_vector_t* vector, distance_t offset, distance_t* dist, size_t* next_hop, size_t hop)
+{
+    bool changed = false;
+    const void* values = vector_values(vector);
+    if (vector->encoding == VECTOR_DENSE) {
+        for (size_t i = 0; i < vector->length; i++) {
+            distance_t distance = value_at(values, vector->wide, i);
+            if (distance != inf_distance) {
+                changed |= merge_entry(dist, i, offset + distance, next_hop, hop);
+            }
+        }
+    } else if (vector->encoding == VECTOR_SPARSE) {
+        // entries kept by vector_encode_keep may be inf_distance
+        for (size_t entry = 0; entry < vector->count; entry++) {
+            distance_t distance = value_at(values, vector->wide, entry);
+            if (distance != inf_distance) {
+                changed |= merge_entry(dist, vector->payload[entry], offset + distance, next_hop, hop);
+            }
+        }
+    } else {
+        size_t entry = 0;
+        for (size_t run = 0; run < vector->count; run++) {
+            size_t start = vector->payload[2 * run];
+            size_t run_length = vector->payload[2 * run + 1];
+            for (size_t i = start; i < start + run_length; i++) {
+                distance_t distance = value_at(values, vector->wide, entry++);
+                if (distance != inf_distance) {
+                    changed |= merge_entry(dist, i, offset + distance, next_hop, hop);
+                }
+            }
+        }
+    }
+    return changed;
+}
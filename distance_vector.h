@@ -0,0 +1,86 @@
+#ifndef DISTANCE_VECTOR_H
+#define DISTANCE_VECTOR_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef unsigned int distance_t;
+
+static const distance_t inf_distance = 0x7fffffff;
+
+// Marks inf_distance in vectors holding 16-bit distances
+#define NARROW_INF_DISTANCE 0xffffu
+
+// Ways a vector's distances can be laid out in its payload
+enum vector_encoding {
+    VECTOR_AUTO = 0, // Encode each snapshot with whichever of the encodings below is smallest
+    VECTOR_DENSE, // One distance per destination
+    VECTOR_SPARSE, // Destination indices of the finite distances, followed by those distances
+    VECTOR_RUNS // (start, length) of each run of finite distances, followed by the distances; runs of inf_distance are skipped
+};
+
+typedef struct vector_pool vector_pool_t;
+
+// Immutable snapshot of a router's distances, shared by reference between the owner and its neighbours
+// A vector must not be written once it has been handed out, and returns to its pool when the last reference is released
+typedef struct distance_vector {
+    size_t src;
+    size_t epoch;
+    atomic_size_t refcount; // Number of holders, the vector goes back to pool when it drops to zero
+    vector_pool_t* pool; // Pool the vector was taken from
+    struct distance_vector* next_free; // Link in the pool's free list
+    size_t length; // Number of destinations the vector covers
+    enum vector_encoding encoding; // Layout of payload, never VECTOR_AUTO
+    bool wide; // Distances are stored as distance_t, otherwise as uint16_t
+    size_t count; // Destinations (dense), stored distances (sparse) or runs (runs) in payload
+    size_t bytes; // Bytes of payload in use
+    uint32_t payload[0];
+} distance_vector_t;
+
+// Per-router pool of vectors of a fixed length
+struct vector_pool {
+    pthread_mutex_t mutex; // Mutex protecting free_list, vectors may be released from any thread
+    distance_vector_t* free_list; // Vectors ready for reuse
+    distance_vector_t** all; // Every vector allocated by the pool
+    size_t allocated; // Number of entries in all
+    size_t capacity; // Allocated length of all
+    size_t length; // Number of distances per vector
+};
+
+// Creates a pool of vectors holding length distances each
+vector_pool_t* vector_pool_create(size_t length);
+
+// Frees the pool and all its vectors
+// Every vector must have been released back to the pool
+void vector_pool_destroy(vector_pool_t* pool);
+
+// Takes a vector from the pool (allocating one if the pool is empty) with a reference count of one
+distance_vector_t* vector_pool_acquire(vector_pool_t* pool);
+
+// Adds count references to the vector
+void vector_retain(distance_vector_t* vector, size_t count);
+
+// Drops one reference to the vector, returning it to its pool when no references remain
+void vector_release(distance_vector_t* vector);
+
+// Stores the pool's length distances from dist in the vector using the given encoding
+// Distances are stored in 16 bits when every finite one fits, except with VECTOR_DENSE which keeps the 32-bit layout
+void vector_encode(distance_vector_t* vector, const distance_t* dist, enum vector_encoding encoding);
+
+// Same as vector_encode, but the inf_distance entries of dist marked in keep (if not NULL) are stored explicitly
+// rather than skipped by the sparse and runs encodings
+void vector_encode_keep(distance_vector_t* vector, const distance_t* dist, const bool* keep, enum vector_encoding encoding);
+
+// Writes the vector's distances into dist, which must hold length entries
+void vector_decode(const distance_vector_t* vector, distance_t* dist);
+
+// Lowers each entry of dist to offset + the vector's distance where that is shorter, skipping inf_distance entries
+// If next_hop is not NULL, the matching entries of next_hop are set to hop for every lowered distance
+// Returns true if any entry of dist changed
+bool vector_merge(const distance_vector_t* vector, distance_t offset, distance_t* dist, size_t* next_hop, size_t hop);
+
+#endif // DISTANCE_VECTOR_H
@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct list_node {
     struct list_node* next;
     struct list_node* prev;
@@ -46,4 +50,8 @@ void list_remove(list_t* list, list_node_t* node);
 // Executes a function for each element in the list
 void list_foreach(list_t* list, void (*func)(void* data));
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // LINKED_LIST_H
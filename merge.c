@@ -0,0 +1,156 @@
+#include <time.h>
+#include "merge.h"
+
+// Returns whether member index appears earlier in the merge too
+static bool merge_duplicate(merge_t* merge, size_t index)
+{
+    for (size_t i = 0; i < index; i++) {
+        if (merge->members[i] == merge->members[index]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Removes the merge's semaphore from the receive waiters of the first count members
+static void merge_unregister(merge_t* merge, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!merge_duplicate(merge, i)) {
+            chan_waiters_unregister(&merge->members[i]->receive_waiters, &merge->ready);
+        }
+    }
+}
+
+// Adds the merge's semaphore to every member's receive waiters, once per channel
+// Returns false, registered nowhere, if out of memory
+static bool merge_register(merge_t* merge)
+{
+    for (size_t i = 0; i < merge->count; i++) {
+        if (!merge_duplicate(merge, i) && !chan_waiters_register(&merge->members[i]->receive_waiters, &merge->ready)) {
+            merge_unregister(merge, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Creates a merge of count channels, which must stay alive until merge_destroy
+// Returns NULL if the merge could not be created
+merge_t* merge_create(chan_t** members, size_t count, enum merge_fairness fairness)
+{
+    if (members == NULL || count == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    merge_t* merge = malloc(sizeof(merge_t));
+    if (merge == NULL) {
+        return NULL;
+    }
+    merge->members = malloc(sizeof(chan_t*) * count);
+    if (merge->members == NULL || sem_init(&merge->ready, 0, 0) == -1) {
+        free(merge->members);
+        free(merge);
+        return NULL;
+    }
+    memcpy(merge->members, members, sizeof(chan_t*) * count);
+    merge->count = count;
+    merge->fairness = fairness;
+    pthread_mutex_init(&merge->mutex, NULL);
+    merge->next = 0;
+    merge->seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)merge;
+    if (!merge_register(merge)) {
+        pthread_mutex_destroy(&merge->mutex);
+        sem_destroy(&merge->ready);
+        free(merge->members);
+        free(merge);
+        return NULL;
+    }
+    return merge;
+}
+
+// Returns the member a scan starts at
+static size_t scan_start(merge_t* merge)
+{
+    if (merge->fairness == MERGE_PRIORITY) {
+        return 0;
+    }
+    pthread_mutex_lock(&merge->mutex);
+    size_t start = (merge->fairness == MERGE_RANDOM) ? (size_t)rand_r(&merge->seed) % merge->count : merge->next;
+    pthread_mutex_unlock(&merge->mutex);
+    return start;
+}
+
+// Receives a message from whichever member has one, picked according to the merge's fairness
+// member (if not NULL) receives the index of the member the message came from
+// Blocking calls wait until any member has a message, non-blocking calls return right away
+// Closed members are skipped
+// Returns SUCCESS for a successful receive,
+// WOULDBLOCK if no member had a message (non-blocking calls only),
+// CLOSED_ERROR once every member is closed, and
+// OTHER_ERROR on encountering any other generic error of any sort
+enum chan_status merge_receive(merge_t* merge, void** data, size_t* member, bool blocking)
+{
+    if (merge == NULL || data == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    
+    while (true) {
+        // Posts announcing messages that receives on the members themselves took would wake us for nothing later,
+        // so drop every post and let this scan find what they announced
+        size_t drained = 0;
+        while (sem_trywait(&merge->ready) == 0) {
+            drained++;
+        }
+        size_t start = scan_start(merge);
+        size_t closed = 0;
+        for (size_t k = 0; k < merge->count; k++) {
+            size_t i = (start + k) % merge->count;
+            enum chan_status status = channel_receive(merge->members[i], data, false);
+            if (status == SUCCESS) {
+                if (merge->fairness == MERGE_ROUND_ROBIN) {
+                    pthread_mutex_lock(&merge->mutex);
+                    merge->next = (i + 1) % merge->count;
+                    pthread_mutex_unlock(&merge->mutex);
+                }
+                // Pass a wakeup on if the member still holds messages, or a dropped post may have been meant for another
+                // receiver's message
+                if (drained > 1 || channel_depth(merge->members[i]) > 0) {
+                    sem_post(&merge->ready);
+                }
+                if (member != NULL) {
+                    *member = i;
+                }
+                return SUCCESS;
+            }
+            if (status == CLOSED_ERROR) {
+                closed++;
+            } else if (status != WOULDBLOCK) {
+                return status;
+            }
+        }
+        if (closed == merge->count) {
+            // Wake other blocked receivers so they see it too
+            sem_post(&merge->ready);
+            return CLOSED_ERROR;
+        }
+        if (!blocking) {
+            return WOULDBLOCK;
+        }
+        // A send after the scan has already posted, so this does not miss it
+        sem_wait(&merge->ready);
+    }
+}
+
+// Unregisters the merge from its members and frees it, leaving the members untouched
+// No merge_receive may be running
+void merge_destroy(merge_t* merge)
+{
+    if (merge == NULL) {
+        return; // Taking invalid arguments
+    }
+    merge_unregister(merge, merge->count);
+    sem_destroy(&merge->ready);
+    pthread_mutex_destroy(&merge->mutex);
+    free(merge->members);
+    free(merge);
+}
@@ -0,0 +1,47 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "channel.h"
+
+// Order in which a merge looks at its members when several have messages
+enum merge_fairness {
+    MERGE_ROUND_ROBIN = 0, // Start after the member that was served last, so every busy member gets a turn
+    MERGE_PRIORITY, // Always start at the first member, earlier members win
+    MERGE_RANDOM // Start at a random member
+};
+
+// Merged view receiving from whichever of several channels has a message, without forwarding threads
+// The merge's semaphore stays registered in every member's receive waiters, so a send to any member wakes a blocked merge_receive
+// Members may also be received from directly; the posts for messages taken that way are dropped before the merge's next scan
+typedef struct {
+    chan_t** members; // Channels merged, owned by the caller
+    size_t count; // Number of members
+    enum merge_fairness fairness;
+    sem_t ready; // Posted by the members on every send and close, drained before every scan
+    pthread_mutex_t mutex; // Mutex protecting the fields below
+    size_t next; // Member the next round robin scan starts at
+    unsigned int seed; // State of the random scan start
+} merge_t;
+
+// Creates a merge of count channels, which must stay alive until merge_destroy
+// Returns NULL if the merge could not be created
+merge_t* merge_create(chan_t** members, size_t count, enum merge_fairness fairness);
+
+// Receives a message from whichever member has one, picked according to the merge's fairness
+// member (if not NULL) receives the index of the member the message came from
+// Blocking calls wait until any member has a message, non-blocking calls return right away
+// Closed members are skipped
+// Returns SUCCESS for a successful receive,
+// WOULDBLOCK if no member had a message (non-blocking calls only),
+// CLOSED_ERROR once every member is closed, and
+// OTHER_ERROR on encountering any other generic error of any sort
+enum chan_status merge_receive(merge_t* merge, void** data, size_t* member, bool blocking);
+
+// Unregisters the merge from its members and frees it, leaving the members untouched
+// No merge_receive may be running
+void merge_destroy(merge_t* merge);
+
+#endif // MERGE_H
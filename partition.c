@@ -0,0 +1,158 @@
+#include <assert.h>
+#include "partition.h"
+
+// Whether there is a link between a and b in either direction
+static bool linked(const distance_t* topology, size_t num_nodes, size_t a, size_t b)
+{
+    return (a != b) && (topology[a * num_nodes + b] != inf_distance || topology[b * num_nodes + a] != inf_distance);
+}
+
+// Undirected links of every router, neighbours[offsets[i]] to neighbours[offsets[i + 1]] being those of router i
+typedef struct {
+    size_t* offsets;
+    size_t* neighbours;
+} adjacency_t;
+
+static void adjacency_build(adjacency_t* adjacency, const distance_t* topology, size_t num_nodes)
+{
+    adjacency->offsets = calloc(num_nodes + 1, sizeof(size_t));
+    assert(adjacency->offsets != NULL);
+    for (size_t a = 0; a < num_nodes; a++) {
+        for (size_t b = 0; b < num_nodes; b++) {
+            if (linked(topology, num_nodes, a, b)) {
+                adjacency->offsets[a + 1]++;
+            }
+        }
+        adjacency->offsets[a + 1] += adjacency->offsets[a];
+    }
+    adjacency->neighbours = malloc((adjacency->offsets[num_nodes] + 1) * sizeof(size_t));
+    assert(adjacency->neighbours != NULL);
+    for (size_t a = 0; a < num_nodes; a++) {
+        size_t next = adjacency->offsets[a];
+        for (size_t b = 0; b < num_nodes; b++) {
+            if (linked(topology, num_nodes, a, b)) {
+                adjacency->neighbours[next++] = b;
+            }
+        }
+    }
+}
+
+// Moves node from part from (num_parts if it had none) to part to, keeping the links every neighbour has into each part current
+// part_links holds num_parts counters per router
+static void move_node(const adjacency_t* adjacency, size_t num_parts, size_t* partition, size_t* part_links, size_t node,
+                      size_t to)
+{
+    size_t from = partition[node];
+    for (size_t k = adjacency->offsets[node]; k < adjacency->offsets[node + 1]; k++) {
+        size_t* links = &part_links[adjacency->neighbours[k] * num_parts];
+        if (from != num_parts) {
+            links[from]--;
+        }
+        links[to]++;
+    }
+    partition[node] = to;
+}
+
+// Returns the number of undirected links in topology
+size_t count_links(const distance_t* topology, size_t num_nodes)
+{
+    size_t count = 0;
+    for (size_t a = 0; a < num_nodes; a++) {
+        for (size_t b = a + 1; b < num_nodes; b++) {
+            if (linked(topology, num_nodes, a, b)) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Assigns each of the num_nodes routers of topology (a num_nodes x num_nodes matrix of link distances)
+// to one of num_parts balanced parts, trying to keep linked routers in the same part
+// Links are treated as undirected, partition receives the part of each router
+// Returns the edge cut: the number of links whose ends ended up in different parts
+size_t partition_graph(const distance_t* topology, size_t num_nodes, size_t num_parts, size_t* partition)
+{
+    assert(num_parts > 0);
+    size_t unassigned = num_parts;
+    for (size_t i = 0; i < num_nodes; i++) {
+        partition[i] = unassigned;
+    }
+    size_t* sizes = calloc(num_parts, sizeof(size_t));
+    assert(sizes != NULL);
+    // links of each router into each part, updated as routers move so that no step rescans the topology
+    size_t* part_links = calloc(num_nodes * num_parts, sizeof(size_t));
+    assert(part_links != NULL);
+    adjacency_t adjacency;
+    adjacency_build(&adjacency, topology, num_nodes);
+
+    // grow each part from a seed, always adding the unassigned router with the most links into the part
+    for (size_t part = 0; part < num_parts; part++) {
+        size_t target = num_nodes / num_parts + (part < num_nodes % num_parts ? 1 : 0);
+        while (sizes[part] < target) {
+            size_t best = num_nodes;
+            size_t best_links = 0;
+            for (size_t i = 0; i < num_nodes; i++) {
+                if (partition[i] != unassigned) {
+                    continue;
+                }
+                size_t links = part_links[i * num_parts + part];
+                if (best == num_nodes || links > best_links) {
+                    best = i;
+                    best_links = links;
+                }
+            }
+            assert(best != num_nodes);
+            move_node(&adjacency, num_parts, partition, part_links, best, part);
+            sizes[part]++;
+        }
+    }
+
+    // refine by moving single routers to the part they have the most links into while the parts stay balanced
+    size_t min_size = num_nodes / num_parts;
+    size_t max_size = min_size + (num_nodes % num_parts != 0 ? 1 : 0);
+    bool improved = true;
+    for (size_t pass = 0; pass < 8 && improved; pass++) {
+        improved = false;
+        for (size_t i = 0; i < num_nodes; i++) {
+            size_t from = partition[i];
+            if (sizes[from] <= min_size) {
+                continue;
+            }
+            size_t from_links = part_links[i * num_parts + from];
+            size_t best = from;
+            size_t best_links = from_links;
+            for (size_t part = 0; part < num_parts; part++) {
+                if (part == from || sizes[part] >= max_size) {
+                    continue;
+                }
+                size_t links = part_links[i * num_parts + part];
+                if (links > best_links) {
+                    best = part;
+                    best_links = links;
+                }
+            }
+            if (best != from) {
+                move_node(&adjacency, num_parts, partition, part_links, i, best);
+                sizes[from]--;
+                sizes[best]++;
+                improved = true;
+            }
+        }
+    }
+    free(sizes);
+
+    size_t cut = 0;
+    for (size_t a = 0; a < num_nodes; a++) {
+        for (size_t k = adjacency.offsets[a]; k < adjacency.offsets[a + 1]; k++) {
+            size_t b = adjacency.neighbours[k];
+            if (a < b && partition[a] != partition[b]) {
+                cut++;
+            }
+        }
+    }
+    free(adjacency.offsets);
+    free(adjacency.neighbours);
+    free(part_links);
+    return cut;
+}
@@ -0,0 +1,16 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stddef.h>
+#include "distance_vector.h"
+
+// Assigns each of the num_nodes routers of topology (a num_nodes x num_nodes matrix of link distances)
+// to one of num_parts balanced parts, trying to keep linked routers in the same part
+// Links are treated as undirected, partition receives the part of each router
+// Returns the edge cut: the number of links whose ends ended up in different parts
+size_t partition_graph(const distance_t* topology, size_t num_nodes, size_t num_parts, size_t* partition);
+
+// Returns the number of undirected links in topology
+size_t count_links(const distance_t* topology, size_t num_nodes);
+
+#endif // PARTITION_H
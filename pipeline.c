@@ -0,0 +1,291 @@
+#include <assert.h>
+#include "pipeline.h"
+
+static pipeline_batch_t* batch_create(size_t batch_size, size_t seq)
+{
+    pipeline_batch_t* batch = malloc(sizeof(pipeline_batch_t) + sizeof(void*) * batch_size);
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->seq = seq;
+    batch->count = 0;
+    return batch;
+}
+
+// Thread running one of a stage's copies
+static void* stage_main(void* arg)
+{
+    pipeline_stage_t* stage = arg;
+    while (true) {
+        void* data = NULL;
+        if (channel_receive(stage->input, &data, true) != SUCCESS) {
+            // the pipeline is being destroyed
+            return NULL;
+        }
+        pipeline_batch_t* batch = data;
+        if (batch == NULL) {
+            // end of the stream, the last thread of the stage to see it passes it on
+            // the others hand it to a sibling, which can only get it once done with its own batch
+            size_t finished = atomic_fetch_add(&stage->finished, 1) + 1;
+            chan_t* next = (finished == stage->parallelism) ? stage->output : stage->input;
+            channel_send(next, NULL, true);
+            return NULL;
+        }
+        // transform the batch in place, keeping the surviving items in order
+        size_t count = 0;
+        for (size_t i = 0; i < batch->count; i++) {
+            void* item = stage->fn(batch->items[i], stage->arg);
+            if (item != NULL) {
+                batch->items[count++] = item;
+            }
+        }
+        batch->count = count;
+        if (channel_send(stage->output, batch, true) != SUCCESS) {
+            free(batch);
+            return NULL;
+        }
+    }
+}
+
+// Creates an empty pipeline moving up to batch_size items per channel operation
+// channel_size is the number of batches each channel between stages holds, ordered makes pipeline_pop return items in push order
+// Returns NULL on invalid arguments or allocation failure
+pipeline_t* pipeline_create(size_t batch_size, size_t channel_size, bool ordered)
+{
+    if (batch_size == 0 || channel_size == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    pipeline_t* pipeline = malloc(sizeof(pipeline_t));
+    if (pipeline == NULL) {
+        return NULL;
+    }
+    pipeline->batch_size = batch_size;
+    pipeline->channel_size = channel_size;
+    pipeline->ordered = ordered;
+    pipeline->started = false;
+    pipeline->stages = NULL;
+    pipeline->num_stages = 0;
+    pipeline->channels = NULL;
+    pipeline->input = NULL;
+    pipeline->next_input_seq = 0;
+    pipeline->input_closed = false;
+    pipeline->output = NULL;
+    pipeline->output_index = 0;
+    pipeline->next_output_seq = 0;
+    pipeline->held = NULL;
+    pipeline->num_held = 0;
+    pipeline->held_capacity = 0;
+    pipeline->output_closed = false;
+    return pipeline;
+}
+
+// Appends a stage running fn on parallelism threads
+// Returns false if the pipeline was already started or the arguments are invalid
+bool pipeline_add_stage(pipeline_t* pipeline, pipeline_stage_fn_t fn, void* arg, size_t parallelism)
+{
+    if (pipeline == NULL || fn == NULL || parallelism == 0 || pipeline->started) {
+        return false; // Taking invalid arguments
+    }
+    pipeline_stage_t* stages = realloc(pipeline->stages, sizeof(pipeline_stage_t) * (pipeline->num_stages + 1));
+    if (stages == NULL) {
+        return false;
+    }
+    pipeline->stages = stages;
+    pipeline_stage_t* stage = &stages[pipeline->num_stages++];
+    stage->fn = fn;
+    stage->arg = arg;
+    stage->parallelism = parallelism;
+    stage->threads = NULL;
+    stage->input = NULL;
+    stage->output = NULL;
+    atomic_init(&stage->finished, 0);
+    return true;
+}
+
+// Starts the stage threads, no stages can be added afterwards
+// Returns false if the pipeline has no stages or was already started
+bool pipeline_start(pipeline_t* pipeline)
+{
+    if (pipeline == NULL || pipeline->num_stages == 0 || pipeline->started) {
+        return false; // Taking invalid arguments
+    }
+    pipeline->channels = malloc(sizeof(chan_t*) * (pipeline->num_stages + 1));
+    assert(pipeline->channels != NULL);
+    for (size_t i = 0; i <= pipeline->num_stages; i++) {
+        pipeline->channels[i] = channel_create(pipeline->channel_size);
+        assert(pipeline->channels[i] != NULL);
+    }
+    for (size_t i = 0; i < pipeline->num_stages; i++) {
+        pipeline_stage_t* stage = &pipeline->stages[i];
+        stage->input = pipeline->channels[i];
+        stage->output = pipeline->channels[i + 1];
+        stage->threads = malloc(sizeof(pthread_t) * stage->parallelism);
+        assert(stage->threads != NULL);
+        for (size_t j = 0; j < stage->parallelism; j++) {
+            int pthread_status = pthread_create(&stage->threads[j], NULL, stage_main, stage);
+            assert(pthread_status == 0);
+        }
+    }
+    pipeline->started = true;
+    return true;
+}
+
+// Adds an item (not NULL) to the current input batch, which is sent to the first stage once full
+// Returns SUCCESS, CLOSED_ERROR after pipeline_close, or OTHER_ERROR on invalid arguments
+enum chan_status pipeline_push(pipeline_t* pipeline, void* item)
+{
+    if (pipeline == NULL || item == NULL || !pipeline->started) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    if (pipeline->input_closed) {
+        return CLOSED_ERROR;
+    }
+    if (pipeline->input == NULL) {
+        pipeline->input = batch_create(pipeline->batch_size, pipeline->next_input_seq);
+        if (pipeline->input == NULL) {
+            return OTHER_ERROR;
+        }
+    }
+    pipeline->input->items[pipeline->input->count++] = item;
+    if (pipeline->input->count == pipeline->batch_size) {
+        return pipeline_flush(pipeline);
+    }
+    return SUCCESS;
+}
+
+// Sends the current input batch to the first stage even if it is not full
+enum chan_status pipeline_flush(pipeline_t* pipeline)
+{
+    if (pipeline == NULL || !pipeline->started) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    if (pipeline->input == NULL) {
+        return SUCCESS; // Nothing to flush
+    }
+    enum chan_status status = channel_send(pipeline->channels[0], pipeline->input, true);
+    if (status == SUCCESS) {
+        pipeline->input = NULL;
+        pipeline->next_input_seq++;
+    }
+    return status;
+}
+
+// Flushes the input and marks the end of the stream, which is passed on stage by stage once every thread of a stage is done
+enum chan_status pipeline_close(pipeline_t* pipeline)
+{
+    if (pipeline == NULL || !pipeline->started) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    if (pipeline->input_closed) {
+        return CLOSED_ERROR;
+    }
+    enum chan_status status = pipeline_flush(pipeline);
+    if (status != SUCCESS) {
+        return status;
+    }
+    // closing the channels would drop the batches still in them, so the end travels as a NULL batch instead
+    status = channel_send(pipeline->channels[0], NULL, true);
+    if (status == SUCCESS) {
+        pipeline->input_closed = true;
+    }
+    return status;
+}
+
+// Takes the next batch from the output, in push order if the pipeline is ordered
+// Returns NULL once the end of the stream was reached
+static pipeline_batch_t* next_output_batch(pipeline_t* pipeline)
+{
+    while (true) {
+        if (pipeline->ordered) {
+            // the batch we want may have arrived ahead of its turn
+            for (size_t i = 0; i < pipeline->num_held; i++) {
+                if (pipeline->held[i]->seq == pipeline->next_output_seq) {
+                    pipeline_batch_t* batch = pipeline->held[i];
+                    pipeline->held[i] = pipeline->held[--pipeline->num_held];
+                    pipeline->next_output_seq++;
+                    return batch;
+                }
+            }
+        }
+        if (pipeline->output_closed) {
+            // every batch was pushed before the end of the stream, so none can be left held
+            assert(pipeline->num_held == 0);
+            return NULL;
+        }
+        void* data = NULL;
+        if (channel_receive(pipeline->channels[pipeline->num_stages], &data, true) != SUCCESS) {
+            return NULL;
+        }
+        pipeline_batch_t* batch = data;
+        if (batch == NULL) {
+            pipeline->output_closed = true;
+            continue;
+        }
+        if (!pipeline->ordered || batch->seq == pipeline->next_output_seq) {
+            pipeline->next_output_seq++;
+            return batch;
+        }
+        // hold on to the batch until the ones pushed before it came out
+        if (pipeline->num_held == pipeline->held_capacity) {
+            pipeline->held_capacity = (pipeline->held_capacity == 0) ? 8 : pipeline->held_capacity * 2;
+            pipeline->held = realloc(pipeline->held, sizeof(pipeline_batch_t*) * pipeline->held_capacity);
+            assert(pipeline->held != NULL);
+        }
+        pipeline->held[pipeline->num_held++] = batch;
+    }
+}
+
+// Takes the next item out of the pipeline, blocking until one is available
+// Returns SUCCESS, or CLOSED_ERROR once the end of the stream was reached and every item has been popped
+enum chan_status pipeline_pop(pipeline_t* pipeline, void** item)
+{
+    if (pipeline == NULL || item == NULL || !pipeline->started) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    while (pipeline->output == NULL || pipeline->output_index == pipeline->output->count) {
+        free(pipeline->output);
+        pipeline->output = next_output_batch(pipeline);
+        pipeline->output_index = 0;
+        if (pipeline->output == NULL) {
+            return CLOSED_ERROR;
+        }
+    }
+    *item = pipeline->output->items[pipeline->output_index++];
+    return SUCCESS;
+}
+
+// Stops the stage threads and frees the pipeline, including batches still in flight
+void pipeline_destroy(pipeline_t* pipeline)
+{
+    if (pipeline == NULL) {
+        return;
+    }
+    if (pipeline->started) {
+        // wake every stage thread still waiting to receive or send
+        for (size_t i = 0; i <= pipeline->num_stages; i++) {
+            channel_close(pipeline->channels[i]);
+        }
+        for (size_t i = 0; i < pipeline->num_stages; i++) {
+            for (size_t j = 0; j < pipeline->stages[i].parallelism; j++) {
+                pthread_join(pipeline->stages[i].threads[j], NULL);
+            }
+            free(pipeline->stages[i].threads);
+        }
+        for (size_t i = 0; i <= pipeline->num_stages; i++) {
+            // the threads are gone, free what was left in the channel
+            while (buffer_current_size(pipeline->channels[i]->buffer) > 0) {
+                free(buffer_remove(pipeline->channels[i]->buffer));
+            }
+            channel_destroy(pipeline->channels[i]);
+        }
+        free(pipeline->channels);
+    }
+    for (size_t i = 0; i < pipeline->num_held; i++) {
+        free(pipeline->held[i]);
+    }
+    free(pipeline->held);
+    free(pipeline->input);
+    free(pipeline->output);
+    free(pipeline->stages);
+    free(pipeline);
+}
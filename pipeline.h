@@ -0,0 +1,84 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+
+// Transforms one item of a stage, returning the item passed to the next stage or NULL to drop it
+typedef void* (*pipeline_stage_fn_t)(void* item, void* arg);
+
+// Items handed from one stage to the next with a single channel operation
+// seq numbers the batches in the order they were pushed, so the output can restore that order
+typedef struct {
+    size_t seq;
+    size_t count;
+    void* items[0];
+} pipeline_batch_t;
+
+typedef struct {
+    pipeline_stage_fn_t fn;
+    void* arg;
+    size_t parallelism; // Number of threads running the stage
+    pthread_t* threads;
+    chan_t* input; // Batches to process, followed by one NULL marking the end of the stream
+    chan_t* output; // Processed batches for the next stage (or the pipeline output)
+    atomic_size_t finished; // Threads of the stage that saw the end of the stream
+} pipeline_stage_t;
+
+// Chain of stages connected by channels carrying batches of items
+// Items are pushed by one producer and popped by one consumer, which must not be the same thread
+// unless the channels can hold everything pushed
+typedef struct {
+    size_t batch_size; // Most items per batch
+    size_t channel_size; // Batches each channel between stages can hold
+    bool ordered; // Whether items are popped in the order they were pushed
+    bool started; // Whether the stage threads are running
+    pipeline_stage_t* stages;
+    size_t num_stages;
+    chan_t** channels; // num_stages + 1 channels, the first feeds the first stage and the last holds the output
+    pipeline_batch_t* input; // Batch being filled by pipeline_push
+    size_t next_input_seq; // seq of the next batch pushed
+    bool input_closed; // Whether the end of the stream was pushed
+    pipeline_batch_t* output; // Batch being consumed by pipeline_pop
+    size_t output_index; // Next item of output to pop
+    size_t next_output_seq; // seq of the next batch to pop when ordered
+    pipeline_batch_t** held; // Batches that arrived ahead of next_output_seq
+    size_t num_held; // Number of entries in held
+    size_t held_capacity; // Allocated length of held
+    bool output_closed; // Whether the end of the stream reached the output
+} pipeline_t;
+
+// Creates an empty pipeline moving up to batch_size items per channel operation
+// channel_size is the number of batches each channel between stages holds, ordered makes pipeline_pop return items in push order
+// Returns NULL on invalid arguments or allocation failure
+pipeline_t* pipeline_create(size_t batch_size, size_t channel_size, bool ordered);
+
+// Appends a stage running fn on parallelism threads
+// Returns false if the pipeline was already started or the arguments are invalid
+bool pipeline_add_stage(pipeline_t* pipeline, pipeline_stage_fn_t fn, void* arg, size_t parallelism);
+
+// Starts the stage threads, no stages can be added afterwards
+// Returns false if the pipeline has no stages or was already started
+bool pipeline_start(pipeline_t* pipeline);
+
+// Adds an item (not NULL) to the current input batch, which is sent to the first stage once full
+// Returns SUCCESS, CLOSED_ERROR after pipeline_close, or OTHER_ERROR on invalid arguments
+enum chan_status pipeline_push(pipeline_t* pipeline, void* item);
+
+// Sends the current input batch to the first stage even if it is not full
+enum chan_status pipeline_flush(pipeline_t* pipeline);
+
+// Flushes the input and marks the end of the stream, which is passed on stage by stage once every thread of a stage is done
+enum chan_status pipeline_close(pipeline_t* pipeline);
+
+// Takes the next item out of the pipeline, blocking until one is available
+// Returns SUCCESS, or CLOSED_ERROR once the end of the stream was reached and every item has been popped
+enum chan_status pipeline_pop(pipeline_t* pipeline, void** item);
+
+// Stops the stage threads and frees the pipeline, including batches still in flight
+void pipeline_destroy(pipeline_t* pipeline);
+
+#endif // PIPELINE_H
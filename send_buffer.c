@@ -0,0 +1,180 @@
+#include <assert.h>
+#include <time.h>
+#include "send_buffer.h"
+#include "time_nsec.h"
+
+// Writes the buffered messages to the channel
+// Must be called with the buffer's mutex held
+static enum chan_status flush_locked(send_buffer_t* buffer)
+{
+    if (buffer->count == 0) {
+        return SUCCESS;
+    }
+    size_t sent = 0;
+    enum chan_status status = channel_send_batch(buffer->channel, buffer->items, buffer->count, true, &sent);
+    buffer->stats.flushes++;
+    buffer->stats.messages += sent;
+    if (sent < buffer->count) {
+        // keep what could not be written, in order
+        memmove(buffer->items, buffer->items + sent, sizeof(void*) * (buffer->count - sent));
+        memmove(buffer->added_nsec, buffer->added_nsec + sent, sizeof(uint64_t) * (buffer->count - sent));
+    }
+    buffer->count -= sent;
+    if (buffer->count > 0) {
+        // the linger deadline stays that of the oldest message still buffered
+        buffer->oldest_nsec = buffer->added_nsec[0];
+    }
+    return status;
+}
+
+// Thread flushing the buffer once its oldest message has lingered long enough
+static void* flusher_main(void* arg)
+{
+    send_buffer_t* buffer = arg;
+    pthread_mutex_lock(&buffer->mutex);
+    while (!buffer->stopping) {
+        if (buffer->count == 0 || buffer->error != SUCCESS) {
+            pthread_cond_wait(&buffer->condition, &buffer->mutex);
+            continue;
+        }
+        uint64_t deadline_nsec = buffer->oldest_nsec + buffer->linger_nsec;
+        if (monotonic_nsec() >= deadline_nsec) {
+            buffer->stats.linger_flushes++;
+            buffer->error = flush_locked(buffer);
+            continue;
+        }
+        struct timespec deadline;
+        deadline.tv_sec = (time_t)(deadline_nsec / 1000000000ull);
+        deadline.tv_nsec = (long)(deadline_nsec % 1000000000ull);
+        pthread_cond_timedwait(&buffer->condition, &buffer->mutex, &deadline);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return NULL;
+}
+
+// Creates a send buffer for channel holding up to capacity messages, which linger for at most linger_nsec
+// Returns NULL on invalid arguments or allocation failure
+send_buffer_t* send_buffer_create(chan_t* channel, size_t capacity, uint64_t linger_nsec)
+{
+    if (channel == NULL || capacity == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    send_buffer_t* buffer = malloc(sizeof(send_buffer_t));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->items = malloc(sizeof(void*) * capacity);
+    buffer->added_nsec = malloc(sizeof(uint64_t) * capacity);
+    if (buffer->items == NULL || buffer->added_nsec == NULL) {
+        free(buffer->items);
+        free(buffer->added_nsec);
+        free(buffer);
+        return NULL;
+    }
+    buffer->channel = channel;
+    buffer->count = 0;
+    buffer->capacity = capacity;
+    buffer->linger_nsec = linger_nsec;
+    buffer->oldest_nsec = 0;
+    buffer->stopping = false;
+    buffer->error = SUCCESS;
+    buffer->stats.messages = 0;
+    buffer->stats.flushes = 0;
+    buffer->stats.linger_flushes = 0;
+    pthread_mutex_init(&buffer->mutex, NULL);
+    // the flusher waits for deadlines on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&buffer->condition, &attr);
+    pthread_condattr_destroy(&attr);
+    if (linger_nsec > 0) {
+        int pthread_status = pthread_create(&buffer->flusher, NULL, flusher_main, buffer);
+        assert(pthread_status == 0);
+    }
+    return buffer;
+}
+
+// Adds data to the buffer, flushing it if it is full
+// Returns SUCCESS once data is buffered, or the status of a failed flush (e.g. CLOSED_ERROR once the channel is closed)
+// if data could not be buffered; a flush failing after data was buffered is reported by the next call instead
+enum chan_status send_buffer_send(send_buffer_t* buffer, void* data)
+{
+    if (buffer == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    pthread_mutex_lock(&buffer->mutex);
+    enum chan_status status = buffer->error;
+    if (status == SUCCESS && buffer->count == buffer->capacity) {
+        // a failed flush left the buffer full, try again
+        status = flush_locked(buffer);
+    }
+    if (status != SUCCESS) {
+        buffer->error = SUCCESS;
+        pthread_mutex_unlock(&buffer->mutex);
+        return status;
+    }
+    uint64_t now_nsec = monotonic_nsec();
+    if (buffer->count == 0) {
+        // the linger time starts with the first message
+        buffer->oldest_nsec = now_nsec;
+        pthread_cond_signal(&buffer->condition);
+    }
+    buffer->added_nsec[buffer->count] = now_nsec;
+    buffer->items[buffer->count++] = data;
+    if (buffer->count == buffer->capacity) {
+        // data is buffered and will be written later, so a failure is reported on the next call,
+        // a caller retrying this one would send data twice
+        buffer->error = flush_locked(buffer);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return SUCCESS;
+}
+
+// Writes every buffered message to the channel, blocking until there is room for them
+// Returns SUCCESS, or the status of channel_send_batch if it failed; messages that were not written stay buffered
+enum chan_status send_buffer_flush(send_buffer_t* buffer)
+{
+    if (buffer == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    pthread_mutex_lock(&buffer->mutex);
+    enum chan_status status = buffer->error;
+    buffer->error = SUCCESS;
+    if (status == SUCCESS) {
+        status = flush_locked(buffer);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return status;
+}
+
+// Fills stats with the buffer's counters
+void send_buffer_stats(send_buffer_t* buffer, send_buffer_stats_t* stats)
+{
+    pthread_mutex_lock(&buffer->mutex);
+    *stats = buffer->stats;
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+// Flushes the buffer, stops its flusher and frees it
+// Returns the status of the final flush
+enum chan_status send_buffer_destroy(send_buffer_t* buffer)
+{
+    if (buffer == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    enum chan_status status = send_buffer_flush(buffer);
+    if (buffer->linger_nsec > 0) {
+        pthread_mutex_lock(&buffer->mutex);
+        buffer->stopping = true;
+        pthread_cond_signal(&buffer->condition);
+        pthread_mutex_unlock(&buffer->mutex);
+        pthread_join(buffer->flusher, NULL);
+    }
+    pthread_mutex_destroy(&buffer->mutex);
+    pthread_cond_destroy(&buffer->condition);
+    free(buffer->items);
+    free(buffer->added_nsec);
+    free(buffer);
+    return status;
+}
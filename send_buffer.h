@@ -0,0 +1,56 @@
+#ifndef SEND_BUFFER_H
+#define SEND_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "channel.h"
+
+// Counters describing how a send buffer combined messages
+typedef struct {
+    size_t messages; // Messages written to the channel
+    size_t flushes; // channel_send_batch calls made, each taking the channel lock once per run that fit
+    size_t linger_flushes; // Flushes triggered by the linger time expiring
+} send_buffer_stats_t;
+
+// Per-producer handle accumulating messages locally and writing them to a channel as one batch
+// A flush happens when the buffer fills, when the oldest buffered message has waited linger_nsec, or on send_buffer_flush
+// The handle belongs to one producer thread; only its linger flusher thread shares it
+typedef struct {
+    chan_t* channel; // Channel the messages are written to
+    void** items; // Messages not flushed yet
+    uint64_t* added_nsec; // When each entry of items was added
+    size_t count; // Number of entries in items
+    size_t capacity; // Messages buffered before a flush is forced
+    uint64_t linger_nsec; // Longest a message waits in the buffer, 0 only flushes when full or asked to
+    uint64_t oldest_nsec; // When the oldest buffered message was added, added_nsec[0] while count > 0
+    pthread_mutex_t mutex; // Mutex protecting the fields above and below, shared with the flusher
+    pthread_cond_t condition; // Wakes the flusher when the buffer stops being empty or the handle is destroyed
+    pthread_t flusher; // Thread flushing lingering messages, only if linger_nsec > 0
+    bool stopping; // Whether the flusher should exit
+    enum chan_status error; // First error a linger flush ran into, reported by the next send or flush
+    send_buffer_stats_t stats;
+} send_buffer_t;
+
+// Creates a send buffer for channel holding up to capacity messages, which linger for at most linger_nsec
+// Returns NULL on invalid arguments or allocation failure
+send_buffer_t* send_buffer_create(chan_t* channel, size_t capacity, uint64_t linger_nsec);
+
+// Adds data to the buffer, flushing it if it is full
+// Returns SUCCESS once data is buffered, or the status of a failed flush (e.g. CLOSED_ERROR once the channel is closed)
+// if data could not be buffered; a flush failing after data was buffered is reported by the next call instead
+enum chan_status send_buffer_send(send_buffer_t* buffer, void* data);
+
+// Writes every buffered message to the channel, blocking until there is room for them
+// Returns SUCCESS, or the status of channel_send_batch if it failed; messages that were not written stay buffered
+enum chan_status send_buffer_flush(send_buffer_t* buffer);
+
+// Fills stats with the buffer's counters
+void send_buffer_stats(send_buffer_t* buffer, send_buffer_stats_t* stats);
+
+// Flushes the buffer, stops its flusher and frees it
+// Returns the status of the final flush
+enum chan_status send_buffer_destroy(send_buffer_t* buffer);
+
+#endif // SEND_BUFFER_H
@@ -4,22 +4,71 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "channel.h"
+#include "distance_vector.h"
+#include "partition.h"
 #include "stress.h"
+#include "time_nsec.h"
 
-typedef unsigned int distance_t;
+// Link-state advertisement: the links of one router, flooded unchanged to every router
+typedef struct {
+    distance_t dist;
+    size_t dst;
+} lsa_link_t;
+
+typedef struct {
+    size_t src; // Router whose links these are
+    size_t bytes; // Size of the links as they would be sent on a wire
+    size_t num_links; // Number of entries in links
+    lsa_link_t links[0];
+} lsa_t;
+
+// What a link-state router sends its neighbours: an LSA and the router forwarding it
+typedef struct {
+    size_t from;
+    const lsa_t* lsa;
+} lsa_envelope_t;
+
+// What a link-state router answers a flush with when it has nothing left to forward
 typedef struct {
     size_t src;
-    size_t epoch;
-    distance_t dist[0];
-} distance_vector_t;
+    size_t known; // Number of LSAs the router has learned
+} flood_status_t;
+
+// What a worker sends another worker's inbox: a snapshot and the router it is for
+// Freed by the receiving worker, the sender may broadcast again before the envelope is received
+typedef struct {
+    size_t dst;
+    distance_vector_t* vector;
+} worker_envelope_t;
+
+// Entry of the Dijkstra priority queue
+typedef struct {
+    distance_t dist;
+    size_t node;
+} heap_entry_t;
 
-static const distance_t inf_distance = 0x7fffffff;
 static distance_t* topology;
 static distance_t* solution;
 static size_t num_channel;
+static vector_pool_t** pools;
+static enum vector_encoding encoding;
+static enum route_mode route_mode;
+static lsa_t** lsas;
+// Sent to a link-state router once flooding is over to make it compute its distances
+static char compute_marker;
 static chan_t** channels;
+// Number of entries in channels: one per router, or one per worker when routers are partitioned
+static size_t num_inbox;
+// Worker each router runs on, NULL when every router has its own thread
+static size_t* partition;
 static chan_t* done_channel;
 static chan_t* completed_channel;
+static stress_router_metrics_t* router_metrics;
+
+// Returns the index in channels of the channel a router receives on
+size_t inbox_of(size_t router) {
+    return (partition != NULL) ? partition[router] : router;
+}
 
 distance_t get_link_distance(size_t src, size_t dst) {
     return topology[src * num_channel + dst];
@@ -122,41 +171,192 @@ void destroy_topology()
     free(solution);
 }
 
-void* router(void* arg)
+// Takes a vector from the router's pool and fills it with a snapshot of dist
+// The inf_distance entries marked in keep (if not NULL) are sent explicitly
+// The snapshot holds one reference for the router plus one for each of the holders it will be sent to
+distance_vector_t* publish_vector(size_t index, size_t epoch, const distance_t* dist, const bool* keep, size_t holders)
 {
-    bool changed = false;
-    size_t index = (size_t)arg;
-    size_t selected_index;
-    distance_vector_t* prev_prev_state = malloc(sizeof(distance_vector_t) + sizeof(distance_t) * num_channel);
-    assert(prev_prev_state != NULL);
-    distance_vector_t* prev_state = malloc(sizeof(distance_vector_t) + sizeof(distance_t) * num_channel);
-    assert(prev_state != NULL);
-    distance_vector_t* curr_state = malloc(sizeof(distance_vector_t) + sizeof(distance_t) * num_channel);
-    assert(curr_state != NULL);
-    distance_vector_t* next_state = malloc(sizeof(distance_vector_t) + sizeof(distance_t) * num_channel);
-    assert(next_state != NULL);
-    prev_prev_state->src = index;
-    prev_state->src = index;
-    curr_state->src = index;
-    next_state->src = index;
-    prev_prev_state->epoch = 0;
-    prev_state->epoch = 1;
-    curr_state->epoch = 2;
-    next_state->epoch = 3;
+    distance_vector_t* vector = vector_pool_acquire(pools[index]);
+    vector->src = index;
+    vector->epoch = epoch;
+    vector_encode_keep(vector, dist, keep, encoding);
+    vector_retain(vector, holders);
+    return vector;
+}
+
+// Per-router state kept between select calls
+typedef struct {
+    size_t index; // Index of the router in the topology
+    distance_t* working; // Working copy of our distances, merged into as neighbour vectors arrive
+    size_t* next_hop; // Router each working distance was learned from
+    size_t* neighbors; // Routers we have a link to
+    bool* dirty; // Whether the vector each neighbour would be sent has changed since it was last sent
+    size_t num_neighbors; // Number of entries in neighbors and dirty
+    size_t* via_count; // Scratch space counting the routes learned from each router
+    distance_t* filtered; // Scratch space holding working without the routes learned from one neighbour
+    bool* poisoned; // Scratch space marking the routes of filtered poisoned for that neighbour
+    distance_vector_t* curr_state; // Latest full snapshot, held by us and by the neighbours it is shared with
+    bool changed; // Whether working has changed since curr_state was published
+    stress_router_metrics_t* metrics; // Where the router's metrics are collected
+} router_t;
+
+void router_init(router_t* state, size_t index)
+{
+    state->index = index;
+    state->working = malloc(sizeof(distance_t) * num_channel);
+    assert(state->working != NULL);
+    state->next_hop = malloc(sizeof(size_t) * num_channel);
+    assert(state->next_hop != NULL);
+    state->neighbors = malloc(sizeof(size_t) * num_channel);
+    assert(state->neighbors != NULL);
+    state->dirty = malloc(sizeof(bool) * num_channel);
+    assert(state->dirty != NULL);
+    state->via_count = malloc(sizeof(size_t) * num_channel);
+    assert(state->via_count != NULL);
+    state->filtered = malloc(sizeof(distance_t) * num_channel);
+    assert(state->filtered != NULL);
+    state->poisoned = malloc(sizeof(bool) * num_channel);
+    assert(state->poisoned != NULL);
+    state->num_neighbors = 0;
     for (size_t i = 0; i < num_channel; i++) {
-        prev_prev_state->dist[i] = get_link_distance(index, i);
-        prev_state->dist[i] = get_link_distance(index, i);
-        curr_state->dist[i] = get_link_distance(index, i);
-        next_state->dist[i] = get_link_distance(index, i);
+        state->working[i] = get_link_distance(index, i);
+        // direct links are learned from the router at the other end
+        state->next_hop[i] = i;
+        if ((i != index) && get_link_distance(index, i) != inf_distance) {
+            state->neighbors[state->num_neighbors] = i;
+            state->dirty[state->num_neighbors] = true;
+            state->num_neighbors++;
+        }
     }
-    size_t total_select_count = 2;
+    state->curr_state = NULL;
+    state->changed = true;
+    state->metrics = &router_metrics[index];
+}
+
+void router_destroy(router_t* state)
+{
+    state->metrics->epoch = state->curr_state->epoch;
+    vector_release(state->curr_state);
+    free(state->working);
+    free(state->next_hop);
+    free(state->neighbors);
+    free(state->dirty);
+    free(state->via_count);
+    free(state->filtered);
+    free(state->poisoned);
+}
+
+// Returns the number of finite routes not learned from hop, which are what split horizon shows hop
+static size_t routes_shown(const router_t* state, size_t hop)
+{
+    size_t shown = 0;
     for (size_t i = 0; i < num_channel; i++) {
-        if ((i != index) && get_link_distance(index, i) != inf_distance) {
-            total_select_count++;
+        if ((state->working[i] != inf_distance) && (state->next_hop[i] != hop)) {
+            shown++;
         }
     }
+    return shown;
+}
+
+// Merges a neighbour's snapshot into the working copy and releases it
+// Marks the neighbours whose vector changed as a result
+void router_merge(router_t* state, distance_vector_t* neighbor_state)
+{
+    size_t hop = neighbor_state->src;
+    distance_t neighbor_dist = get_link_distance(state->index, hop);
+    assert(neighbor_dist != inf_distance);
+    // every route the merge lowers is learned from hop, so with split horizon hop's view only changes
+    // when routes it was shown move onto it and disappear from its vector
+    size_t shown = (route_mode == ROUTE_SPLIT_HORIZON) ? routes_shown(state, hop) : 0;
+    if (vector_merge(neighbor_state, neighbor_dist, state->working, state->next_hop, hop)) {
+        state->changed = true;
+        bool hop_changed = (route_mode != ROUTE_SPLIT_HORIZON) || (routes_shown(state, hop) != shown);
+        for (size_t i = 0; i < state->num_neighbors; i++) {
+            // poison reverse tells hop on every change that the routes we just learned are unreachable through us
+            if (hop_changed || (state->neighbors[i] != hop)) {
+                state->dirty[i] = true;
+            }
+        }
+    }
+    // done with the neighbour's snapshot
+    vector_release(neighbor_state);
+}
+
+// Publishes the working copy as a new snapshot and queues it in sends for every dirty neighbour
+// send_neighbors receives the neighbour each send is for
+// Returns the number of sends queued
+size_t router_broadcast(router_t* state, select_t* sends, size_t* send_neighbors)
+{
+    size_t epoch = 0;
+    if (state->curr_state != NULL) {
+        // the old snapshot returns to the pool once every neighbour has merged it
+        epoch = state->curr_state->epoch + 1;
+        vector_release(state->curr_state);
+    }
+    state->curr_state = publish_vector(state->index, epoch, state->working, NULL, 0);
+    if (route_mode != ROUTE_FULL) {
+        // count the routes each neighbour has to be left out of
+        for (size_t i = 0; i < state->num_neighbors; i++) {
+            state->via_count[state->neighbors[i]] = 0;
+        }
+        for (size_t i = 0; i < num_channel; i++) {
+            if ((state->working[i] != inf_distance) && (state->next_hop[i] != state->index)) {
+                state->via_count[state->next_hop[i]]++;
+            }
+        }
+    }
+    size_t send_count = 0;
+    for (size_t i = 0; i < state->num_neighbors; i++) {
+        if (!state->dirty[i]) {
+            continue;
+        }
+        size_t neighbor = state->neighbors[i];
+        distance_vector_t* vector = state->curr_state;
+        if ((route_mode == ROUTE_FULL) || (state->via_count[neighbor] == 0)) {
+            // share the full snapshot
+            vector_retain(vector, 1);
+        } else {
+            // the neighbour gets its own snapshot without the routes learned from it,
+            // poison reverse sends them as inf_distance where split horizon leaves them out
+            bool poison = (route_mode == ROUTE_POISON_REVERSE);
+            for (size_t dst = 0; dst < num_channel; dst++) {
+                bool learned = (state->next_hop[dst] == neighbor) && (state->working[dst] != inf_distance);
+                state->filtered[dst] = learned ? inf_distance : state->working[dst];
+                state->poisoned[dst] = poison && learned;
+            }
+            if (poison) {
+                state->metrics->poisoned_routes += state->via_count[neighbor];
+            }
+            vector = publish_vector(state->index, epoch, state->filtered, poison ? state->poisoned : NULL, 0);
+        }
+        sends[send_count].channel = channels[inbox_of(neighbor)];
+        sends[send_count].is_send = true;
+        sends[send_count].data = vector;
+        send_neighbors[send_count] = neighbor;
+        send_count++;
+        state->dirty[i] = false;
+    }
+    if (send_count > 0) {
+        state->metrics->broadcast_rounds++;
+    }
+    state->changed = false;
+    return send_count;
+}
+
+void* router(void* arg)
+{
+    size_t index = (size_t)arg;
+    size_t selected_index;
+    size_t wakeups;
+    router_t state;
+    router_init(&state, index);
+    stress_router_metrics_t* metrics = state.metrics;
+    size_t total_select_count = 2 + state.num_neighbors;
     select_t* select_list = malloc(sizeof(select_t) * total_select_count);
     assert(select_list != NULL);
+    // neighbour each pending send in select_list is for
+    size_t* send_neighbors = malloc(sizeof(size_t) * total_select_count);
+    assert(send_neighbors != NULL);
     size_t select_count = 0;
     select_list[select_count].channel = done_channel;
     select_list[select_count].is_send = false;
@@ -166,78 +366,217 @@ void* router(void* arg)
     select_list[select_count].is_send = false;
     select_list[select_count].data = NULL;
     select_count++;
-    for (size_t i = 0; i < num_channel; i++) {
-        if ((i != index) && get_link_distance(index, i) != inf_distance) {
-            select_list[select_count].channel = channels[i];
-            select_list[select_count].is_send = true;
-            select_list[select_count].data = curr_state;
-            select_count++;
-        }
-    }
+    // the initial vector is the first broadcast
+    select_count += router_broadcast(&state, &select_list[2], &send_neighbors[2]);
     while (true) {
-        enum chan_status status = channel_select(select_count, select_list, &selected_index);
+        enum chan_status status = channel_select_wakeups(select_count, select_list, &selected_index, &wakeups);
+        if (wakeups > 0) {
+            // Only the last wakeup found a channel ready, and the one caused by close delivered no message
+            metrics->spurious_wakeups += wakeups - 1;
+            if (status == SUCCESS) {
+                metrics->productive_wakeups++;
+            }
+        }
         if (status == SUCCESS) {
             assert(selected_index != 0);
             if (selected_index == 1) {
                 if (select_list[selected_index].data) {
-                    // update next_state with new data
-                    distance_vector_t* neighbor_state = select_list[selected_index].data;
-                    distance_t neighbor_dist = get_link_distance(index, neighbor_state->src);
-                    assert(neighbor_dist != inf_distance);
-                    for (size_t i = 0; i < num_channel; i++) {
-                        distance_t new_dist = neighbor_dist + neighbor_state->dist[i];
-                        if (new_dist < next_state->dist[i]) {
-                            next_state->dist[i] = new_dist;
-                            changed = true;
-                        }
-                    }
+                    // update working copy with new data
+                    router_merge(&state, select_list[selected_index].data);
                 } else {
                     // special message sent to test convergence
-                    bool converged = (select_count == 2) && !changed;
-                    status = channel_send(completed_channel, converged ? curr_state : NULL, true);
+                    bool converged = (select_count == 2) && !state.changed;
+                    if (converged) {
+                        // check_done holds on to the snapshot until it has validated it
+                        vector_retain(state.curr_state, 1);
+                    }
+                    status = channel_send(completed_channel, converged ? state.curr_state : NULL, true);
                     assert(status == SUCCESS);
                 }
             } else {
+                distance_vector_t* sent = select_list[selected_index].data;
+                metrics->messages_sent++;
+                metrics->bytes_sent += sent->bytes;
                 select_count--;
-                // swap last element and selected element
-                chan_t* temp = select_list[select_count].channel;
-                select_list[select_count].channel = select_list[selected_index].channel;
-                select_list[selected_index].channel = temp;
+                // move last element into the selected element's place
+                select_list[selected_index] = select_list[select_count];
+                send_neighbors[selected_index] = send_neighbors[select_count];
             }
             // check if we've sent to everyone
             if (select_count == 2) {
                 // check if we want to reset
-                if (changed) {
-                    // cycle triple buffer
-                    distance_vector_t* temp_state = curr_state;
-                    curr_state = next_state;
-                    next_state = prev_prev_state;
-                    prev_prev_state = prev_state;
-                    prev_state = temp_state;
-                    next_state->epoch = curr_state->epoch + 1;
-                    for (size_t i = 0; i < num_channel; i++) {
-                        next_state->dist[i] = curr_state->dist[i];
-                    }
+                if (state.changed) {
                     // reset to broadcast again
-                    select_count = total_select_count;
-                    for (size_t i = 2; i < select_count; i++) {
-                        select_list[i].data = curr_state;
-                    }
-                    changed = false;
+                    select_count += router_broadcast(&state, &select_list[2], &send_neighbors[2]);
                 }
             }
         } else {
             assert(status == CLOSED_ERROR);
             assert(selected_index == 0);
-            assert(changed == false);
+            assert(state.changed == false);
+            break;
+        }
+    }
+    router_destroy(&state);
+    free(select_list);
+    free(send_neighbors);
+    return NULL;
+}
+
+// Broadcasts every router of a worker that changed and has no send in flight, until none is left
+// Vectors for routers of the same worker are merged directly, the others are queued in sends
+// send_slots receives the router each send is from
+// Returns the number of sends queued
+size_t worker_settle(router_t* routers, size_t num_routers, router_t** local, size_t* pending,
+                     select_t* scratch, size_t* scratch_neighbors, select_t* sends, size_t* send_slots)
+{
+    size_t send_count = 0;
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (size_t slot = 0; slot < num_routers; slot++) {
+            router_t* state = &routers[slot];
+            if (!state->changed || pending[slot] > 0) {
+                continue;
+            }
+            size_t count = router_broadcast(state, scratch, scratch_neighbors);
+            for (size_t i = 0; i < count; i++) {
+                size_t neighbor = scratch_neighbors[i];
+                if (local[neighbor] != NULL) {
+                    // the neighbour runs on this worker, no need to go through a channel
+                    router_merge(local[neighbor], scratch[i].data);
+                    state->metrics->local_updates++;
+                } else {
+                    worker_envelope_t* envelope = malloc(sizeof(worker_envelope_t));
+                    assert(envelope != NULL);
+                    envelope->dst = neighbor;
+                    envelope->vector = scratch[i].data;
+                    sends[send_count] = scratch[i];
+                    sends[send_count].data = envelope;
+                    send_slots[send_count] = slot;
+                    send_count++;
+                    pending[slot]++;
+                    // counted now, the envelope and vector may be gone by the time the send completes
+                    state->metrics->messages_sent++;
+                    state->metrics->bytes_sent += envelope->vector->bytes;
+                }
+            }
+            progress = true;
+        }
+    }
+    return send_count;
+}
+
+// Runs every router assigned to a worker on one thread
+// Routers of the same worker update each other in memory, channels are only used between workers
+void* worker(void* arg)
+{
+    size_t index = (size_t)arg;
+    size_t selected_index;
+    size_t wakeups;
+    size_t num_routers = 0;
+    for (size_t i = 0; i < num_channel; i++) {
+        if (partition[i] == index) {
+            num_routers++;
+        }
+    }
+    assert(num_routers > 0);
+    router_t* routers = malloc(sizeof(router_t) * num_routers);
+    assert(routers != NULL);
+    // state of each router in the topology, NULL for routers of other workers
+    router_t** local = calloc(num_channel, sizeof(router_t*));
+    assert(local != NULL);
+    // number of sends each router has in flight, a router broadcasts again only once they are done
+    size_t* pending = calloc(num_routers, sizeof(size_t));
+    assert(pending != NULL);
+    size_t total_select_count = 2;
+    size_t slot = 0;
+    for (size_t i = 0; i < num_channel; i++) {
+        if (partition[i] == index) {
+            router_init(&routers[slot], i);
+            local[i] = &routers[slot];
+            total_select_count += routers[slot].num_neighbors;
+            slot++;
+        }
+    }
+    select_t* scratch = malloc(sizeof(select_t) * num_channel);
+    assert(scratch != NULL);
+    size_t* scratch_neighbors = malloc(sizeof(size_t) * num_channel);
+    assert(scratch_neighbors != NULL);
+    select_t* select_list = malloc(sizeof(select_t) * total_select_count);
+    assert(select_list != NULL);
+    // router each pending send in select_list is from
+    size_t* send_slots = malloc(sizeof(size_t) * total_select_count);
+    assert(send_slots != NULL);
+    // select wakeups are the worker's, they are counted on its first router
+    stress_router_metrics_t* metrics = routers[0].metrics;
+    size_t select_count = 0;
+    select_list[select_count].channel = done_channel;
+    select_list[select_count].is_send = false;
+    select_list[select_count].data = NULL;
+    select_count++;
+    select_list[select_count].channel = channels[index];
+    select_list[select_count].is_send = false;
+    select_list[select_count].data = NULL;
+    select_count++;
+    // the initial vectors are the first broadcast
+    select_count += worker_settle(routers, num_routers, local, pending, scratch, scratch_neighbors, &select_list[select_count],
+                                  &send_slots[select_count]);
+    while (true) {
+        enum chan_status status = channel_select_wakeups(select_count, select_list, &selected_index, &wakeups);
+        if (wakeups > 0) {
+            // Only the last wakeup found a channel ready, and the one caused by close delivered no message
+            metrics->spurious_wakeups += wakeups - 1;
+            if (status == SUCCESS) {
+                metrics->productive_wakeups++;
+            }
+        }
+        if (status != SUCCESS) {
+            assert(status == CLOSED_ERROR);
+            assert(selected_index == 0);
+            assert(select_count == 2);
             break;
         }
+        assert(selected_index != 0);
+        if (selected_index == 1) {
+            worker_envelope_t* envelope = select_list[selected_index].data;
+            if (envelope != NULL) {
+                // update the working copy of the router the vector is for
+                router_merge(local[envelope->dst], envelope->vector);
+                free(envelope);
+            } else {
+                // special message sent to test convergence, answered once for each of our routers
+                // settling leaves a router changed only while it has sends in flight
+                bool converged = (select_count == 2);
+                for (size_t i = 0; i < num_routers; i++) {
+                    if (converged) {
+                        // check_done holds on to the snapshot until it has validated it
+                        vector_retain(routers[i].curr_state, 1);
+                    }
+                    status = channel_send(completed_channel, converged ? routers[i].curr_state : NULL, true);
+                    assert(status == SUCCESS);
+                }
+            }
+        } else {
+            pending[send_slots[selected_index]]--;
+            select_count--;
+            // move last element into the selected element's place
+            select_list[selected_index] = select_list[select_count];
+            send_slots[selected_index] = send_slots[select_count];
+        }
+        select_count += worker_settle(routers, num_routers, local, pending, scratch, scratch_neighbors, &select_list[select_count],
+                                      &send_slots[select_count]);
     }
+    for (size_t i = 0; i < num_routers; i++) {
+        router_destroy(&routers[i]);
+    }
+    free(routers);
+    free(local);
+    free(send_slots);
+    free(pending);
+    free(scratch);
+    free(scratch_neighbors);
     free(select_list);
-    free(prev_prev_state);
-    free(prev_state);
-    free(curr_state);
-    free(next_state);
     return NULL;
 }
 
@@ -245,10 +584,10 @@ bool check_done()
 {
     bool valid = true;
     enum chan_status status;
-    distance_vector_t** completed = malloc(sizeof(distance_vector_t*) * num_channel);
+    distance_vector_t** completed = calloc(num_channel, sizeof(distance_vector_t*));
     assert(completed != NULL);
     // validate by sending special NULL message to flush channels
-    for (size_t i = 0; i < num_channel; i++) {
+    for (size_t i = 0; i < num_inbox; i++) {
         status = channel_send(channels[i], NULL, true);
         assert(status == SUCCESS);
     }
@@ -267,7 +606,7 @@ bool check_done()
     }
     if (valid) {
         // ensure epoch hasn't changed since first validation
-        for (size_t i = 0; i < num_channel; i++) {
+        for (size_t i = 0; i < num_inbox; i++) {
             status = channel_send(channels[i], NULL, true);
             assert(status == SUCCESS);
         }
@@ -284,32 +623,378 @@ bool check_done()
                 if (completed[index]->epoch != new_data->epoch) {
                     valid = false;
                 }
+                vector_release(new_data);
             }
         }
         if (valid) {
             // check results
+            distance_t* dist = malloc(sizeof(distance_t) * num_channel);
+            assert(dist != NULL);
             for (size_t src = 0; src < num_channel; src++) {
+                vector_decode(completed[src], dist);
                 for (size_t dst = 0; dst < num_channel; dst++) {
-                    assert(completed[src]->dist[dst] == get_solution_distance(src, dst));
+                    assert(dist[dst] == get_solution_distance(src, dst));
                 }
             }
+            free(dist);
+        }
+    }
+    for (size_t i = 0; i < num_channel; i++) {
+        if (completed[i] != NULL) {
+            vector_release(completed[i]);
         }
     }
     free(completed);
     return valid;
 }
 
+// Builds the LSA describing a router's outgoing links
+lsa_t* create_lsa(size_t index)
+{
+    size_t num_links = 0;
+    for (size_t i = 0; i < num_channel; i++) {
+        if ((i != index) && get_link_distance(index, i) != inf_distance) {
+            num_links++;
+        }
+    }
+    lsa_t* lsa = malloc(sizeof(lsa_t) + sizeof(lsa_link_t) * num_links);
+    assert(lsa != NULL);
+    lsa->src = index;
+    lsa->num_links = 0;
+    for (size_t i = 0; i < num_channel; i++) {
+        if ((i != index) && get_link_distance(index, i) != inf_distance) {
+            lsa->links[lsa->num_links].dst = i;
+            lsa->links[lsa->num_links].dist = get_link_distance(index, i);
+            lsa->num_links++;
+        }
+    }
+    // a 32-bit destination and distance per link
+    lsa->bytes = num_links * 2 * sizeof(uint32_t);
+    return lsa;
+}
+
+void heap_push(heap_entry_t* heap, size_t* count, distance_t dist, size_t node)
+{
+    size_t i = (*count)++;
+    while (i > 0 && heap[(i - 1) / 2].dist > dist) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].dist = dist;
+    heap[i].node = node;
+}
+
+heap_entry_t heap_pop(heap_entry_t* heap, size_t* count)
+{
+    heap_entry_t top = heap[0];
+    heap_entry_t last = heap[--(*count)];
+    size_t i = 0;
+    while (2 * i + 1 < *count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < *count && heap[child + 1].dist < heap[child].dist) {
+            child++;
+        }
+        if (heap[child].dist >= last.dist) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// Computes the distances from index to every router over the LSAs it knows
+void dijkstra(size_t index, const lsa_t** known, distance_t* dist)
+{
+    size_t heap_capacity = 1;
+    for (size_t i = 0; i < num_channel; i++) {
+        dist[i] = inf_distance;
+        if (known[i] != NULL) {
+            heap_capacity += known[i]->num_links;
+        }
+    }
+    heap_entry_t* heap = malloc(sizeof(heap_entry_t) * heap_capacity);
+    assert(heap != NULL);
+    size_t count = 0;
+    dist[index] = get_link_distance(index, index);
+    heap_push(heap, &count, dist[index], index);
+    while (count > 0) {
+        heap_entry_t entry = heap_pop(heap, &count);
+        const lsa_t* lsa = known[entry.node];
+        if (entry.dist > dist[entry.node] || lsa == NULL) {
+            continue;
+        }
+        for (size_t i = 0; i < lsa->num_links; i++) {
+            distance_t new_dist = entry.dist + lsa->links[i].dist;
+            if (new_dist < dist[lsa->links[i].dst]) {
+                dist[lsa->links[i].dst] = new_dist;
+                heap_push(heap, &count, new_dist, lsa->links[i].dst);
+            }
+        }
+    }
+    free(heap);
+}
+
+// Router that floods LSAs to its neighbours and computes its distances once asked to
+void* link_state_router(void* arg)
+{
+    size_t index = (size_t)arg;
+    size_t selected_index;
+    size_t wakeups;
+    stress_router_metrics_t* metrics = &router_metrics[index];
+    size_t num_neighbors = 0;
+    size_t* neighbors = malloc(sizeof(size_t) * num_channel);
+    assert(neighbors != NULL);
+    for (size_t i = 0; i < num_channel; i++) {
+        if ((i != index) && get_link_distance(index, i) != inf_distance) {
+            neighbors[num_neighbors++] = i;
+        }
+    }
+    // LSAs learned so far, indexed by the router they describe
+    const lsa_t** known = calloc(num_channel, sizeof(lsa_t*));
+    assert(known != NULL);
+    size_t known_count = 0;
+    lsa_envelope_t* envelopes = malloc(sizeof(lsa_envelope_t) * num_channel);
+    assert(envelopes != NULL);
+    // per-neighbour queue of LSAs left to forward, each LSA is queued at most once per neighbour
+    size_t* queues = malloc(sizeof(size_t) * num_channel * (num_neighbors + 1));
+    assert(queues != NULL);
+    size_t* queue_head = calloc(num_neighbors + 1, sizeof(size_t));
+    assert(queue_head != NULL);
+    size_t* queue_tail = calloc(num_neighbors + 1, sizeof(size_t));
+    assert(queue_tail != NULL);
+    select_t* select_list = malloc(sizeof(select_t) * (2 + num_neighbors));
+    assert(select_list != NULL);
+    // neighbour each pending send in select_list is for
+    size_t* send_neighbors = malloc(sizeof(size_t) * (2 + num_neighbors));
+    assert(send_neighbors != NULL);
+    size_t select_count = 0;
+    select_list[select_count].channel = done_channel;
+    select_list[select_count].is_send = false;
+    select_list[select_count].data = NULL;
+    select_count++;
+    select_list[select_count].channel = channels[index];
+    select_list[select_count].is_send = false;
+    select_list[select_count].data = NULL;
+    select_count++;
+
+    // learns an LSA and queues it for every neighbour except the one it came from
+    const lsa_t* lsa = lsas[index];
+    size_t from = index;
+    while (true) {
+        if (lsa != NULL && known[lsa->src] == NULL) {
+            known[lsa->src] = lsa;
+            known_count++;
+            envelopes[lsa->src].from = index;
+            envelopes[lsa->src].lsa = lsa;
+            metrics->broadcast_rounds++;
+            for (size_t i = 0; i < num_neighbors; i++) {
+                if (neighbors[i] == from) {
+                    continue;
+                }
+                if (queue_head[i] == queue_tail[i]) {
+                    // queue was idle, start sending to this neighbour
+                    select_list[select_count].channel = channels[neighbors[i]];
+                    select_list[select_count].is_send = true;
+                    select_list[select_count].data = &envelopes[lsa->src];
+                    send_neighbors[select_count] = i;
+                    select_count++;
+                }
+                queues[i * num_channel + queue_tail[i]++] = lsa->src;
+            }
+        }
+        lsa = NULL;
+
+        enum chan_status status = channel_select_wakeups(select_count, select_list, &selected_index, &wakeups);
+        if (wakeups > 0) {
+            // Only the last wakeup found a channel ready, and the one caused by close delivered no message
+            metrics->spurious_wakeups += wakeups - 1;
+            if (status == SUCCESS) {
+                metrics->productive_wakeups++;
+            }
+        }
+        if (status != SUCCESS) {
+            assert(status == CLOSED_ERROR);
+            assert(selected_index == 0);
+            break;
+        }
+        assert(selected_index != 0);
+        if (selected_index == 1) {
+            void* data = select_list[selected_index].data;
+            if (data == NULL) {
+                // special message sent to test whether flooding is over
+                flood_status_t* flood_status = NULL;
+                if (select_count == 2) {
+                    flood_status = malloc(sizeof(flood_status_t));
+                    assert(flood_status != NULL);
+                    flood_status->src = index;
+                    flood_status->known = known_count;
+                }
+                status = channel_send(completed_channel, flood_status, true);
+                assert(status == SUCCESS);
+            } else if (data == &compute_marker) {
+                // flooding is over, compute our distances from the LSAs we know
+                uint64_t compute_start = monotonic_nsec();
+                distance_t* dist = malloc(sizeof(distance_t) * num_channel);
+                assert(dist != NULL);
+                dijkstra(index, known, dist);
+                distance_vector_t* result = publish_vector(index, known_count, dist, NULL, 0);
+                free(dist);
+                metrics->compute_nsec += monotonic_nsec() - compute_start;
+                status = channel_send(completed_channel, result, true);
+                assert(status == SUCCESS);
+            } else {
+                lsa_envelope_t* envelope = data;
+                lsa = envelope->lsa;
+                from = envelope->from;
+            }
+        } else {
+            lsa_envelope_t* sent = select_list[selected_index].data;
+            size_t i = send_neighbors[selected_index];
+            metrics->messages_sent++;
+            metrics->bytes_sent += sent->lsa->bytes;
+            queue_head[i]++;
+            if (queue_head[i] != queue_tail[i]) {
+                // send the next queued LSA to this neighbour
+                select_list[selected_index].data = &envelopes[queues[i * num_channel + queue_head[i]]];
+            } else {
+                // move last element into the selected element's place
+                select_count--;
+                select_list[selected_index] = select_list[select_count];
+                send_neighbors[selected_index] = send_neighbors[select_count];
+            }
+        }
+    }
+    metrics->epoch = known_count;
+    free(neighbors);
+    free(known);
+    free(envelopes);
+    free(queues);
+    free(queue_head);
+    free(queue_tail);
+    free(select_list);
+    free(send_neighbors);
+    return NULL;
+}
+
+// Checks whether every link-state router has forwarded everything it learned
+// Like check_done, flushes every channel twice and requires the answers to match
+bool check_flooded()
+{
+    bool valid = true;
+    enum chan_status status;
+    size_t* known = calloc(num_channel, sizeof(size_t));
+    assert(known != NULL);
+    for (size_t round = 0; round < 2 && valid; round++) {
+        // validate by sending special NULL message to flush channels
+        for (size_t i = 0; i < num_channel; i++) {
+            status = channel_send(channels[i], NULL, true);
+            assert(status == SUCCESS);
+        }
+        // receive special response
+        for (size_t i = 0; i < num_channel; i++) {
+            void* data = NULL;
+            status = channel_receive(completed_channel, &data, true);
+            assert(status == SUCCESS);
+            if (data == NULL) {
+                valid = false;
+            } else {
+                flood_status_t* flood_status = data;
+                if (round == 0) {
+                    known[flood_status->src] = flood_status->known;
+                } else if (known[flood_status->src] != flood_status->known) {
+                    valid = false;
+                }
+                free(flood_status);
+            }
+        }
+    }
+    free(known);
+    return valid;
+}
+
+// Asks every link-state router to compute its distances and checks them against the solution
+void compute_link_state()
+{
+    enum chan_status status;
+    for (size_t i = 0; i < num_channel; i++) {
+        status = channel_send(channels[i], &compute_marker, true);
+        assert(status == SUCCESS);
+    }
+    distance_t* dist = malloc(sizeof(distance_t) * num_channel);
+    assert(dist != NULL);
+    for (size_t i = 0; i < num_channel; i++) {
+        void* data = NULL;
+        status = channel_receive(completed_channel, &data, true);
+        assert(status == SUCCESS);
+        distance_vector_t* result = data;
+        vector_decode(result, dist);
+        for (size_t dst = 0; dst < num_channel; dst++) {
+            assert(dist[dst] == get_solution_distance(result->src, dst));
+        }
+        vector_release(result);
+    }
+    free(dist);
+}
+
 void run_stress(size_t main_buffer_size, size_t secondary_buffer_size, const char* filename)
 {
-    assert(main_buffer_size <= 1); // only support up to a buffer size of 1
-    assert(secondary_buffer_size <= 1); // only support up to a buffer size of 1
+    run_stress_report(main_buffer_size, secondary_buffer_size, filename, NULL);
+}
+
+void run_stress_report(size_t main_buffer_size, size_t secondary_buffer_size, const char* filename, stress_report_t* report)
+{
+    stress_options_t options;
+    stress_options_init(&options, main_buffer_size, secondary_buffer_size, filename);
+    run_stress_options(&options, report);
+}
+
+void stress_options_init(stress_options_t* options, size_t main_buffer_size, size_t secondary_buffer_size, const char* filename)
+{
+    options->main_buffer_size = main_buffer_size;
+    options->secondary_buffer_size = secondary_buffer_size;
+    options->filename = filename;
+    options->encoding = VECTOR_AUTO;
+    options->route_mode = ROUTE_FULL;
+    options->algorithm = ALGORITHM_DISTANCE_VECTOR;
+    options->num_workers = 0;
+}
+
+void run_stress_options(const stress_options_t* options, stress_report_t* report)
+{
+    size_t main_buffer_size = options->main_buffer_size;
+    size_t secondary_buffer_size = options->secondary_buffer_size;
+    const char* filename = options->filename;
     int pthread_status;
     enum chan_status status;
     bool initialized = create_topology(filename);
     assert(initialized);
-    channels = malloc(sizeof(chan_t*) * num_channel);
-    assert(channels != NULL);
+    encoding = options->encoding;
+    route_mode = options->route_mode;
+    pools = malloc(sizeof(vector_pool_t*) * num_channel);
+    assert(pools != NULL);
     for (size_t i = 0; i < num_channel; i++) {
+        pools[i] = vector_pool_create(num_channel);
+        assert(pools[i] != NULL);
+    }
+    router_metrics = calloc(num_channel, sizeof(stress_router_metrics_t));
+    assert(router_metrics != NULL);
+    bool link_state = (options->algorithm == ALGORITHM_LINK_STATE);
+    size_t edge_cut = 0;
+    num_inbox = num_channel;
+    partition = NULL;
+    if (options->num_workers > 0 && options->num_workers < num_channel) {
+        // partitioning only applies to the distance vector routers
+        assert(!link_state);
+        num_inbox = options->num_workers;
+        partition = malloc(sizeof(size_t) * num_channel);
+        assert(partition != NULL);
+        edge_cut = partition_graph(topology, num_channel, num_inbox, partition);
+    }
+    channels = malloc(sizeof(chan_t*) * num_inbox);
+    assert(channels != NULL);
+    for (size_t i = 0; i < num_inbox; i++) {
         channels[i] = channel_create(main_buffer_size);
         assert(channels[i] != NULL);
     }
@@ -318,25 +1003,94 @@ void run_stress(size_t main_buffer_size, size_t secondary_buffer_size, const cha
     completed_channel = channel_create(secondary_buffer_size);
     assert(completed_channel != NULL);
 
-    pthread_t* pid = malloc(sizeof(pthread_t) * num_channel);
+    if (link_state) {
+        lsas = malloc(sizeof(lsa_t*) * num_channel);
+        assert(lsas != NULL);
+        for (size_t i = 0; i < num_channel; i++) {
+            lsas[i] = create_lsa(i);
+        }
+    }
+
+    void* (*thread_routine)(void*) = router;
+    if (link_state) {
+        thread_routine = link_state_router;
+    } else if (partition != NULL) {
+        thread_routine = worker;
+    }
+    pthread_t* pid = malloc(sizeof(pthread_t) * num_inbox);
     assert(pid != NULL);
-    for (size_t i = 0; i < num_channel; i++) {
-        pthread_status = pthread_create(&pid[i], NULL, router, (void*)i);
+    uint64_t start_time = monotonic_nsec();
+    for (size_t i = 0; i < num_inbox; i++) {
+        pthread_status = pthread_create(&pid[i], NULL, thread_routine, (void*)i);
         assert(pthread_status == 0);
     }
 
     // wait for convergence
-    while (!check_done()) {
-        usleep(1000);
+    uint64_t flood_time = 0;
+    if (link_state) {
+        while (!check_flooded()) {
+            usleep(1000);
+        }
+        flood_time = monotonic_nsec() - start_time;
+        compute_link_state();
+    } else {
+        while (!check_done()) {
+            usleep(1000);
+        }
     }
+    uint64_t convergence_time = monotonic_nsec() - start_time;
 
     // stop threads
     status = channel_close(done_channel);
     assert(status == SUCCESS);
     // join threads
-    for (size_t i = 0; i < num_channel; i++) {
+    for (size_t i = 0; i < num_inbox; i++) {
         pthread_join(pid[i], NULL);
     }
+    // collect metrics
+    if (report != NULL) {
+        report->filename = filename;
+        report->main_buffer_size = main_buffer_size;
+        report->secondary_buffer_size = secondary_buffer_size;
+        report->num_routers = num_channel;
+        report->num_threads = num_inbox;
+        report->num_links = count_links(topology, num_channel);
+        report->edge_cut = (partition != NULL) ? edge_cut : report->num_links;
+        report->total_local_updates = 0;
+        report->convergence_nsec = convergence_time;
+        report->encoding = encoding;
+        report->route_mode = route_mode;
+        report->algorithm = options->algorithm;
+        report->flood_nsec = flood_time;
+        report->compute_nsec = link_state ? convergence_time - flood_time : 0;
+        report->total_compute_nsec = 0;
+        report->total_messages = 0;
+        report->total_bytes = 0;
+        report->total_broadcast_rounds = 0;
+        report->total_poisoned_routes = 0;
+        report->productive_wakeups = 0;
+        report->spurious_wakeups = 0;
+        report->peak_channel_depth = 0;
+        for (size_t i = 0; i < num_channel; i++) {
+            report->total_messages += router_metrics[i].messages_sent;
+            report->total_bytes += router_metrics[i].bytes_sent;
+            report->total_broadcast_rounds += router_metrics[i].broadcast_rounds;
+            report->total_poisoned_routes += router_metrics[i].poisoned_routes;
+            report->productive_wakeups += router_metrics[i].productive_wakeups;
+            report->spurious_wakeups += router_metrics[i].spurious_wakeups;
+            report->total_compute_nsec += router_metrics[i].compute_nsec;
+            report->total_local_updates += router_metrics[i].local_updates;
+        }
+        for (size_t i = 0; i < num_inbox; i++) {
+            size_t depth = channel_peak_size(channels[i]);
+            if (depth > report->peak_channel_depth) {
+                report->peak_channel_depth = depth;
+            }
+        }
+        // hand the per-router metrics over to the report
+        report->routers = router_metrics;
+        router_metrics = NULL;
+    }
     // cleanup
     status = channel_destroy(done_channel);
     assert(status == SUCCESS);
@@ -344,13 +1098,142 @@ void run_stress(size_t main_buffer_size, size_t secondary_buffer_size, const cha
     assert(status == SUCCESS);
     status = channel_destroy(completed_channel);
     assert(status == SUCCESS);
-    for (size_t i = 0; i < num_channel; i++) {
+    for (size_t i = 0; i < num_inbox; i++) {
         status = channel_close(channels[i]);
         assert(status == SUCCESS);
         status = channel_destroy(channels[i]);
         assert(status == SUCCESS);
     }
+    free(router_metrics);
+    router_metrics = NULL;
+    for (size_t i = 0; i < num_channel; i++) {
+        vector_pool_destroy(pools[i]);
+    }
+    free(pools);
+    if (link_state) {
+        for (size_t i = 0; i < num_channel; i++) {
+            free(lsas[i]);
+        }
+        free(lsas);
+        lsas = NULL;
+    }
     free(pid);
     free(channels);
+    free(partition);
+    partition = NULL;
     destroy_topology();
 }
+
+const char* encoding_name(enum vector_encoding vector_encoding)
+{
+    switch (vector_encoding) {
+    case VECTOR_DENSE:
+        return "dense";
+    case VECTOR_SPARSE:
+        return "sparse";
+    case VECTOR_RUNS:
+        return "runs";
+    default:
+        return "auto";
+    }
+}
+
+const char* algorithm_name(enum stress_algorithm algorithm)
+{
+    return (algorithm == ALGORITHM_LINK_STATE) ? "link_state" : "distance_vector";
+}
+
+const char* route_mode_name(enum route_mode mode)
+{
+    switch (mode) {
+    case ROUTE_SPLIT_HORIZON:
+        return "split";
+    case ROUTE_POISON_REVERSE:
+        return "poison";
+    default:
+        return "full";
+    }
+}
+
+void stress_report_print(const stress_report_t* report, FILE* file)
+{
+    fprintf(file, "topology: %s\n", report->filename);
+    fprintf(file, "buffer sizes: main %zu, secondary %zu\n", report->main_buffer_size, report->secondary_buffer_size);
+    fprintf(file, "routers: %zu on %zu threads\n", report->num_routers, report->num_threads);
+    fprintf(file, "links: %zu, %zu crossing threads, %zu in-memory updates\n", report->num_links, report->edge_cut,
+            report->total_local_updates);
+    fprintf(file, "convergence time: %.3f ms\n", (double)report->convergence_nsec / 1e6);
+    if (report->algorithm == ALGORITHM_LINK_STATE) {
+        fprintf(file, "flood time: %.3f ms, compute time: %.3f ms (%.3f ms summed over routers)\n",
+                (double)report->flood_nsec / 1e6, (double)report->compute_nsec / 1e6, (double)report->total_compute_nsec / 1e6);
+    }
+    fprintf(file, "vector encoding: %s\n", encoding_name(report->encoding));
+    fprintf(file, "algorithm: %s\n", algorithm_name(report->algorithm));
+    fprintf(file, "route mode: %s\n", route_mode_name(report->route_mode));
+    if (report->route_mode == ROUTE_POISON_REVERSE) {
+        fprintf(file, "poisoned routes sent: %zu\n", report->total_poisoned_routes);
+    }
+    fprintf(file, "messages sent: %zu (%zu bytes)\n", report->total_messages, report->total_bytes);
+    fprintf(file, "broadcast rounds: %zu\n", report->total_broadcast_rounds);
+    fprintf(file, "select wakeups: %zu productive, %zu spurious\n", report->productive_wakeups, report->spurious_wakeups);
+    fprintf(file, "peak channel depth: %zu\n", report->peak_channel_depth);
+    for (size_t i = 0; i < report->num_routers; i++) {
+        const stress_router_metrics_t* router_report = &report->routers[i];
+        fprintf(file, "router %zu: epoch %zu, rounds %zu, sent %zu (%zu bytes), %zu in-memory, wakeups %zu/%zu\n", i,
+                router_report->epoch, router_report->broadcast_rounds, router_report->messages_sent, router_report->bytes_sent,
+                router_report->local_updates, router_report->productive_wakeups, router_report->spurious_wakeups);
+    }
+}
+
+// Writes string as a quoted JSON string, escaping quotes, backslashes and control characters
+static void write_json_string(FILE* file, const char* string)
+{
+    fputc('"', file);
+    for (const char* c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned)(unsigned char)*c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void stress_report_write_json(const stress_report_t* report, FILE* file)
+{
+    fprintf(file, "{\"topology\": ");
+    write_json_string(file, report->filename);
+    fprintf(file, ", ");
+    fprintf(file, "\"main_buffer_size\": %zu, \"secondary_buffer_size\": %zu, ", report->main_buffer_size, report->secondary_buffer_size);
+    fprintf(file, "\"routers\": %zu, ", report->num_routers);
+    fprintf(file, "\"convergence_nsec\": %llu, ", (unsigned long long)report->convergence_nsec);
+    fprintf(file, "\"flood_nsec\": %llu, \"compute_nsec\": %llu, \"total_compute_nsec\": %llu, ",
+            (unsigned long long)report->flood_nsec, (unsigned long long)report->compute_nsec,
+            (unsigned long long)report->total_compute_nsec);
+    fprintf(file, "\"encoding\": \"%s\", ", encoding_name(report->encoding));
+    fprintf(file, "\"algorithm\": \"%s\", ", algorithm_name(report->algorithm));
+    fprintf(file, "\"route_mode\": \"%s\", \"poisoned_routes\": %zu, ", route_mode_name(report->route_mode), report->total_poisoned_routes);
+    fprintf(file, "\"messages_sent\": %zu, \"bytes_sent\": %zu, ", report->total_messages, report->total_bytes);
+    fprintf(file, "\"num_threads\": %zu, \"num_links\": %zu, \"edge_cut\": %zu, \"local_updates\": %zu, ", report->num_threads,
+            report->num_links, report->edge_cut, report->total_local_updates);
+    fprintf(file, "\"broadcast_rounds\": %zu, ", report->total_broadcast_rounds);
+    fprintf(file, "\"productive_wakeups\": %zu, \"spurious_wakeups\": %zu, ", report->productive_wakeups, report->spurious_wakeups);
+    fprintf(file, "\"peak_channel_depth\": %zu, ", report->peak_channel_depth);
+    fprintf(file, "\"per_router\": [");
+    for (size_t i = 0; i < report->num_routers; i++) {
+        const stress_router_metrics_t* router_report = &report->routers[i];
+        fprintf(file, "%s{\"epoch\": %zu, \"broadcast_rounds\": %zu, \"messages_sent\": %zu, \"bytes_sent\": %zu, \"local_updates\": %zu, \"productive_wakeups\": %zu, \"spurious_wakeups\": %zu, \"compute_nsec\": %llu}",
+                (i == 0) ? "" : ", ", router_report->epoch, router_report->broadcast_rounds, router_report->messages_sent, router_report->bytes_sent,
+                router_report->local_updates, router_report->productive_wakeups, router_report->spurious_wakeups,
+                (unsigned long long)router_report->compute_nsec);
+    }
+    fprintf(file, "]}\n");
+}
+
+void stress_report_free(stress_report_t* report)
+{
+    free(report->routers);
+    report->routers = NULL;
+}
@@ -1,6 +1,95 @@
 #ifndef STRESS_H
 #define STRESS_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "distance_vector.h"
+
+// What a router sends each neighbour
+enum route_mode {
+    ROUTE_FULL = 0, // The full vector, to every neighbour whenever it changes
+    ROUTE_SPLIT_HORIZON, // The vector without routes learned from that neighbour, only when that changed
+    ROUTE_POISON_REVERSE // The vector with routes learned from that neighbour as inf_distance, to every neighbour whenever it changes
+};
+
+// Routing algorithm the routers run
+enum stress_algorithm {
+    ALGORITHM_DISTANCE_VECTOR = 0, // Routers repeatedly exchange distance vectors until nothing changes
+    ALGORITHM_LINK_STATE // Routers flood their links once, then each runs Dijkstra locally
+};
+
+// Counters collected by a single router during run_stress
+typedef struct {
+    size_t epoch; // Epoch of the router's distance vector (LSAs known with link-state) once the run converged
+    size_t broadcast_rounds; // Number of times the router started broadcasting a changed vector (flooding an LSA with link-state)
+    size_t messages_sent; // Distance vectors (LSAs with link-state) sent to neighbours
+    size_t bytes_sent; // Encoded bytes sent to neighbours
+    size_t poisoned_routes; // Routes sent back as inf_distance to the neighbour they were learned from (poison reverse only)
+    size_t local_updates; // Vectors merged directly into neighbours on the same worker thread
+    uint64_t compute_nsec; // Time spent computing distances after flooding (link-state only)
+    size_t productive_wakeups; // Select wakeups that ended in a send or receive (counted on a worker's first router)
+    size_t spurious_wakeups; // Select wakeups that found no channel ready (counted on a worker's first router)
+} stress_router_metrics_t;
+
+// Metrics describing one run_stress run
+typedef struct {
+    const char* filename; // Topology file used
+    size_t main_buffer_size; // Buffer size of the router channels
+    size_t secondary_buffer_size; // Buffer size of the done/completed channels
+    size_t num_routers; // Number of routers in the topology
+    size_t num_threads; // Number of router or worker threads
+    size_t num_links; // Number of undirected links in the topology
+    size_t edge_cut; // Links between routers on different threads, all of them without partitioning
+    size_t total_local_updates; // In-memory updates summed over all routers
+    uint64_t convergence_nsec; // Wall time from starting the routers until convergence was verified
+    enum stress_algorithm algorithm; // Routing algorithm the routers ran
+    uint64_t flood_nsec; // Wall time until flooding was over (link-state only)
+    uint64_t compute_nsec; // Wall time of the compute phase after flooding (link-state only)
+    uint64_t total_compute_nsec; // Time spent computing summed over all routers (link-state only)
+    enum vector_encoding encoding; // Encoding of the distance vectors
+    enum route_mode route_mode; // What routers sent each neighbour
+    size_t total_messages; // Distance vectors sent by all routers
+    size_t total_bytes; // Encoded distance bytes sent by all routers
+    size_t total_broadcast_rounds; // Broadcast rounds summed over all routers
+    size_t total_poisoned_routes; // Poisoned routes summed over all routers
+    size_t productive_wakeups; // Productive select wakeups summed over all routers
+    size_t spurious_wakeups; // Spurious select wakeups summed over all routers
+    size_t peak_channel_depth; // Deepest any router channel got
+    stress_router_metrics_t* routers; // Per-router metrics, num_routers entries
+} stress_report_t;
+
+// Options controlling a run_stress_options run
+typedef struct {
+    size_t main_buffer_size; // Buffer size of the router channels
+    size_t secondary_buffer_size; // Buffer size of the done/completed channels
+    const char* filename; // Topology file
+    enum vector_encoding encoding; // Encoding of the distance vectors routers exchange
+    enum route_mode route_mode; // What routers send each neighbour
+    enum stress_algorithm algorithm; // Routing algorithm the routers run
+    size_t num_workers; // Threads the distance vector routers are partitioned onto, 0 runs every router on its own thread
+} stress_options_t;
+
 void run_stress(size_t main_buffer_size, size_t secondary_buffer_size, const char* filename);
 
+// Fills options with the defaults run_stress uses for the given buffer sizes and topology
+void stress_options_init(stress_options_t* options, size_t main_buffer_size, size_t secondary_buffer_size, const char* filename);
+
+// Runs the routing stress test as configured by options and fills report (if not NULL) with its metrics
+// The caller must release the report with stress_report_free
+void run_stress_options(const stress_options_t* options, stress_report_t* report);
+
+// Runs the routing stress test and fills report (if not NULL) with its metrics
+// The caller must release the report with stress_report_free
+void run_stress_report(size_t main_buffer_size, size_t secondary_buffer_size, const char* filename, stress_report_t* report);
+
+// Prints a human readable summary of the report
+void stress_report_print(const stress_report_t* report, FILE* file);
+
+// Writes the report, including per-router metrics, as a JSON object
+void stress_report_write_json(const stress_report_t* report, FILE* file);
+
+// Frees the memory held by the report
+void stress_report_free(stress_report_t* report);
+
 #endif // STRESS_H
@@ -6,11 +6,17 @@
 #include <stdatomic.h>
 #include "channel.h"
 #include "stress_send_recv.h"
+#include "time_nsec.h"
 
 static size_t num_channel;
 static chan_t** channels;
 static volatile atomic_bool done;
 static chan_t* main_channel;
+static atomic_size_t total_hops;
+// Hops each message has left in run_stress_send_recv_hops, NULL when running for a fixed duration
+static size_t* hops_left;
+// Where messages go once their hops are used up
+static chan_t* finished_channel;
 
 void* worker_thread(void* arg)
 {
@@ -22,6 +28,7 @@ void* worker_thread(void* arg)
     chan_t* my_channel = channels[index];
     chan_t* next_channel = channels[next_index];
     bool start = true;
+    size_t hops = 0;
     enum chan_status status;
     while (true) {
         void* data = NULL;
@@ -41,7 +48,18 @@ void* worker_thread(void* arg)
                 break;
             }
         }
-        if (atomic_load(&done)) {
+        if (hops_left != NULL) {
+            // the message is only touched by the thread holding it, the channels order the accesses
+            if (hops_left[(size_t)data] == 0) {
+                status = channel_send(finished_channel, data, true);
+                assert(status == SUCCESS);
+            } else {
+                hops_left[(size_t)data]--;
+                status = channel_send(next_channel, data, true);
+                assert(status == SUCCESS);
+                hops++;
+            }
+        } else if (atomic_load(&done)) {
             // Send data to main_channel
             status = channel_send(main_channel, data, true);
             assert(status == SUCCESS);
@@ -49,17 +67,26 @@ void* worker_thread(void* arg)
             // Pass along message to next thread in ring
             status = channel_send(next_channel, data, true);
             assert(status == SUCCESS);
+            hops++;
         }
     }
+    atomic_fetch_add(&total_hops, hops);
     return NULL;
 }
 
 void run_stress_send_recv(size_t buffer_size, size_t num_threads, double load, useconds_t duration_usec)
+{
+    run_stress_send_recv_count(buffer_size, num_threads, load, duration_usec);
+}
+
+size_t run_stress_send_recv_count(size_t buffer_size, size_t num_threads, double load, useconds_t duration_usec)
 {
     enum chan_status status;
     // setup
     num_channel = num_threads;
     atomic_store(&done, false);
+    atomic_store(&total_hops, 0);
+    hops_left = NULL;
     size_t num_msgs = (size_t)(((double)(num_channel * (buffer_size + 1))) * load);
     bool* msg_check = calloc(num_msgs + 1, sizeof(bool));
     assert(msg_check != NULL);
@@ -133,4 +160,102 @@ void run_stress_send_recv(size_t buffer_size, size_t num_threads, double load, u
     free(msg_check);
     free(pid);
     free(channels);
+    return atomic_load(&total_hops);
+}
+
+uint64_t run_stress_send_recv_hops(size_t buffer_size, size_t num_threads, double load, size_t hop_count)
+{
+    enum chan_status status;
+    // setup
+    num_channel = num_threads;
+    atomic_store(&done, false);
+    atomic_store(&total_hops, 0);
+    size_t num_msgs = (size_t)(((double)(num_channel * (buffer_size + 1))) * load);
+    assert(num_msgs > 0);
+    bool* msg_check = calloc(num_msgs + 1, sizeof(bool));
+    assert(msg_check != NULL);
+    // split the hops evenly between the messages
+    hops_left = malloc(sizeof(size_t) * (num_msgs + 1));
+    assert(hops_left != NULL);
+    for (size_t msg = 1; msg <= num_msgs; msg++) {
+        hops_left[msg] = hop_count / num_msgs + ((msg <= hop_count % num_msgs) ? 1 : 0);
+    }
+
+    channels = malloc(sizeof(chan_t*) * num_channel);
+    assert(channels != NULL);
+    for (size_t i = 0; i < num_channel; i++) {
+        channels[i] = channel_create(buffer_size);
+        assert(channels[i] != NULL);
+    }
+    main_channel = channel_create(buffer_size);
+    assert(main_channel != NULL);
+    // large enough to hold every message, threads never block handing one back
+    finished_channel = channel_create(num_msgs);
+    assert(finished_channel != NULL);
+
+    pthread_t* pid = malloc(sizeof(pthread_t) * num_channel);
+    assert(pid != NULL);
+    for (size_t i = 0; i < num_channel; i++) {
+        int pthread_status = pthread_create(&pid[i], NULL, worker_thread, (void*)i);
+        assert(pthread_status == 0);
+    }
+
+    // start test
+    uint64_t start_time = monotonic_nsec();
+    for (size_t msg = 1; msg <= num_msgs; msg++) {
+        // insert data into threads
+        status = channel_send(main_channel, (void*)msg, true);
+        assert(status == SUCCESS);
+    }
+    for (size_t i = 0; i < num_channel; i++) {
+        // send start message
+        status = channel_send(main_channel, NULL, true);
+        assert(status == SUCCESS);
+    }
+
+    // wait for every message to use up its hops
+    for (size_t msg = 1; msg <= num_msgs; msg++) {
+        size_t data = 0;
+        status = channel_receive(finished_channel, (void**)&data, true);
+        assert(status == SUCCESS);
+        // check that data wasn't duplicated
+        assert((1 <= data) && (data <= num_msgs));
+        assert(msg_check[data] == false);
+        msg_check[data] = true;
+    }
+    uint64_t elapsed = monotonic_nsec() - start_time;
+
+    // shutdown
+    for (size_t i = 0; i < num_channel; i++) {
+        // send stop message
+        status = channel_send(channels[i], NULL, true);
+        assert(status == SUCCESS);
+    }
+    for (size_t i = 0; i < num_channel; i++) {
+        // join threads
+        pthread_join(pid[i], NULL);
+    }
+    assert(atomic_load(&total_hops) == hop_count);
+
+    // cleanup
+    status = channel_close(main_channel);
+    assert(status == SUCCESS);
+    status = channel_destroy(main_channel);
+    assert(status == SUCCESS);
+    status = channel_close(finished_channel);
+    assert(status == SUCCESS);
+    status = channel_destroy(finished_channel);
+    assert(status == SUCCESS);
+    for (size_t i = 0; i < num_channel; i++) {
+        status = channel_close(channels[i]);
+        assert(status == SUCCESS);
+        status = channel_destroy(channels[i]);
+        assert(status == SUCCESS);
+    }
+    free(hops_left);
+    hops_left = NULL;
+    free(msg_check);
+    free(pid);
+    free(channels);
+    return elapsed;
 }
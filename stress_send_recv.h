@@ -1,6 +1,16 @@
 #ifndef STRESS_SEND_RECV_H
 #define STRESS_SEND_RECV_H
 
+#include <stdint.h>
+
 void run_stress_send_recv(size_t buffer_size, size_t num_threads, double load, useconds_t duration_usec);
 
+// Same as run_stress_send_recv, returns the number of times a message was passed from one worker thread to the next
+size_t run_stress_send_recv_count(size_t buffer_size, size_t num_threads, double load, useconds_t duration_usec);
+
+// Passes messages around the ring until hop_count hops have been made in total, instead of for a fixed duration
+// Each message carries an equal share of the hops and leaves the ring once it has used them up
+// Returns the wall time in nanoseconds from injecting the first message until the last one came back
+uint64_t run_stress_send_recv_hops(size_t buffer_size, size_t num_threads, double load, size_t hop_count);
+
 #endif // STRESS_SEND_RECV_H
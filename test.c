@@ -6,8 +6,19 @@
 #include <stdlib.h>
 #include <time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <stdbool.h>
+#include "partition.h"
+#include "worker_pool.h"
+#include "pipeline.h"
+#include "send_buffer.h"
+#include "timer.h"
+#include "merge.h"
+#include "budget.h"
+#include "typed_channel.h"
+#include "channel_inline.h"
+#include "arena.h"
 #include "stress.h"
 #include "stress_send_recv.h"
 
@@ -1297,6 +1308,1766 @@ char* test_stress_mixed_buffered_unbuffered() {
     return NULL;
 }
 
+char* test_stress_deep_buffered() {
+    print_test_details(__func__, "Stress Testing for deeply buffered channels");
+    run_stress(4, 4, "topology.txt");
+    run_stress(4, 2, "random_topology.txt");
+    run_stress(16, 1, "connected_topology.txt");
+    run_stress(64, 8, "big_graph.txt");
+    return NULL;
+}
+
+char* test_stress_report() {
+    print_test_details(__func__, "Testing the metrics reported by the routing stress test");
+    stress_report_t report;
+    run_stress_report(1, 1, "topology.txt", &report);
+    mu_assert("test_stress_report: Wrong number of routers", report.num_routers == 10);
+    mu_assert("test_stress_report: Convergence time not measured", report.convergence_nsec > 0);
+    mu_assert("test_stress_report: No messages counted", report.total_messages > 0);
+    mu_assert("test_stress_report: Peak depth exceeds buffer size", report.peak_channel_depth <= 1);
+    size_t total_messages = 0;
+    for (size_t i = 0; i < report.num_routers; i++) {
+        mu_assert("test_stress_report: Router did not broadcast", report.routers[i].broadcast_rounds > 0);
+        total_messages += report.routers[i].messages_sent;
+    }
+    mu_assert("test_stress_report: Per-router messages do not add up", total_messages == report.total_messages);
+
+    // The topology name is escaped in the JSON report
+    report.filename = "dir\\\"quoted\".txt";
+    FILE* json = tmpfile();
+    mu_assert("test_stress_report: Could not create a temporary file", json != NULL);
+    stress_report_write_json(&report, json);
+    rewind(json);
+    char line[128];
+    mu_assert("test_stress_report: JSON report is empty", fgets(line, sizeof(line), json) != NULL);
+    mu_assert("test_stress_report: Topology name not escaped",
+              strncmp(line, "{\"topology\": \"dir\\\\\\\"quoted\\\".txt\", ", strlen("{\"topology\": \"dir\\\\\\\"quoted\\\".txt\", ")) == 0);
+    fclose(json);
+    stress_report_free(&report);
+    return NULL;
+}
+
+// Drops the last reference to a vector from another thread
+static void* release_vector(void* arg)
+{
+    vector_release(arg);
+    return NULL;
+}
+
+char* test_vector_pool() {
+    print_test_details(__func__, "Testing refcounted distance vector snapshots");
+    vector_pool_t* pool = vector_pool_create(16);
+    mu_assert("test_vector_pool: Could not create the pool", pool != NULL);
+
+    // Share one snapshot with three neighbours
+    distance_vector_t* shared = vector_pool_acquire(pool);
+    mu_assert("test_vector_pool: Acquired vector does not hold one reference", atomic_load(&shared->refcount) == 1);
+    mu_assert("test_vector_pool: Acquired vector has the wrong length", shared->length == 16 && shared->pool == pool);
+    vector_retain(shared, 3);
+    mu_assert("test_vector_pool: Retain did not add references", atomic_load(&shared->refcount) == 4);
+    vector_release(shared); // the owner moves on
+    vector_release(shared);
+    vector_release(shared);
+    mu_assert("test_vector_pool: Vector returned while a neighbour still holds it", atomic_load(&shared->refcount) == 1);
+    mu_assert("test_vector_pool: Vector on the free list while still held", pool->free_list == NULL);
+
+    // Nothing is free, so the pool falls back to allocating another vector
+    distance_vector_t* other = vector_pool_acquire(pool);
+    mu_assert("test_vector_pool: Handed out a vector that is still held", other != shared);
+    mu_assert("test_vector_pool: Pool did not grow when exhausted", pool->allocated == 2);
+
+    // The last reference may be dropped on another thread
+    pthread_t thread;
+    pthread_create(&thread, NULL, release_vector, shared);
+    pthread_join(thread, NULL);
+    mu_assert("test_vector_pool: Last release did not return the vector", pool->free_list == shared);
+
+    // A released vector is reused before the pool grows
+    distance_vector_t* reused = vector_pool_acquire(pool);
+    mu_assert("test_vector_pool: Released vector was not reused", reused == shared);
+    mu_assert("test_vector_pool: Reused vector does not hold one reference", atomic_load(&reused->refcount) == 1);
+    mu_assert("test_vector_pool: Pool grew although a vector was free", pool->allocated == 2);
+
+    // Exhaust the pool past its initial capacity
+    distance_vector_t* extra[8];
+    for (size_t i = 0; i < 8; i++) {
+        extra[i] = vector_pool_acquire(pool);
+        mu_assert("test_vector_pool: Pool ran out of vectors", extra[i] != NULL);
+    }
+    mu_assert("test_vector_pool: Pool did not grow past its capacity", pool->allocated == 10);
+    for (size_t i = 0; i < 8; i++) {
+        vector_release(extra[i]);
+    }
+    vector_release(reused);
+    vector_release(other);
+    vector_pool_destroy(pool);
+    return NULL;
+}
+
+char* test_distance_vector_encoding() {
+    print_test_details(__func__, "Testing compact distance vector encodings");
+    size_t length = 64;
+    distance_t dist[length];
+    distance_t decoded[length];
+    distance_t merged[length];
+    vector_pool_t* pool = vector_pool_create(length);
+    enum vector_encoding encodings[] = {VECTOR_AUTO, VECTOR_DENSE, VECTOR_SPARSE, VECTOR_RUNS};
+    for (size_t wide = 0; wide < 2; wide++) {
+        // a few runs of finite distances between runs of inf_distance
+        for (size_t i = 0; i < length; i++) {
+            dist[i] = ((i % 16) < 3) ? (distance_t)(i + (wide ? 100000 : 1)) : inf_distance;
+        }
+        for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+            distance_vector_t* vector = vector_pool_acquire(pool);
+            vector_encode(vector, dist, encodings[e]);
+            mu_assert("test_distance_vector_encoding: Chose an encoding larger than dense", vector->bytes <= length * sizeof(distance_t));
+            mu_assert("test_distance_vector_encoding: Used 16-bit distances that do not fit", !wide || vector->wide);
+            if (encodings[e] == VECTOR_AUTO) {
+                mu_assert("test_distance_vector_encoding: Did not pick a compact encoding", vector->bytes < length * sizeof(uint16_t));
+            }
+            vector_decode(vector, decoded);
+            for (size_t i = 0; i < length; i++) {
+                mu_assert("test_distance_vector_encoding: Decoded distance does not match", decoded[i] == dist[i]);
+                merged[i] = (i == 1) ? 0 : inf_distance;
+            }
+            mu_assert("test_distance_vector_encoding: Merge did not report a change", vector_merge(vector, 5, merged, NULL, 0));
+            for (size_t i = 0; i < length; i++) {
+                distance_t expected = (i == 1) ? 0 : ((dist[i] == inf_distance) ? inf_distance : dist[i] + 5);
+                mu_assert("test_distance_vector_encoding: Merged distance does not match", merged[i] == expected);
+            }
+            mu_assert("test_distance_vector_encoding: Merge reported a change that did not happen", !vector_merge(vector, 5, merged, NULL, 0));
+            vector_release(vector);
+        }
+    }
+
+    // Kept inf_distance entries are sent explicitly, and still never lower a distance
+    bool keep[length];
+    for (size_t i = 0; i < length; i++) {
+        dist[i] = ((i % 16) < 3) ? (distance_t)(i + 1) : inf_distance;
+        keep[i] = (i % 16) == 3;
+    }
+    for (size_t e = 1; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+        distance_vector_t* plain = vector_pool_acquire(pool);
+        distance_vector_t* kept = vector_pool_acquire(pool);
+        vector_encode(plain, dist, encodings[e]);
+        vector_encode_keep(kept, dist, keep, encodings[e]);
+        if (encodings[e] == VECTOR_DENSE) {
+            mu_assert("test_distance_vector_encoding: Dense vector changed size", kept->bytes == plain->bytes);
+        } else {
+            mu_assert("test_distance_vector_encoding: Kept entries not encoded", kept->bytes > plain->bytes);
+        }
+        vector_decode(kept, decoded);
+        for (size_t i = 0; i < length; i++) {
+            merged[i] = 1000;
+            mu_assert("test_distance_vector_encoding: Decoded kept distance does not match", decoded[i] == dist[i]);
+        }
+        vector_merge(kept, 5, merged, NULL, 0);
+        for (size_t i = 0; i < length; i++) {
+            distance_t expected = (dist[i] == inf_distance) ? 1000 : dist[i] + 5;
+            mu_assert("test_distance_vector_encoding: Kept entry changed a distance", merged[i] == expected);
+        }
+        vector_release(plain);
+        vector_release(kept);
+    }
+    vector_pool_destroy(pool);
+    return NULL;
+}
+
+char* test_stress_compact_vectors() {
+    print_test_details(__func__, "Stress Testing with each distance vector encoding");
+    enum vector_encoding encodings[] = {VECTOR_AUTO, VECTOR_DENSE, VECTOR_SPARSE, VECTOR_RUNS};
+    const char* files[] = {"topology.txt", "random_topology.txt", "big_graph.txt"};
+    for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+        for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+            stress_options_t options;
+            stress_options_init(&options, 2, 1, files[f]);
+            options.encoding = encodings[e];
+            run_stress_options(&options, NULL);
+        }
+    }
+    return NULL;
+}
+
+char* test_stress_route_modes() {
+    print_test_details(__func__, "Stress Testing with split horizon and poison reverse");
+    enum route_mode modes[] = {ROUTE_FULL, ROUTE_SPLIT_HORIZON, ROUTE_POISON_REVERSE};
+    const char* files[] = {"topology.txt", "connected_topology.txt", "random_topology_1.txt", "big_graph.txt"};
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+        stress_report_t reports[3];
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            stress_options_t options;
+            stress_options_init(&options, 1, 1, files[f]);
+            // sparse vectors leave out inf_distance entries unless they are poisoned
+            options.encoding = VECTOR_SPARSE;
+            options.route_mode = modes[m];
+            run_stress_options(&options, &reports[m]);
+            mu_assert("test_stress_route_modes: Route mode not reported", reports[m].route_mode == modes[m]);
+            mu_assert("test_stress_route_modes: No vectors sent", reports[m].total_messages > 0);
+            if (modes[m] == ROUTE_POISON_REVERSE) {
+                mu_assert("test_stress_route_modes: Poison reverse sent no poisoned routes", reports[m].total_poisoned_routes > 0);
+            } else {
+                mu_assert("test_stress_route_modes: Poisoned routes sent without poison reverse", reports[m].total_poisoned_routes == 0);
+            }
+        }
+        // split horizon leaves out the routes poison reverse sends back, so its vectors are smaller on the wire
+        stress_report_t* split = &reports[1];
+        stress_report_t* poison = &reports[2];
+        mu_assert("test_stress_route_modes: Poisoned routes did not reach the wire",
+                  split->total_bytes * poison->total_messages < poison->total_bytes * split->total_messages);
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            stress_report_free(&reports[m]);
+        }
+    }
+    return NULL;
+}
+
+char* test_stress_link_state() {
+    print_test_details(__func__, "Stress Testing with link-state routing");
+    const char* files[] = {"topology.txt", "connected_topology.txt", "random_topology.txt", "random_topology_1.txt", "big_graph.txt"};
+    size_t sizes[] = {1, 16};
+    for (size_t b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+        for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+            stress_options_t options;
+            stress_options_init(&options, sizes[b], 1, files[f]);
+            options.algorithm = ALGORITHM_LINK_STATE;
+            stress_report_t report;
+            run_stress_options(&options, &report);
+            mu_assert("test_stress_link_state: Algorithm not reported", report.algorithm == ALGORITHM_LINK_STATE);
+            mu_assert("test_stress_link_state: No LSAs were flooded", report.num_routers < 2 || report.total_messages > 0);
+            mu_assert("test_stress_link_state: Flood time exceeds convergence time", report.flood_nsec <= report.convergence_nsec);
+            stress_report_free(&report);
+        }
+    }
+    return NULL;
+}
+
+char* test_partition_graph() {
+    print_test_details(__func__, "Testing the router graph partitioner");
+    // two triangles joined by a single link
+    size_t num_nodes = 6;
+    distance_t topology[36];
+    for (size_t i = 0; i < 36; i++) {
+        topology[i] = inf_distance;
+    }
+    size_t links[][2] = {{0, 2}, {2, 4}, {0, 4}, {1, 3}, {3, 5}, {1, 5}, {4, 5}};
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        topology[links[i][0] * num_nodes + links[i][1]] = 1;
+        topology[links[i][1] * num_nodes + links[i][0]] = 1;
+    }
+    size_t partition[6];
+    mu_assert("test_partition_graph: Wrong link count", count_links(topology, num_nodes) == 7);
+    size_t cut = partition_graph(topology, num_nodes, 2, partition);
+    mu_assert("test_partition_graph: Triangles were split", cut == 1);
+    mu_assert("test_partition_graph: Triangle 0 split", partition[0] == partition[2] && partition[0] == partition[4]);
+    mu_assert("test_partition_graph: Triangle 1 split", partition[1] == partition[3] && partition[1] == partition[5]);
+    cut = partition_graph(topology, num_nodes, 4, partition);
+    size_t sizes[4] = {0};
+    for (size_t i = 0; i < num_nodes; i++) {
+        mu_assert("test_partition_graph: Invalid part", partition[i] < 4);
+        sizes[partition[i]]++;
+    }
+    for (size_t i = 0; i < 4; i++) {
+        mu_assert("test_partition_graph: Parts are unbalanced", sizes[i] == 1 || sizes[i] == 2);
+    }
+    mu_assert("test_partition_graph: Edge cut larger than link count", cut <= 7);
+
+    // a ring large enough that rescanning every router per step would show, cut into contiguous arcs
+    size_t ring = 2000;
+    distance_t* big = malloc(ring * ring * sizeof(distance_t));
+    size_t* ring_partition = malloc(ring * sizeof(size_t));
+    for (size_t i = 0; i < ring * ring; i++) {
+        big[i] = inf_distance;
+    }
+    for (size_t i = 0; i < ring; i++) {
+        big[i * ring + (i + 1) % ring] = 1;
+        big[((i + 1) % ring) * ring + i] = 1;
+    }
+    cut = partition_graph(big, ring, 8, ring_partition);
+    size_t ring_sizes[8] = {0};
+    for (size_t i = 0; i < ring; i++) {
+        ring_sizes[ring_partition[i]]++;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        mu_assert("test_partition_graph: Ring parts are unbalanced", ring_sizes[i] == ring / 8);
+    }
+    mu_assert("test_partition_graph: Ring cut into more than arcs", cut <= 16);
+    free(big);
+    free(ring_partition);
+    return NULL;
+}
+
+char* test_stress_partitioned() {
+    print_test_details(__func__, "Stress Testing with routers partitioned onto worker threads");
+    enum route_mode modes[] = {ROUTE_FULL, ROUTE_SPLIT_HORIZON, ROUTE_POISON_REVERSE};
+    const char* files[] = {"topology.txt", "connected_topology.txt", "random_topology_1.txt", "big_graph.txt"};
+    size_t workers[] = {1, 2, 3, 8};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+            for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); w++) {
+                stress_options_t options;
+                stress_options_init(&options, 4, 1, files[f]);
+                options.route_mode = modes[m];
+                options.num_workers = workers[w];
+                stress_report_t report;
+                run_stress_options(&options, &report);
+                mu_assert("test_stress_partitioned: Wrong thread count",
+                          report.num_threads == (workers[w] < report.num_routers ? workers[w] : report.num_routers));
+                mu_assert("test_stress_partitioned: Edge cut larger than link count", report.edge_cut <= report.num_links);
+                if (workers[w] == 1) {
+                    mu_assert("test_stress_partitioned: Single worker used channels", report.total_messages == 0);
+                }
+                stress_report_free(&report);
+            }
+        }
+    }
+    return NULL;
+}
+
+char* test_receive_timeout() {
+    print_test_details(__func__, "Testing receive with a timeout");
+    chan_t* channel = channel_create(2);
+    void* out = NULL;
+
+    // Nothing to receive, the call must give up
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mu_assert("test_receive_timeout: Receive on empty channel did not time out", channel_receive_timeout(channel, &out, 20000000) == WOULDBLOCK);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    mu_assert("test_receive_timeout: Returned before the timeout", elapsed_usec >= 20000);
+    mu_assert("test_receive_timeout: Output changed on timeout", out == NULL);
+
+    // Data already there is received right away
+    channel_send(channel, "Message1", true);
+    mu_assert("test_receive_timeout: Receive failed", channel_receive_timeout(channel, &out, 20000000) == SUCCESS);
+    mu_assert("test_receive_timeout: Wrong value received", string_equal(out, "Message1"));
+    mu_assert("test_receive_timeout: Depth not updated", channel_depth(channel) == 0);
+
+    channel_close(channel);
+    mu_assert("test_receive_timeout: Receive on closed channel", channel_receive_timeout(channel, &out, 20000000) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+// Handler counting the messages a worker pool handled
+void count_message(void* data, void* arg)
+{
+    (void)data;
+    // a little work per message so the channel backs up
+    for (volatile int i = 0; i < 2000; i++) {
+    }
+    atomic_fetch_add((atomic_size_t*)arg, 1);
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t locked_calls;
+    size_t unlocked_calls;
+    bool mutex_free; // Whether every unlocked call found the channel's mutex free
+} deferring_hook_args;
+
+// Send hook asking for a second call after every locked one
+bool deferring_hook(void* arg, size_t depth, bool unlocked)
+{
+    (void)depth;
+    deferring_hook_args* args = arg;
+    if (!unlocked) {
+        args->locked_calls++;
+        return true;
+    }
+    args->unlocked_calls++;
+    if (pthread_mutex_trylock(&args->channel->mutex) == 0) {
+        pthread_mutex_unlock(&args->channel->mutex);
+    } else {
+        args->mutex_free = false;
+    }
+    return false;
+}
+
+char* test_worker_pool() {
+    print_test_details(__func__, "Testing the elastic worker pool");
+    chan_t* channel = channel_create(64);
+
+    // the pool starts workers from a send hook call deferred until the channel is unlocked
+    deferring_hook_args hook = {channel, 0, 0, true};
+    channel_set_send_hook(channel, deferring_hook, &hook);
+    channel_send(channel, (void*)1, true);
+    void* batch[3] = {(void*)2, (void*)3, (void*)4};
+    channel_send_batch(channel, batch, 3, true, NULL);
+    channel_set_send_hook(channel, NULL, NULL);
+    mu_assert("test_worker_pool: Hook not called once per send", hook.locked_calls == 2);
+    mu_assert("test_worker_pool: Deferred hook call missing", hook.unlocked_calls == 2 && hook.mutex_free);
+    while (channel_receive(channel, &batch[0], false) == SUCCESS) {
+    }
+    atomic_size_t handled;
+    atomic_init(&handled, 0);
+    worker_pool_options_t options;
+    worker_pool_options_init(&options);
+    options.max_workers = 4;
+    options.depth_per_worker = 4;
+    options.linger_nsec = 20000000;
+    worker_pool_t* pool = worker_pool_create(channel, &options, count_message, &handled);
+    mu_assert("test_worker_pool: Pool not created", pool != NULL);
+    worker_pool_stats_t stats;
+    worker_pool_stats(pool, &stats);
+    mu_assert("test_worker_pool: Idle pool started workers", stats.workers == 0);
+
+    // a burst makes the pool grow
+    size_t num_msgs = 5000;
+    for (size_t i = 0; i < num_msgs; i++) {
+        channel_send(channel, (void*)(i + 1), true);
+    }
+    while (atomic_load(&handled) < num_msgs) {
+        usleep(1000);
+    }
+    worker_pool_stats(pool, &stats);
+    mu_assert("test_worker_pool: Pool did not grow", stats.peak_workers > 1);
+    mu_assert("test_worker_pool: Pool grew past max_workers", stats.peak_workers <= options.max_workers);
+
+    // once idle for the linger period the workers retire
+    for (size_t i = 0; i < 200 && stats.workers > 0; i++) {
+        usleep(5000);
+        worker_pool_stats(pool, &stats);
+    }
+    mu_assert("test_worker_pool: Idle workers did not retire", stats.workers == 0);
+    mu_assert("test_worker_pool: Retirements not counted", stats.retired == stats.started);
+
+    // a single message starts a worker again
+    channel_send(channel, (void*)1, true);
+    while (atomic_load(&handled) < num_msgs + 1) {
+        usleep(1000);
+    }
+    channel_close(channel);
+    worker_pool_destroy(pool);
+    channel_destroy(channel);
+    return NULL;
+}
+
+void* pipeline_add_one(void* item, void* arg)
+{
+    (void)arg;
+    return (void*)((size_t)item + 1);
+}
+
+void* pipeline_drop_multiples_of_three(void* item, void* arg)
+{
+    (void)arg;
+    return ((size_t)item % 3 == 0) ? NULL : item;
+}
+
+void* pipeline_double(void* item, void* arg)
+{
+    (void)arg;
+    return (void*)((size_t)item * 2);
+}
+
+#define PIPELINE_ITEMS 20000
+
+void* pipeline_producer(void* arg)
+{
+    pipeline_t* pipeline = arg;
+    for (size_t i = 1; i <= PIPELINE_ITEMS; i++) {
+        assert(pipeline_push(pipeline, (void*)i) == SUCCESS);
+        if (i % 1000 == 0) {
+            // partial batches flow too
+            assert(pipeline_flush(pipeline) == SUCCESS);
+        }
+    }
+    assert(pipeline_close(pipeline) == SUCCESS);
+    assert(pipeline_push(pipeline, (void*)1) == CLOSED_ERROR);
+    return NULL;
+}
+
+char* test_pipeline() {
+    print_test_details(__func__, "Testing pipeline stages with batched hand-off");
+    bool ordered_modes[] = {true, false};
+    size_t batch_sizes[] = {1, 7, 64};
+    for (size_t o = 0; o < 2; o++) {
+        for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+            bool ordered = ordered_modes[o];
+            pipeline_t* pipeline = pipeline_create(batch_sizes[b], 4, ordered);
+            mu_assert("test_pipeline: Pipeline not created", pipeline != NULL);
+            mu_assert("test_pipeline: Started without stages", !pipeline_start(pipeline));
+            mu_assert("test_pipeline: Stage not added", pipeline_add_stage(pipeline, pipeline_add_one, NULL, 4));
+            mu_assert("test_pipeline: Stage not added", pipeline_add_stage(pipeline, pipeline_drop_multiples_of_three, NULL, 2));
+            mu_assert("test_pipeline: Stage not added", pipeline_add_stage(pipeline, pipeline_double, NULL, 1));
+            mu_assert("test_pipeline: Pipeline not started", pipeline_start(pipeline));
+            mu_assert("test_pipeline: Stage added after start", !pipeline_add_stage(pipeline, pipeline_double, NULL, 1));
+
+            pthread_t pid;
+            pthread_create(&pid, NULL, pipeline_producer, pipeline);
+            // items 2..PIPELINE_ITEMS + 1 that are not multiples of 3, doubled
+            size_t expected_count = 0;
+            size_t expected_sum = 0;
+            for (size_t i = 2; i <= PIPELINE_ITEMS + 1; i++) {
+                if (i % 3 != 0) {
+                    expected_count++;
+                    expected_sum += i * 2;
+                }
+            }
+            size_t count = 0;
+            size_t sum = 0;
+            size_t last = 0;
+            void* item = NULL;
+            while (pipeline_pop(pipeline, &item) == SUCCESS) {
+                size_t value = (size_t)item;
+                if (ordered) {
+                    mu_assert("test_pipeline: Items out of order", value > last);
+                }
+                mu_assert("test_pipeline: Dropped item came out", (value / 2) % 3 != 0);
+                last = value;
+                sum += value;
+                count++;
+            }
+            pthread_join(pid, NULL);
+            mu_assert("test_pipeline: Wrong number of items", count == expected_count);
+            mu_assert("test_pipeline: Wrong items", sum == expected_sum);
+            mu_assert("test_pipeline: Pop after end of stream", pipeline_pop(pipeline, &item) == CLOSED_ERROR);
+            pipeline_destroy(pipeline);
+        }
+    }
+
+    // destroying a pipeline mid stream frees what is in flight
+    pipeline_t* pipeline = pipeline_create(8, 2, true);
+    pipeline_add_stage(pipeline, pipeline_add_one, NULL, 2);
+    pipeline_start(pipeline);
+    for (size_t i = 1; i <= 40; i++) {
+        pipeline_push(pipeline, (void*)i);
+    }
+    pipeline_destroy(pipeline);
+    return NULL;
+}
+
+char* test_send_batch() {
+    print_test_details(__func__, "Testing batched send");
+    chan_t* channel = channel_create(4);
+    void* messages[] = {"Message1", "Message2", "Message3", "Message4", "Message5", "Message6"};
+    size_t sent = 0;
+
+    // Only what fits is written without blocking
+    mu_assert("test_send_batch: Non-blocking batch did not stop when full", channel_send_batch(channel, messages, 6, false, &sent) == WOULDBLOCK);
+    mu_assert("test_send_batch: Wrong number of messages sent", sent == 4);
+    mu_assert("test_send_batch: Wrong buffer size", buffer_current_size(channel->buffer) == 4);
+    void* out = NULL;
+    for (size_t i = 0; i < 4; i++) {
+        channel_receive(channel, &out, true);
+        mu_assert("test_send_batch: Messages out of order", string_equal(out, messages[i]));
+    }
+
+    // A blocking batch larger than the buffer completes as the receiver drains it
+    receive_args data_rec[6];
+    pthread_t pid[6];
+    sem_t done;
+    sem_init(&done, 0, 0);
+    mu_assert("test_send_batch: Empty batch failed", channel_send_batch(channel, messages, 0, true, &sent) == SUCCESS && sent == 0);
+    for (size_t i = 0; i < 6; i++) {
+        init_object_for_receive_api(&data_rec[i], channel, &done);
+        pthread_create(&pid[i], NULL, (void *)helper_receive, &data_rec[i]);
+    }
+    mu_assert("test_send_batch: Blocking batch failed", channel_send_batch(channel, messages, 6, true, &sent) == SUCCESS);
+    mu_assert("test_send_batch: Wrong number of messages sent", sent == 6);
+    for (size_t i = 0; i < 6; i++) {
+        pthread_join(pid[i], NULL);
+    }
+    mu_assert("test_send_batch: Buffer not drained", buffer_current_size(channel->buffer) == 0);
+
+    channel_close(channel);
+    mu_assert("test_send_batch: Batch on closed channel", channel_send_batch(channel, messages, 2, true, &sent) == CLOSED_ERROR);
+    mu_assert("test_send_batch: Sent on closed channel", sent == 0);
+    sem_destroy(&done);
+    channel_destroy(channel);
+    return NULL;
+}
+
+char* test_send_buffer() {
+    print_test_details(__func__, "Testing producer send buffers");
+    chan_t* channel = channel_create(64);
+    void* out = NULL;
+    send_buffer_stats_t stats;
+
+    // Without linger messages only move when the buffer fills or is flushed
+    send_buffer_t* buffer = send_buffer_create(channel, 16, 0);
+    mu_assert("test_send_buffer: Buffer not created", buffer != NULL);
+    for (size_t i = 1; i <= 15; i++) {
+        mu_assert("test_send_buffer: Send failed", send_buffer_send(buffer, (void*)i) == SUCCESS);
+    }
+    mu_assert("test_send_buffer: Flushed before full", channel_receive(channel, &out, false) == WOULDBLOCK);
+    mu_assert("test_send_buffer: Send failed", send_buffer_send(buffer, (void*)16) == SUCCESS);
+    mu_assert("test_send_buffer: Full buffer not flushed", buffer_current_size(channel->buffer) == 16);
+    mu_assert("test_send_buffer: Send failed", send_buffer_send(buffer, (void*)17) == SUCCESS);
+    mu_assert("test_send_buffer: Flush failed", send_buffer_flush(buffer) == SUCCESS);
+    for (size_t i = 1; i <= 17; i++) {
+        channel_receive(channel, &out, true);
+        mu_assert("test_send_buffer: Messages out of order", (size_t)out == i);
+    }
+    send_buffer_stats(buffer, &stats);
+    mu_assert("test_send_buffer: Wrong message count", stats.messages == 17);
+    mu_assert("test_send_buffer: Messages not combined", stats.flushes == 2);
+    mu_assert("test_send_buffer: Destroy failed", send_buffer_destroy(buffer) == SUCCESS);
+
+    // Lingering messages are flushed without the producer doing anything
+    buffer = send_buffer_create(channel, 100, 5000000);
+    for (size_t i = 1; i <= 3; i++) {
+        send_buffer_send(buffer, (void*)i);
+    }
+    for (size_t i = 1; i <= 3; i++) {
+        mu_assert("test_send_buffer: Lingering message not flushed", channel_receive_timeout(channel, &out, 1000000000) == SUCCESS);
+        mu_assert("test_send_buffer: Messages out of order", (size_t)out == i);
+    }
+    send_buffer_stats(buffer, &stats);
+    mu_assert("test_send_buffer: Linger flush not counted", stats.linger_flushes == 1);
+    // Destroying flushes what is left
+    send_buffer_send(buffer, (void*)4);
+    mu_assert("test_send_buffer: Destroy failed", send_buffer_destroy(buffer) == SUCCESS);
+    mu_assert("test_send_buffer: Destroy did not flush", channel_receive(channel, &out, false) == SUCCESS && (size_t)out == 4);
+
+    // Errors from the channel reach the producer
+    buffer = send_buffer_create(channel, 2, 0);
+    channel_close(channel);
+    send_buffer_send(buffer, (void*)1);
+    // The message filling the buffer is kept even though its flush failed, the failure comes with the next call
+    mu_assert("test_send_buffer: Buffered message reported as failed", send_buffer_send(buffer, (void*)2) == SUCCESS);
+    mu_assert("test_send_buffer: Closed channel not reported", send_buffer_send(buffer, (void*)3) == CLOSED_ERROR);
+    mu_assert("test_send_buffer: Rejected message was buffered", buffer->count == 2);
+    mu_assert("test_send_buffer: Closed channel not reported", send_buffer_destroy(buffer) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t count; // Messages to receive
+    size_t batches; // Batches they were received in
+} batch_receiver_args;
+
+void* batch_receiver(void* arg)
+{
+    batch_receiver_args* args = arg;
+    void* data[64];
+    size_t total = 0;
+    args->batches = 0;
+    while (total < args->count) {
+        size_t received = 0;
+        enum chan_status status = channel_receive_batch(args->channel, data, 64, true, &received);
+        assert(status == SUCCESS);
+        for (size_t i = 0; i < received; i++) {
+            // messages arrive in order
+            assert((size_t)data[i] == total + i + 1);
+        }
+        total += received;
+        args->batches++;
+    }
+    return NULL;
+}
+
+// Sends count messages one at a time with a short pause in between and returns the receiver's wakeups
+size_t trickle_messages(chan_t* channel, size_t count, size_t* batches)
+{
+    batch_receiver_args args = {channel, count, 0};
+    pthread_t pid;
+    pthread_create(&pid, NULL, batch_receiver, &args);
+    for (size_t i = 1; i <= count; i++) {
+        channel_send(channel, (void*)i, true);
+        usleep(20);
+    }
+    pthread_join(pid, NULL);
+    *batches = args.batches;
+    return channel_receive_wakeups(channel);
+}
+
+char* test_wake_policy() {
+    print_test_details(__func__, "Testing deferred receiver wakeups");
+    size_t count = 2000;
+    size_t batches = 0;
+    chan_t* channel = channel_create(256);
+    size_t eager_wakeups = trickle_messages(channel, count, &batches);
+    channel_close(channel);
+    channel_destroy(channel);
+
+    channel = channel_create(256);
+    channel_set_wake_policy(channel, 32, 100000000);
+    size_t coalesced_wakeups = trickle_messages(channel, count, &batches);
+    mu_assert("test_wake_policy: Receiver did not get batches", batches <= count / 8);
+    mu_assert("test_wake_policy: Wakeups were not coalesced", coalesced_wakeups * 4 < eager_wakeups || coalesced_wakeups <= 2 * count / 32 + 2);
+
+    // a lone message is delivered once it waited the delay
+    channel_set_wake_policy(channel, 32, 5000000);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    channel_send(channel, (void*)1, true);
+    void* out = NULL;
+    mu_assert("test_wake_policy: Lone message not received", channel_receive(channel, &out, true) == SUCCESS && (size_t)out == 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    mu_assert("test_wake_policy: Lone message delivered before the delay", elapsed_usec >= 5000);
+    mu_assert("test_wake_policy: Lone message delayed too long", elapsed_usec < 1000000);
+
+    // non-blocking receives are not held back
+    channel_send(channel, (void*)2, true);
+    size_t received = 0;
+    void* data[4];
+    mu_assert("test_wake_policy: Non-blocking batch receive failed", channel_receive_batch(channel, data, 4, false, &received) == SUCCESS);
+    mu_assert("test_wake_policy: Wrong batch", received == 1 && (size_t)data[0] == 2);
+    mu_assert("test_wake_policy: Empty batch receive", channel_receive_batch(channel, data, 4, false, &received) == WOULDBLOCK);
+    channel_close(channel);
+    mu_assert("test_wake_policy: Batch receive on closed channel", channel_receive_batch(channel, data, 4, true, &received) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+// Returns the microseconds elapsed since start
+long usec_since(const struct timespec* start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_nsec - start->tv_nsec) / 1000;
+}
+
+char* test_timer_channels() {
+    print_test_details(__func__, "Testing timer channels driven by the timer wheel");
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    chan_t* after = channel_after(20000000);
+    void* out = NULL;
+    mu_assert("test_timer_channels: Timer fired early", channel_receive(after, &out, false) == WOULDBLOCK);
+    mu_assert("test_timer_channels: Timer did not fire", channel_receive(after, &out, true) == SUCCESS && (size_t)out == 1);
+    long elapsed_usec = usec_since(&start);
+    mu_assert("test_timer_channels: Timer fired before its duration", elapsed_usec >= 20000);
+    mu_assert("test_timer_channels: Timer fired too late", elapsed_usec < 1000000);
+    mu_assert("test_timer_channels: Stopping a fired timer failed", channel_timer_stop(after) == SUCCESS);
+
+    // a stopped timer never fires
+    after = channel_after(5000000);
+    chan_t* later = channel_after(30000000);
+    mu_assert("test_timer_channels: Stopping a pending timer failed", channel_timer_stop(after) == SUCCESS);
+    mu_assert("test_timer_channels: Later timer did not fire", channel_receive(later, &out, true) == SUCCESS);
+    mu_assert("test_timer_channels: Later timer still pending", channel_timer_stop(later) == SUCCESS && timer_pending_count() == 0);
+    chan_t* plain = channel_create(1);
+    mu_assert("test_timer_channels: Stopped a non-timer channel", channel_timer_stop(plain) == OTHER_ERROR);
+    channel_destroy(plain);
+
+    // a ticker races a timeout in select
+    chan_t* ticker = channel_ticker(2000000);
+    chan_t* timeout = channel_after(50000000);
+    size_t ticks = 0;
+    size_t last_tick = 0;
+    while (true) {
+        select_t list[] = {{ticker, false, NULL}, {timeout, false, NULL}};
+        size_t index = 0;
+        mu_assert("test_timer_channels: Select failed", channel_select(2, list, &index) == SUCCESS);
+        if (index == 1) {
+            break;
+        }
+        mu_assert("test_timer_channels: Ticks out of order", (size_t)list[0].data > last_tick);
+        last_tick = (size_t)list[0].data;
+        ticks++;
+    }
+    mu_assert("test_timer_channels: Ticker did not tick", ticks >= 5);
+    mu_assert("test_timer_channels: Ticker ticked too often", ticks <= 26);
+    mu_assert("test_timer_channels: Ticker not pending", timer_pending_count() == 1);
+    channel_timer_stop(timeout);
+    channel_timer_stop(ticker);
+    mu_assert("test_timer_channels: Invalid ticker", channel_ticker(0) == NULL);
+
+    // many concurrent timers, spread over the first two wheel levels, all fire
+    size_t count = 2000;
+    chan_t** timers = malloc(count * sizeof(chan_t*));
+    for (size_t i = 0; i < count; i++) {
+        timers[i] = channel_after((uint64_t)(i % 100) * 1000000);
+    }
+    mu_assert("test_timer_channels: Timers not pending", timer_pending_count() > 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) {
+        mu_assert("test_timer_channels: Timer lost", channel_receive(timers[i], &out, true) == SUCCESS);
+    }
+    mu_assert("test_timer_channels: Timers took too long", usec_since(&start) < 2000000);
+    mu_assert("test_timer_channels: Timers left pending", timer_pending_count() == 0);
+    for (size_t i = 0; i < count; i++) {
+        channel_timer_stop(timers[i]);
+    }
+    free(timers);
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t first; // First message sent
+    size_t count; // Number of messages sent
+} merge_sender_args;
+
+void* merge_sender(void* arg)
+{
+    merge_sender_args* args = arg;
+    for (size_t i = 0; i < args->count; i++) {
+        channel_send(args->channel, (void*)(args->first + i), true);
+        if (i % 64 == 0) {
+            usleep(100);
+        }
+    }
+    return NULL;
+}
+
+char* test_merge() {
+    print_test_details(__func__, "Testing merged receives across channels");
+    size_t num_members = 3;
+    chan_t* members[3];
+    for (size_t i = 0; i < num_members; i++) {
+        members[i] = channel_create(16);
+        for (size_t j = 0; j < 4; j++) {
+            channel_send(members[i], (void*)(i * 100 + j + 1), true);
+        }
+    }
+
+    // round robin takes turns between busy members, in each member's order
+    merge_t* merge = merge_create(members, num_members, MERGE_ROUND_ROBIN);
+    void* out = NULL;
+    size_t member = 0;
+    for (size_t j = 0; j < 4; j++) {
+        for (size_t i = 0; i < num_members; i++) {
+            mu_assert("test_merge: Round robin receive failed", merge_receive(merge, &out, &member, false) == SUCCESS);
+            mu_assert("test_merge: Round robin skipped a member", member == i && (size_t)out == i * 100 + j + 1);
+        }
+    }
+    mu_assert("test_merge: Received from empty members", merge_receive(merge, &out, &member, false) == WOULDBLOCK);
+
+    // posts for messages received from a member directly are dropped by the next scan instead of waking receivers later
+    for (size_t j = 0; j < 5; j++) {
+        channel_send(members[0], (void*)(j + 1), true);
+        channel_receive(members[0], &out, true);
+    }
+    int posts = 0;
+    sem_getvalue(&merge->ready, &posts);
+    mu_assert("test_merge: Sends did not post the merge", posts == 5);
+    mu_assert("test_merge: Received a message taken directly", merge_receive(merge, &out, &member, false) == WOULDBLOCK);
+    sem_getvalue(&merge->ready, &posts);
+    mu_assert("test_merge: Stale posts kept", posts == 0);
+    merge_destroy(merge);
+
+    // priority drains the first member first
+    for (size_t i = 0; i < num_members; i++) {
+        channel_send(members[i], (void*)(i + 1), true);
+        channel_send(members[i], (void*)(i + 1), true);
+    }
+    merge = merge_create(members, num_members, MERGE_PRIORITY);
+    size_t expected[] = {0, 0, 1, 1, 2, 2};
+    for (size_t k = 0; k < 6; k++) {
+        mu_assert("test_merge: Priority receive failed", merge_receive(merge, &out, &member, true) == SUCCESS);
+        mu_assert("test_merge: Priority order not kept", member == expected[k] && (size_t)out == member + 1);
+    }
+    merge_destroy(merge);
+
+    // blocking receives wake on sends to any member, and every message arrives once
+    merge = merge_create(members, num_members, MERGE_RANDOM);
+    size_t per_member = 1000;
+    pthread_t pids[3];
+    merge_sender_args args[3];
+    for (size_t i = 0; i < num_members; i++) {
+        args[i] = (merge_sender_args){members[i], i * per_member, per_member};
+        pthread_create(&pids[i], NULL, merge_sender, &args[i]);
+    }
+    bool* seen = calloc(num_members * per_member, sizeof(bool));
+    for (size_t k = 0; k < num_members * per_member; k++) {
+        mu_assert("test_merge: Blocking receive failed", merge_receive(merge, &out, &member, true) == SUCCESS);
+        mu_assert("test_merge: Wrong member reported", (size_t)out / per_member == member);
+        mu_assert("test_merge: Message received twice", !seen[(size_t)out]);
+        seen[(size_t)out] = true;
+    }
+    free(seen);
+    for (size_t i = 0; i < num_members; i++) {
+        pthread_join(pids[i], NULL);
+    }
+
+    // closed members are skipped until all of them are closed
+    channel_close(members[0]);
+    channel_send(members[1], (void*)7, true);
+    mu_assert("test_merge: Open member not received", merge_receive(merge, &out, &member, true) == SUCCESS && member == 1);
+    channel_close(members[1]);
+    channel_close(members[2]);
+    mu_assert("test_merge: Closed merge receive", merge_receive(merge, &out, &member, true) == CLOSED_ERROR);
+    merge_destroy(merge);
+    for (size_t i = 0; i < num_members; i++) {
+        mu_assert("test_merge: Merge left registered", !chan_waiters_any(&members[i]->receive_waiters));
+        channel_destroy(members[i]);
+    }
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t count; // Messages to send, blocking
+    enum chan_status out; // Status of the last send
+} budget_sender_args;
+
+void* budget_sender(void* arg)
+{
+    budget_sender_args* args = arg;
+    args->out = SUCCESS;
+    for (size_t i = 1; i <= args->count && args->out == SUCCESS; i++) {
+        args->out = channel_send(args->channel, (void*)i, true);
+    }
+    return NULL;
+}
+
+void* budget_receiver(void* arg)
+{
+    budget_sender_args* args = arg;
+    void* data = NULL;
+    for (size_t i = 0; i < args->count; i++) {
+        channel_receive(args->channel, &data, true);
+    }
+    return NULL;
+}
+
+char* test_budget() {
+    print_test_details(__func__, "Testing a memory budget shared by several channels");
+    chan_budget_t* budget = budget_create(8, 2);
+    chan_t* channels[3];
+    for (size_t i = 0; i < 3; i++) {
+        channels[i] = channel_create(16);
+        mu_assert("test_budget: Setting the budget failed", channel_set_budget(channels[i], budget, 1) == SUCCESS);
+    }
+    mu_assert("test_budget: Accepted a cost over the limit", channel_set_budget(channels[0], budget, 9) == OTHER_ERROR);
+
+    // the channels together hold no more than the budget, although each has room for more
+    size_t sent = 0;
+    for (size_t k = 0; k < 30; k++) {
+        if (channel_send(channels[k % 3], (void*)1, false) == SUCCESS) {
+            sent++;
+        }
+    }
+    mu_assert("test_budget: Budget not enforced", sent == 8 && budget_used(budget) == 8);
+    mu_assert("test_budget: Budget set on a channel holding messages", channel_set_budget(channels[0], NULL, 0) == OTHER_ERROR);
+    void* out = NULL;
+    mu_assert("test_budget: Receive failed", channel_receive(channels[1], &out, false) == SUCCESS);
+    mu_assert("test_budget: Freed credits not reusable", channel_send(channels[0], (void*)1, false) == SUCCESS);
+    mu_assert("test_budget: Budget exceeded", channel_send(channels[2], (void*)1, false) == WOULDBLOCK);
+
+    // a blocked sender continues once another channel frees credits
+    budget_sender_args args = {channels[0], 1, OTHER_ERROR};
+    pthread_t pid;
+    pthread_create(&pid, NULL, budget_sender, &args);
+    usleep(20000);
+    mu_assert("test_budget: Sender did not block", channel_depth(channels[0]) == 4);
+    mu_assert("test_budget: Receive failed", channel_receive(channels[2], &out, true) == SUCCESS);
+    pthread_join(pid, NULL);
+    mu_assert("test_budget: Blocked sender failed", args.out == SUCCESS && channel_depth(channels[0]) == 5);
+
+    // a sender blocked on the budget gives up when its channel closes
+    void* batch_closed[2] = {NULL, NULL};
+    args = (budget_sender_args){channels[2], 1, SUCCESS};
+    pthread_create(&pid, NULL, budget_sender, &args);
+    usleep(20000);
+    channel_close(channels[2]);
+    pthread_join(pid, NULL);
+    mu_assert("test_budget: Blocked sender not closed", args.out == CLOSED_ERROR);
+    // with the budget still used up, a closed channel is reported as closed rather than full
+    mu_assert("test_budget: Budget not used up", budget_used(budget) == 8);
+    mu_assert("test_budget: Closed channel reported as full", channel_send(channels[2], (void*)1, false) == CLOSED_ERROR);
+    mu_assert("test_budget: Closed channel reported as full", channel_send_batch(channels[2], batch_closed, 2, false, &sent) == CLOSED_ERROR && sent == 0);
+    // destroying a channel returns the credits of what it still held
+    channel_destroy(channels[2]);
+    mu_assert("test_budget: Credits of destroyed channel lost", budget_used(budget) == 7);
+
+    // batches are cut down to what the budget has room for
+    void* batch[5] = {NULL, NULL, NULL, NULL, NULL};
+    mu_assert("test_budget: Batch not cut down", channel_send_batch(channels[1], batch, 5, false, &sent) == WOULDBLOCK && sent == 1);
+    size_t received = 0;
+    mu_assert("test_budget: Batch receive failed", channel_receive_batch(channels[1], batch, 5, false, &received) == SUCCESS && received == 3);
+    while (channel_receive(channels[0], &out, false) == SUCCESS) {
+    }
+    mu_assert("test_budget: Credits not returned", budget_used(budget) == 0);
+
+    // many senders and receivers through a tight budget
+    budget_sender_args senders[2] = {{channels[0], 5000, SUCCESS}, {channels[1], 5000, SUCCESS}};
+    pthread_t pids[4];
+    for (size_t i = 0; i < 2; i++) {
+        pthread_create(&pids[i], NULL, budget_sender, &senders[i]);
+        pthread_create(&pids[2 + i], NULL, budget_receiver, &senders[i]);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    mu_assert("test_budget: Stress senders failed", senders[0].out == SUCCESS && senders[1].out == SUCCESS);
+    mu_assert("test_budget: Stress exceeded the budget", channel_peak_size(channels[0]) + channel_peak_size(channels[1]) <= 16);
+    mu_assert("test_budget: Stress leaked credits", budget_used(budget) == 0);
+    for (size_t i = 0; i < 2; i++) {
+        channel_close(channels[i]);
+        channel_destroy(channels[i]);
+    }
+    budget_destroy(budget);
+    return NULL;
+}
+
+typedef struct {
+    size_t id;
+    double weight;
+} typed_point;
+
+DEFINE_CHANNEL(point_channel, typed_point, 4)
+
+void* typed_point_sender(void* arg)
+{
+    point_channel_t* channel = arg;
+    for (size_t i = 0; i < 1000; i++) {
+        typed_point point = {i, (double)i / 2};
+        point_channel_send(channel, point);
+    }
+    return NULL;
+}
+
+char* test_typed_channel() {
+    print_test_details(__func__, "Testing macro generated typed channels");
+    point_channel_t channel;
+    mu_assert("test_typed_channel: Init failed", point_channel_init(&channel) == SUCCESS);
+    typed_point point = {0, 0.0};
+    mu_assert("test_typed_channel: Receive from empty channel", point_channel_try_receive(&channel, &point) == WOULDBLOCK);
+    for (size_t i = 0; i < 4; i++) {
+        typed_point value = {i, (double)i};
+        mu_assert("test_typed_channel: Send failed", point_channel_try_send(&channel, value) == SUCCESS);
+    }
+    mu_assert("test_typed_channel: Send to full channel", point_channel_try_send(&channel, point) == WOULDBLOCK);
+    for (size_t i = 0; i < 4; i++) {
+        mu_assert("test_typed_channel: Receive failed", point_channel_try_receive(&channel, &point) == SUCCESS);
+        mu_assert("test_typed_channel: Values out of order", point.id == i && point.weight == (double)i);
+    }
+
+    // blocking calls wrap around the inline ring many times
+    pthread_t pid;
+    pthread_create(&pid, NULL, typed_point_sender, &channel);
+    for (size_t i = 0; i < 1000; i++) {
+        mu_assert("test_typed_channel: Blocking receive failed", point_channel_receive(&channel, &point) == SUCCESS);
+        mu_assert("test_typed_channel: Blocking values out of order", point.id == i && point.weight == (double)i / 2);
+    }
+    pthread_join(pid, NULL);
+
+    // the ring lives in the struct, no chan_t is made until select needs one
+    mu_assert("test_typed_channel: Token channel made before select", channel.ready == NULL);
+
+    // selecting on the handle next to a plain channel picks it while values are held
+    chan_t* plain = channel_create(1);
+    select_t list[] = {{plain, false, NULL}, {point_channel_select_handle(&channel), false, NULL}};
+    size_t index = 0;
+    for (size_t i = 0; i < 3; i++) {
+        typed_point value = {7 + i, (double)i};
+        point_channel_send(&channel, value);
+    }
+    for (size_t i = 0; i < 3; i++) {
+        mu_assert("test_typed_channel: Select failed", channel_select(2, list, &index) == SUCCESS && index == 1);
+        mu_assert("test_typed_channel: Receive after select failed", point_channel_try_receive(&channel, &point) == SUCCESS);
+        mu_assert("test_typed_channel: Selected the wrong value", point.id == 7 + i && point.weight == (double)i);
+    }
+    // a value received without select takes its token along
+    point_channel_send(&channel, point);
+    point_channel_receive(&channel, &point);
+    channel_send(plain, (void*)1, true);
+    mu_assert("test_typed_channel: Select picked an empty channel", channel_select(2, list, &index) == SUCCESS && index == 0);
+
+    point_channel_close(&channel);
+    mu_assert("test_typed_channel: Select missed the close", channel_select(2, list, &index) == CLOSED_ERROR && index == 1);
+    mu_assert("test_typed_channel: Send on closed channel", point_channel_send(&channel, point) == CLOSED_ERROR);
+    mu_assert("test_typed_channel: Receive on closed channel", point_channel_receive(&channel, &point) == CLOSED_ERROR);
+    mu_assert("test_typed_channel: Closed twice", point_channel_close(&channel) == CLOSED_ERROR);
+    point_channel_destroy(&channel);
+    channel_close(plain);
+    channel_destroy(plain);
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    enum chan_status out;
+    void* data;
+} inline_select_args;
+
+void* inline_selector(void* arg)
+{
+    inline_select_args* args = arg;
+    select_t list[] = {{args->channel, false, NULL}};
+    size_t index = 0;
+    args->out = channel_select(1, list, &index);
+    args->data = list[0].data;
+    return NULL;
+}
+
+bool count_sends(void* arg, size_t depth, bool unlocked)
+{
+    (void)depth;
+    (void)unlocked;
+    (*(size_t*)arg)++;
+    return false;
+}
+
+char* test_inline_try() {
+    print_test_details(__func__, "Testing the inline try_send/try_receive fast paths");
+    chan_t* channel = channel_create(3);
+    void* out = NULL;
+    mu_assert("test_inline_try: Receive from empty channel", channel_try_receive(channel, &out) == WOULDBLOCK);
+    // wrap the ring a few times
+    for (size_t i = 1; i <= 10; i++) {
+        mu_assert("test_inline_try: Send failed", channel_try_send(channel, (void*)i) == SUCCESS);
+        mu_assert("test_inline_try: Receive failed", channel_try_receive(channel, &out) == SUCCESS && (size_t)out == i);
+    }
+    for (size_t i = 1; i <= 3; i++) {
+        channel_try_send(channel, (void*)i);
+    }
+    mu_assert("test_inline_try: Send to full channel", channel_try_send(channel, (void*)4) == WOULDBLOCK);
+    mu_assert("test_inline_try: Peak not tracked", channel_peak_size(channel) == 3);
+    mu_assert("test_inline_try: Out of line receive disagrees", channel_receive(channel, &out, false) == SUCCESS && (size_t)out == 1);
+    mu_assert("test_inline_try: Inline receive disagrees", channel_try_receive(channel, &out) == SUCCESS && (size_t)out == 2);
+    channel_try_receive(channel, &out);
+
+    // channels with a hook go through channel_send
+    size_t hook_calls = 0;
+    channel_set_send_hook(channel, count_sends, &hook_calls);
+    channel_try_send(channel, (void*)1);
+    channel_set_send_hook(channel, NULL, NULL);
+    mu_assert("test_inline_try: Hook skipped", hook_calls == 1);
+    channel_try_receive(channel, &out);
+
+    // select waiters are still woken
+    inline_select_args args = {channel, OTHER_ERROR, NULL};
+    pthread_t pid;
+    pthread_create(&pid, NULL, inline_selector, &args);
+    usleep(20000);
+    mu_assert("test_inline_try: Send for selector failed", channel_try_send(channel, (void*)9) == SUCCESS);
+    pthread_join(pid, NULL);
+    mu_assert("test_inline_try: Selector not woken", args.out == SUCCESS && (size_t)args.data == 9);
+
+    channel_close(channel);
+    mu_assert("test_inline_try: Send on closed channel", channel_try_send(channel, (void*)1) == CLOSED_ERROR);
+    mu_assert("test_inline_try: Receive on closed channel", channel_try_receive(channel, &out) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+// Returns the number of pages of the large buffer's mapping that are resident
+size_t resident_pages(buffer_t* buffer)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = buffer->mapped_bytes / page;
+    unsigned char* residency = malloc(pages);
+    mincore(buffer->data, buffer->mapped_bytes, residency);
+    size_t resident = 0;
+    for (size_t i = 0; i < pages; i++) {
+        resident += residency[i] & 1;
+    }
+    free(residency);
+    return resident;
+}
+
+char* test_large_buffer() {
+    print_test_details(__func__, "Testing lazily committed large ring buffers");
+    size_t capacity = 1 << 22;
+    size_t page_slots = (size_t)sysconf(_SC_PAGESIZE) / sizeof(void*);
+    chan_t* channel = channel_create_large(capacity, true, false);
+    mu_assert("test_large_buffer: Large channel not created", channel != NULL && channel->buffer->large);
+    mu_assert("test_large_buffer: Ring committed up front", resident_pages(channel->buffer) == 0);
+
+    // a shallow but long running stream stays packed at the start of the ring
+    void* out = NULL;
+    for (size_t i = 1; i <= 200000; i++) {
+        channel_send(channel, (void*)i, false);
+        if (i > 8) {
+            mu_assert("test_large_buffer: Stream out of order", channel_receive(channel, &out, false) == SUCCESS && (size_t)out == i - 8);
+        }
+    }
+    mu_assert("test_large_buffer: Shallow stream walked the ring", channel->buffer->touched <= 8192);
+
+    // a stream too deep to be packed walks the ring, but only the pages under its values stay resident
+    size_t depth = 20000;
+    for (size_t i = 1; i <= 1000000; i++) {
+        channel_send(channel, (void*)i, false);
+        if (i > depth) {
+            channel_receive(channel, &out, false);
+        }
+    }
+    // allow for a transparent huge page committed ahead of the newest value; the stream walked four times as many pages
+    size_t huge_slots = (2u << 20) / sizeof(void*);
+    mu_assert("test_large_buffer: Steady depth kept walked pages", resident_pages(channel->buffer) <= (depth + huge_slots) / page_slots + 4);
+    while (channel_receive(channel, &out, false) == SUCCESS) {
+    }
+
+    // a deep burst commits memory, draining returns it
+    size_t burst = 1 << 20;
+    for (size_t i = 0; i < burst; i++) {
+        mu_assert("test_large_buffer: Burst send failed", channel_send(channel, (void*)i, false) == SUCCESS);
+    }
+    size_t burst_pages = resident_pages(channel->buffer);
+    mu_assert("test_large_buffer: Burst not committed", burst_pages >= burst / page_slots);
+    for (size_t i = 0; i < burst; i++) {
+        mu_assert("test_large_buffer: Burst out of order", channel_receive(channel, &out, false) == SUCCESS && (size_t)out == i);
+    }
+    mu_assert("test_large_buffer: Drained ring not released", resident_pages(channel->buffer) * 4 < burst_pages);
+
+    // the full capacity is usable, across wrap arounds
+    for (size_t i = 0; i < capacity; i++) {
+        channel_send(channel, (void*)i, false);
+    }
+    mu_assert("test_large_buffer: Send to full large channel", channel_send(channel, (void*)1, false) == WOULDBLOCK);
+    for (size_t i = 0; i < capacity / 2; i++) {
+        channel_receive(channel, &out, false);
+    }
+    for (size_t i = 0; i < capacity / 2; i++) {
+        channel_send(channel, (void*)(capacity + i), false);
+    }
+    for (size_t i = capacity / 2; i < capacity + capacity / 2; i++) {
+        mu_assert("test_large_buffer: Wrapped ring out of order", channel_receive(channel, &out, false) == SUCCESS && (size_t)out == i);
+    }
+    channel_close(channel);
+    channel_destroy(channel);
+    return NULL;
+}
+
+typedef struct {
+    arena_t* arena;
+    chan_t* channel;
+    size_t count; // Payloads passed through the channel
+    bool ok; // Whether every payload arrived intact
+} arena_args;
+
+void* arena_producer(void* arg)
+{
+    arena_args* args = arg;
+    for (size_t i = 0; i < args->count; i++) {
+        size_t* payload = arena_alloc(args->arena);
+        payload[0] = i;
+        payload[7] = ~i;
+        channel_send(args->channel, payload, true);
+    }
+    return NULL;
+}
+
+void* arena_consumer(void* arg)
+{
+    arena_args* args = arg;
+    args->ok = true;
+    for (size_t i = 0; i < args->count; i++) {
+        void* data = NULL;
+        channel_receive(args->channel, &data, true);
+        size_t* payload = data;
+        if (payload[0] != i || payload[7] != ~i) {
+            args->ok = false;
+        }
+        arena_release(payload);
+    }
+    arena_flush(args->arena);
+    return NULL;
+}
+
+void* arena_release_one(void* arg)
+{
+    void** args = arg;
+    arena_release(args[1]);
+    arena_flush(args[0]);
+    return NULL;
+}
+
+char* test_arena() {
+    print_test_details(__func__, "Testing the refcounted payload arena");
+    arena_t* arena = arena_create(64, 1);
+    void* payload = arena_alloc(arena);
+    arena_release(payload);
+    mu_assert("test_arena: Local release not reused", arena_alloc(arena) == payload && arena_slab_count(arena) == 1);
+
+    // a payload broadcast to three receivers goes back to its owner after the last release only
+    arena_retain(payload, 2);
+    void* args[2] = {arena, payload};
+    pthread_t pids[3];
+    for (size_t i = 0; i < 2; i++) {
+        pthread_create(&pids[i], NULL, arena_release_one, args);
+        pthread_join(pids[i], NULL);
+    }
+    void* other = arena_alloc(arena);
+    mu_assert("test_arena: Block returned while referenced", other != payload && arena_slab_count(arena) == 2);
+    pthread_create(&pids[2], NULL, arena_release_one, args);
+    pthread_join(pids[2], NULL);
+    mu_assert("test_arena: Block not returned to its owner", arena_alloc(arena) == payload && arena_slab_count(arena) == 2);
+    arena_release(payload);
+    arena_release(other);
+    arena_destroy(arena);
+
+    // remote releases come back in batches and keep the producer's slabs bounded
+    arena = arena_create(64, 64);
+    chan_t* channel = channel_create(64);
+    arena_args stream = {arena, channel, 100000, false};
+    pthread_create(&pids[0], NULL, arena_producer, &stream);
+    pthread_create(&pids[1], NULL, arena_consumer, &stream);
+    pthread_join(pids[0], NULL);
+    pthread_join(pids[1], NULL);
+    mu_assert("test_arena: Payload corrupted", stream.ok);
+    mu_assert("test_arena: Returned blocks not reused", arena_slab_count(arena) <= 4);
+
+    // a new thread adopts the cache of an exited producer and its returned blocks
+    size_t slabs = arena_slab_count(arena);
+    stream.count = 1000;
+    pthread_create(&pids[0], NULL, arena_producer, &stream);
+    pthread_create(&pids[1], NULL, arena_consumer, &stream);
+    pthread_join(pids[0], NULL);
+    pthread_join(pids[1], NULL);
+    mu_assert("test_arena: Exited thread's blocks not adopted", stream.ok && arena_slab_count(arena) == slabs);
+    channel_close(channel);
+    channel_destroy(channel);
+    arena_destroy(arena);
+    return NULL;
+}
+
+size_t count_waiter_entries(chan_waiters_t* waiters)
+{
+    size_t count = 0;
+    for (chan_waiter_t* waiter = atomic_load(&waiters->head); waiter != NULL; waiter = waiter->next) {
+        count++;
+    }
+    return count;
+}
+
+void* waiter_selector(void* arg)
+{
+    chan_t** channels = arg;
+    select_t list[] = {{channels[0], false, NULL}, {channels[1], false, NULL}};
+    for (size_t i = 0; i < 2000; i++) {
+        size_t index = 0;
+        channel_select(2, list, &index);
+    }
+    return NULL;
+}
+
+char* test_select_waiters() {
+    print_test_details(__func__, "Testing the lock-free select waiter stack");
+    chan_t* channel = channel_create(1);
+    sem_t first;
+    sem_t second;
+    sem_init(&first, 0, 0);
+    sem_init(&second, 0, 0);
+    chan_waiters_register(&channel->receive_waiters, &first);
+    chan_waiters_register(&channel->receive_waiters, &first);
+    chan_waiters_register(&channel->receive_waiters, &second);
+    chan_waiters_notify(&channel->receive_waiters);
+    int value = 0;
+    sem_getvalue(&first, &value);
+    mu_assert("test_select_waiters: Not posted once per registration", value == 2);
+
+    // unregistered entries are reused rather than pushed again
+    chan_waiters_unregister(&channel->receive_waiters, &first);
+    chan_waiters_unregister(&channel->receive_waiters, &second);
+    chan_waiters_register(&channel->receive_waiters, &second);
+    chan_waiters_notify(&channel->receive_waiters);
+    sem_getvalue(&first, &value);
+    mu_assert("test_select_waiters: Unregistered sem posted", value == 3);
+    mu_assert("test_select_waiters: Entry not reused", count_waiter_entries(&channel->receive_waiters) == 3);
+    chan_waiters_unregister(&channel->receive_waiters, &first);
+    chan_waiters_unregister(&channel->receive_waiters, &second);
+    mu_assert("test_select_waiters: Still registered", !chan_waiters_any(&channel->receive_waiters));
+    sem_destroy(&first);
+    sem_destroy(&second);
+
+    // selectors keep registering and unregistering while a sender notifies them
+    chan_t* idle = channel_create(1);
+    chan_t* channels[2] = {channel, idle};
+    pthread_t pids[4];
+    for (size_t i = 0; i < 4; i++) {
+        pthread_create(&pids[i], NULL, waiter_selector, channels);
+    }
+    for (size_t i = 0; i < 4 * 2000; i++) {
+        channel_send(channel, NULL, true);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    mu_assert("test_select_waiters: Selectors left registered", !chan_waiters_any(&channel->receive_waiters) && !chan_waiters_any(&idle->receive_waiters));
+    mu_assert("test_select_waiters: Entries not reused", count_waiter_entries(&idle->receive_waiters) <= 4);
+    channel_close(channel);
+    channel_close(idle);
+    channel_destroy(channel);
+    channel_destroy(idle);
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t value;
+    enum chan_status status;
+} queued_sender_args;
+
+void* queued_sender(void* arg)
+{
+    queued_sender_args* args = arg;
+    args->status = channel_send(args->channel, (void*)args->value, true);
+    return NULL;
+}
+
+void* queued_receiver(void* arg)
+{
+    queued_sender_args* args = arg;
+    void* data = NULL;
+    args->status = channel_receive(args->channel, &data, true);
+    args->value = (size_t)data;
+    return NULL;
+}
+
+// Waits until count threads are queued on queue
+void wait_for_queued(chan_t* channel, chan_wait_queue_t* queue, size_t count)
+{
+    while (true) {
+        pthread_mutex_lock(&channel->mutex);
+        size_t queued = queue->count;
+        pthread_mutex_unlock(&channel->mutex);
+        if (queued == count) {
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+char* test_wake_order_fifo() {
+    print_test_details(__func__, "Testing FIFO-fair wakeups of blocked senders and receivers");
+    chan_t* channel = channel_create(1);
+    mu_assert("test_wake_order_fifo: Unknown order accepted", channel_set_wake_order(channel, (enum chan_wake_order)7) == OTHER_ERROR);
+    mu_assert("test_wake_order_fifo: Order not set", channel_set_wake_order(channel, CHAN_WAKE_FIFO) == SUCCESS);
+    channel_send(channel, (void*)100, false);
+
+    // senders are served in the order they blocked, and freed room cannot be taken by a newcomer
+    pthread_t pids[4];
+    queued_sender_args senders[4];
+    for (size_t i = 0; i < 4; i++) {
+        senders[i] = (queued_sender_args){channel, i, OTHER_ERROR};
+        pthread_create(&pids[i], NULL, queued_sender, &senders[i]);
+        wait_for_queued(channel, &channel->send_queue, i + 1);
+    }
+    mu_assert("test_wake_order_fifo: Order changed with threads queued", channel_set_wake_order(channel, CHAN_WAKE_BARGING) == OTHER_ERROR);
+    void* data = NULL;
+    mu_assert("test_wake_order_fifo: Buffered message lost", channel_receive(channel, &data, true) == SUCCESS && (size_t)data == 100);
+    mu_assert("test_wake_order_fifo: Newcomer barged ahead", channel_send(channel, (void*)200, false) == WOULDBLOCK);
+    for (size_t i = 0; i < 4; i++) {
+        mu_assert("test_wake_order_fifo: Senders not served in order", channel_receive(channel, &data, true) == SUCCESS && (size_t)data == i);
+        pthread_join(pids[i], NULL);
+        mu_assert("test_wake_order_fifo: Sender not completed", senders[i].status == SUCCESS);
+    }
+
+    // receivers likewise, with messages handed to them directly
+    queued_sender_args receivers[4];
+    for (size_t i = 0; i < 4; i++) {
+        receivers[i] = (queued_sender_args){channel, 0, OTHER_ERROR};
+        pthread_create(&pids[i], NULL, queued_receiver, &receivers[i]);
+        wait_for_queued(channel, &channel->receive_queue, i + 1);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        channel_send(channel, (void*)(i + 10), true);
+        pthread_join(pids[i], NULL);
+        mu_assert("test_wake_order_fifo: Receivers not served in order", receivers[i].status == SUCCESS && receivers[i].value == i + 10);
+    }
+    mu_assert("test_wake_order_fifo: Handed message left buffered", channel_receive(channel, &data, false) == WOULDBLOCK);
+    mu_assert("test_wake_order_fifo: Queued receive did not time out", channel_receive_timeout(channel, &data, 1000000) == WOULDBLOCK);
+    mu_assert("test_wake_order_fifo: Timed out receiver left queued", channel->receive_queue.count == 2);
+
+    // close releases the rest
+    channel_close(channel);
+    for (size_t i = 2; i < 4; i++) {
+        pthread_join(pids[i], NULL);
+        mu_assert("test_wake_order_fifo: Queued receiver not closed", receivers[i].status == CLOSED_ERROR);
+    }
+    channel_destroy(channel);
+    return NULL;
+}
+
+char* test_wake_order_lifo() {
+    print_test_details(__func__, "Testing LIFO wakeups of blocked receivers");
+    chan_t* channel = channel_create(1);
+    mu_assert("test_wake_order_lifo: Order not set", channel_set_wake_order(channel, CHAN_WAKE_LIFO) == SUCCESS);
+
+    // the most recently blocked receiver gets each message
+    pthread_t pids[3];
+    queued_sender_args receivers[3];
+    for (size_t i = 0; i < 3; i++) {
+        receivers[i] = (queued_sender_args){channel, 0, OTHER_ERROR};
+        pthread_create(&pids[i], NULL, queued_receiver, &receivers[i]);
+        wait_for_queued(channel, &channel->receive_queue, i + 1);
+    }
+    for (size_t i = 3; i-- > 1;) {
+        channel_send(channel, (void*)(i + 10), true);
+        pthread_join(pids[i], NULL);
+        mu_assert("test_wake_order_lifo: Newest receiver not served first", receivers[i].status == SUCCESS && receivers[i].value == i + 10);
+    }
+    mu_assert("test_wake_order_lifo: Oldest receiver woken", channel->receive_queue.count == 1);
+
+    // senders are still served in the order they blocked
+    channel_send(channel, (void*)20, true);
+    pthread_join(pids[0], NULL);
+    channel_send(channel, (void*)100, true);
+    queued_sender_args senders[2];
+    for (size_t i = 0; i < 2; i++) {
+        senders[i] = (queued_sender_args){channel, i, OTHER_ERROR};
+        pthread_create(&pids[i], NULL, queued_sender, &senders[i]);
+        wait_for_queued(channel, &channel->send_queue, i + 1);
+    }
+    void* data = NULL;
+    channel_receive(channel, &data, true);
+    for (size_t i = 0; i < 2; i++) {
+        mu_assert("test_wake_order_lifo: Senders not served in order", channel_receive(channel, &data, true) == SUCCESS && (size_t)data == i);
+        pthread_join(pids[i], NULL);
+    }
+    channel_close(channel);
+    channel_destroy(channel);
+    return NULL;
+}
+
+typedef struct {
+    chan_t* channel;
+    size_t first; // First value sent, or number of values to receive
+    size_t count;
+    size_t* seen; // Receivers count every value they get here
+} eliminate_args;
+
+void* eliminate_sender(void* arg)
+{
+    eliminate_args* args = arg;
+    for (size_t i = 0; i < args->count; i++) {
+        channel_send(args->channel, (void*)(args->first + i + 1), true);
+    }
+    return NULL;
+}
+
+void* eliminate_receiver(void* arg)
+{
+    eliminate_args* args = arg;
+    for (size_t i = 0; i < args->count; i++) {
+        void* data = NULL;
+        channel_receive(args->channel, &data, true);
+        args->seen[(size_t)data - 1]++;
+    }
+    return NULL;
+}
+
+// Same as eliminate_sender, in batches
+void* eliminate_batch_sender(void* arg)
+{
+    eliminate_args* args = arg;
+    void* batch[7];
+    for (size_t i = 0; i < args->count; i += 7) {
+        size_t count = (args->count - i < 7) ? args->count - i : 7;
+        for (size_t j = 0; j < count; j++) {
+            batch[j] = (void*)(args->first + i + j + 1);
+        }
+        channel_send_batch(args->channel, batch, count, true, NULL);
+    }
+    return NULL;
+}
+
+// Same as eliminate_receiver, in batches
+void* eliminate_batch_receiver(void* arg)
+{
+    eliminate_args* args = arg;
+    void* batch[5];
+    size_t done = 0;
+    while (done < args->count) {
+        size_t received = 0;
+        size_t max = (args->count - done < 5) ? args->count - done : 5;
+        if (channel_receive_batch(args->channel, batch, max, true, &received) != SUCCESS) {
+            return NULL;
+        }
+        for (size_t j = 0; j < received; j++) {
+            args->seen[(size_t)batch[j] - 1]++;
+        }
+        done += received;
+    }
+    return NULL;
+}
+
+char* test_elimination() {
+    print_test_details(__func__, "Testing elimination of contended sends and receives");
+    chan_t* channel = channel_create(4);
+    chan_budget_t* budget = budget_create(8, 1);
+    channel_set_budget(channel, budget, 1);
+    mu_assert("test_elimination: Elimination allowed with a budget", channel_set_elimination(channel, 4) == OTHER_ERROR);
+    channel_set_budget(channel, NULL, 0);
+    budget_destroy(budget);
+    mu_assert("test_elimination: Elimination not enabled", channel_set_elimination(channel, 4) == SUCCESS);
+    mu_assert("test_elimination: Queued order allowed with elimination", channel_set_wake_order(channel, CHAN_WAKE_FIFO) == OTHER_ERROR);
+
+    // a sender and a receiver both finding the mutex held pair off in the array
+    pthread_t pids[8];
+    for (size_t attempt = 0; attempt < 20 && channel_exchanges(channel) == 0; attempt++) {
+        queued_sender_args sender = {channel, 42, OTHER_ERROR};
+        queued_sender_args receiver = {channel, 0, OTHER_ERROR};
+        pthread_mutex_lock(&channel->mutex);
+        pthread_create(&pids[0], NULL, queued_sender, &sender);
+        pthread_create(&pids[1], NULL, queued_receiver, &receiver);
+        usleep(20000);
+        pthread_mutex_unlock(&channel->mutex);
+        pthread_join(pids[0], NULL);
+        pthread_join(pids[1], NULL);
+        mu_assert("test_elimination: Message lost", sender.status == SUCCESS && receiver.status == SUCCESS && receiver.value == 42);
+    }
+    mu_assert("test_elimination: Contended pair never met", channel_exchanges(channel) > 0);
+    mu_assert("test_elimination: Exchanged message buffered", channel_depth(channel) == 0);
+
+    // every message is delivered exactly once, through the array or the ring
+    size_t per_thread = 5000;
+    size_t* seen[4];
+    eliminate_args args[8];
+    for (size_t i = 0; i < 4; i++) {
+        seen[i] = calloc(4 * per_thread, sizeof(size_t));
+        args[i] = (eliminate_args){channel, i * per_thread, per_thread, NULL};
+        args[4 + i] = (eliminate_args){channel, 0, per_thread, seen[i]};
+    }
+    for (size_t i = 0; i < 8; i++) {
+        pthread_create(&pids[i], NULL, (i < 4) ? eliminate_sender : eliminate_receiver, &args[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    bool once = true;
+    for (size_t value = 0; value < 4 * per_thread; value++) {
+        once = once && (seen[0][value] + seen[1][value] + seen[2][value] + seen[3][value] == 1);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        free(seen[i]);
+    }
+    mu_assert("test_elimination: Message lost or duplicated", once && channel_depth(channel) == 0);
+
+    // close stops the exchanges too
+    channel_close(channel);
+    void* data = NULL;
+    mu_assert("test_elimination: Receive after close", channel_receive(channel, &data, true) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+char* test_combining() {
+    print_test_details(__func__, "Testing flat combining of sends and receives");
+    chan_t* channel = channel_create(4);
+    mu_assert("test_combining: Combining not enabled", channel_set_combining(channel, true) == SUCCESS);
+    mu_assert("test_combining: Queued order allowed with combining", channel_set_wake_order(channel, CHAN_WAKE_FIFO) == OTHER_ERROR);
+    mu_assert("test_combining: Elimination allowed with combining", channel_set_elimination(channel, 4) == OTHER_ERROR);
+
+    // sends published while the mutex is held are applied together, in the order they were published
+    pthread_t pids[8];
+    queued_sender_args senders[3];
+    pthread_mutex_lock(&channel->mutex);
+    for (size_t i = 0; i < 3; i++) {
+        senders[i] = (queued_sender_args){channel, i, OTHER_ERROR};
+        pthread_create(&pids[i], NULL, queued_sender, &senders[i]);
+        usleep(5000);
+    }
+    // the senders sleep until a thread leaving the mutex applies their requests, the raw unlock here does not, channel_depth does
+    pthread_mutex_unlock(&channel->mutex);
+    channel_depth(channel);
+    for (size_t i = 0; i < 3; i++) {
+        pthread_join(pids[i], NULL);
+        mu_assert("test_combining: Send not completed", senders[i].status == SUCCESS);
+    }
+    mu_assert("test_combining: Sends not combined", channel_combined(channel) >= 2);
+    void* data = NULL;
+    for (size_t i = 0; i < 3; i++) {
+        mu_assert("test_combining: Sends applied out of order", channel_receive(channel, &data, false) == SUCCESS && (size_t)data == i);
+    }
+
+    // calls that cannot complete behave as without combining
+    mu_assert("test_combining: Receive from empty channel", channel_receive(channel, &data, false) == WOULDBLOCK);
+    for (size_t i = 0; i < 4; i++) {
+        channel_send(channel, (void*)i, false);
+    }
+    mu_assert("test_combining: Send to full channel", channel_send(channel, (void*)4, false) == WOULDBLOCK);
+    queued_sender_args blocked = {channel, 4, OTHER_ERROR};
+    pthread_create(&pids[0], NULL, queued_sender, &blocked);
+    usleep(10000);
+    channel_receive(channel, &data, true);
+    pthread_join(pids[0], NULL);
+    mu_assert("test_combining: Blocked send not completed", blocked.status == SUCCESS && channel_depth(channel) == 4);
+    for (size_t i = 0; i < 4; i++) {
+        channel_receive(channel, &data, true);
+    }
+
+    // every message is delivered exactly once
+    size_t per_thread = 5000;
+    size_t* seen[4];
+    eliminate_args args[8];
+    for (size_t i = 0; i < 4; i++) {
+        seen[i] = calloc(4 * per_thread, sizeof(size_t));
+        args[i] = (eliminate_args){channel, i * per_thread, per_thread, NULL};
+        args[4 + i] = (eliminate_args){channel, 0, per_thread, seen[i]};
+    }
+    for (size_t i = 0; i < 8; i++) {
+        pthread_create(&pids[i], NULL, (i < 4) ? eliminate_sender : eliminate_receiver, &args[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    bool once = true;
+    for (size_t value = 0; value < 4 * per_thread; value++) {
+        once = once && (seen[0][value] + seen[1][value] + seen[2][value] + seen[3][value] == 1);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        free(seen[i]);
+    }
+    mu_assert("test_combining: Message lost or duplicated", once && channel_depth(channel) == 0);
+
+    // batches take their turn among single sends and receives, in order within a batch
+    void* batch[4] = {(void*)1, (void*)2, (void*)3, (void*)4};
+    size_t count = 0;
+    mu_assert("test_combining: Batch send failed", channel_send_batch(channel, batch, 4, false, &count) == SUCCESS && count == 4);
+    mu_assert("test_combining: Batch send to full channel", channel_send_batch(channel, batch, 1, false, &count) == WOULDBLOCK && count == 0);
+    mu_assert("test_combining: Batch receive failed", channel_receive_batch(channel, batch, 3, true, &count) == SUCCESS && count == 3);
+    mu_assert("test_combining: Batch received out of order", batch[0] == (void*)1 && batch[1] == (void*)2 && batch[2] == (void*)3);
+    mu_assert("test_combining: Timed receive failed", channel_receive_timeout(channel, &data, 1000000) == SUCCESS && data == (void*)4);
+    mu_assert("test_combining: Timed receive from empty channel", channel_receive_timeout(channel, &data, 1000000) == WOULDBLOCK);
+    for (size_t i = 0; i < 4; i++) {
+        seen[i] = calloc(4 * per_thread, sizeof(size_t));
+        args[i] = (eliminate_args){channel, i * per_thread, per_thread, NULL};
+        args[4 + i] = (eliminate_args){channel, 0, per_thread, seen[i]};
+    }
+    for (size_t i = 0; i < 8; i++) {
+        bool batched = (i % 2 == 1);
+        void* (*run)(void*) = (i < 4) ? (batched ? eliminate_batch_sender : eliminate_sender) :
+                                        (batched ? eliminate_batch_receiver : eliminate_receiver);
+        pthread_create(&pids[i], NULL, run, &args[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        pthread_join(pids[i], NULL);
+    }
+    once = true;
+    for (size_t value = 0; value < 4 * per_thread; value++) {
+        once = once && (seen[0][value] + seen[1][value] + seen[2][value] + seen[3][value] == 1);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        free(seen[i]);
+    }
+    mu_assert("test_combining: Batched message lost or duplicated", once && channel_depth(channel) == 0);
+
+    // closing completes a request published meanwhile
+    queued_sender_args parked = {channel, 0, OTHER_ERROR};
+    for (size_t i = 0; i < 4; i++) {
+        channel_send(channel, (void*)i, false);
+    }
+    pthread_mutex_lock(&channel->mutex);
+    pthread_create(&pids[0], NULL, queued_sender, &parked);
+    usleep(10000);
+    pthread_mutex_unlock(&channel->mutex);
+    channel_close(channel);
+    pthread_join(pids[0], NULL);
+    mu_assert("test_combining: Published send not closed", parked.status == CLOSED_ERROR);
+    mu_assert("test_combining: Send after close", channel_send(channel, NULL, true) == CLOSED_ERROR);
+    mu_assert("test_combining: Receive after close", channel_receive(channel, &data, true) == CLOSED_ERROR);
+    channel_destroy(channel);
+    return NULL;
+}
+
+char* test_stress_send_recv_hops() {
+    print_test_details(__func__, "Stress Testing send/recv for a fixed number of hops");
+    size_t sizes[] = {1, 4};
+    size_t threads[] = {4, 8, 16};
+    for (size_t b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+        for (size_t n = 0; n < sizeof(threads) / sizeof(threads[0]); n++) {
+            // run_stress_send_recv_hops asserts every hop was made
+            uint64_t elapsed = run_stress_send_recv_hops(sizes[b], threads[n], 0.5, 20000);
+            mu_assert("test_stress_send_recv_hops: No time elapsed", elapsed > 0);
+        }
+    }
+    // fewer hops than messages leaves some messages with none
+    run_stress_send_recv_hops(4, 8, 0.75, 7);
+    run_stress_send_recv_hops(4, 8, 0.75, 0);
+    return NULL;
+}
+
 char* test_stress_send_recv_buffered() {
     print_test_details(__func__, "Stress Testing send/recv for buffered version (takes around 10 seconds)");
     run_stress_send_recv(1, 4, 0.25, 1000000);
@@ -2032,6 +3803,34 @@ test_t tests[] = {{"test_initialization", test_initialization},
                   {"test_select_with_send_receive_on_same_channel_buffered", test_select_with_send_receive_on_same_channel_buffered},
                   {"test_select_with_duplicate_channel_buffered", test_select_with_duplicate_channel_buffered},
                   {"test_stress_buffered", test_stress_buffered},
+                  {"test_stress_deep_buffered", test_stress_deep_buffered},
+                  {"test_stress_report", test_stress_report},
+                  {"test_vector_pool", test_vector_pool},
+                  {"test_distance_vector_encoding", test_distance_vector_encoding},
+                  {"test_stress_compact_vectors", test_stress_compact_vectors},
+                  {"test_stress_route_modes", test_stress_route_modes},
+                  {"test_stress_link_state", test_stress_link_state},
+                  {"test_partition_graph", test_partition_graph},
+                  {"test_stress_partitioned", test_stress_partitioned},
+                  {"test_stress_send_recv_hops", test_stress_send_recv_hops},
+                  {"test_receive_timeout", test_receive_timeout},
+                  {"test_worker_pool", test_worker_pool},
+                  {"test_pipeline", test_pipeline},
+                  {"test_send_batch", test_send_batch},
+                  {"test_send_buffer", test_send_buffer},
+                  {"test_wake_policy", test_wake_policy},
+                  {"test_timer_channels", test_timer_channels},
+                  {"test_merge", test_merge},
+                  {"test_budget", test_budget},
+                  {"test_typed_channel", test_typed_channel},
+                  {"test_inline_try", test_inline_try},
+                  {"test_large_buffer", test_large_buffer},
+                  {"test_arena", test_arena},
+                  {"test_select_waiters", test_select_waiters},
+                  {"test_wake_order_fifo", test_wake_order_fifo},
+                  {"test_wake_order_lifo", test_wake_order_lifo},
+                  {"test_elimination", test_elimination},
+                  {"test_combining", test_combining},
                   {"test_select_response_time", test_select_response_time},
                   {"test_cpu_utilization_select", test_cpu_utilization_select},
                   {"test_for_basic_global_declaration", test_for_basic_global_declaration},
@@ -0,0 +1,133 @@
+// Smoke test of the C++ channel wrapper, also checking that the C headers compile as C++
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "channel.hpp"
+#include "channel_inline.h"
+
+#define mu_str_(text) #text
+#define mu_str(text) mu_str_(text)
+#define mu_assert(message, test) do { if (!(test)) return "FAILURE: See " __FILE__ " Line " mu_str(__LINE__) ": " message; } while (0)
+#define mu_run_test(test) do { const char* message = test; tests_run++; \
+                                if (message) return message; } while (0)
+
+static int tests_run = 0;
+
+// Sends 1..count from each producer and checks that the consumers receive every value once
+template <class P>
+static const char* test_send_receive(std::size_t producers, std::size_t consumers)
+{
+    const std::size_t count = 5000;
+    chan::Channel<std::unique_ptr<std::size_t>, 8, P> channel;
+    std::atomic<std::size_t> sum{0};
+    std::atomic<std::size_t> received{0};
+    std::atomic<std::size_t> failures{0};
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&] {
+            for (std::size_t i = 1; i <= count; i++) {
+                if (channel.send(std::unique_ptr<std::size_t>(new std::size_t(i))) != SUCCESS) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (std::size_t c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            std::unique_ptr<std::size_t> value;
+            while (received.fetch_add(1) < producers * count) {
+                if (channel.receive(value) != SUCCESS) {
+                    failures++;
+                    return;
+                }
+                sum += *value;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    mu_assert("test_send_receive: Send or receive failed", failures == 0);
+    mu_assert("test_send_receive: Values lost or duplicated", sum == producers * count * (count + 1) / 2);
+    return NULL;
+}
+
+static const char* test_try_send()
+{
+    chan::Channel<std::string, 4> channel;
+    std::string value = "x";
+    for (int i = 0; i < 4; i++) {
+        mu_assert("test_try_send: Send to a channel with room failed", channel.try_send(value) == SUCCESS);
+    }
+    std::string kept = "kept";
+    mu_assert("test_try_send: Send to a full channel did not block", channel.try_send(std::move(kept)) == WOULDBLOCK);
+    mu_assert("test_try_send: Failed send moved its argument", kept == "kept");
+    std::string out;
+    mu_assert("test_try_send: Receive failed", channel.try_receive(out) == SUCCESS && out == "x");
+    return NULL;
+}
+
+static const char* test_select()
+{
+    chan::Channel<int, 4> typed;
+    chan_t* plain = channel_create(1);
+    select_t list[] = {{plain, false, NULL}, {typed.select_handle(), false, NULL}};
+    std::size_t index = 0;
+    std::thread sender([&] { typed.send(42); });
+    mu_assert("test_select: Select failed", channel_select(2, list, &index) == SUCCESS);
+    mu_assert("test_select: Select picked the wrong channel", index == 1);
+    int value = 0;
+    mu_assert("test_select: Receive after select failed", typed.receive(value) == SUCCESS && value == 42);
+    sender.join();
+    // the C fast paths work from C++ too
+    mu_assert("test_select: Inline send failed", channel_try_send(plain, &value) == SUCCESS);
+    void* out = NULL;
+    mu_assert("test_select: Inline receive failed", channel_try_receive(plain, &out) == SUCCESS && out == &value);
+    typed.close();
+    mu_assert("test_select: Select did not report the close", channel_select(2, list, &index) == CLOSED_ERROR && index == 1);
+    channel_close(plain);
+    channel_destroy(plain);
+    return NULL;
+}
+
+static const char* test_close()
+{
+    chan::Channel<std::unique_ptr<int>, 2, chan::SPSC> channel;
+    enum chan_status status = SUCCESS;
+    std::thread receiver([&] {
+        std::unique_ptr<int> value;
+        status = channel.receive(value);
+    });
+    mu_assert("test_close: Close failed", channel.close() == SUCCESS);
+    receiver.join();
+    mu_assert("test_close: Blocked receive not closed", status == CLOSED_ERROR);
+    mu_assert("test_close: Send after close succeeded", channel.send(std::unique_ptr<int>(new int(1))) == CLOSED_ERROR);
+    mu_assert("test_close: Closed twice", channel.close() == CLOSED_ERROR);
+    return NULL;
+}
+
+static const char* all_tests()
+{
+    mu_run_test(test_send_receive<chan::SPSC>(1, 1));
+    mu_run_test(test_send_receive<chan::MPSC>(3, 1));
+    mu_run_test(test_send_receive<chan::MPMC>(3, 3));
+    mu_run_test(test_send_receive<chan::MPMCSpin>(2, 2));
+    mu_run_test(test_try_send());
+    mu_run_test(test_select());
+    mu_run_test(test_close());
+    return NULL;
+}
+
+int main()
+{
+    const char* result = all_tests();
+    if (result != NULL) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != NULL;
+}
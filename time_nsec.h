@@ -0,0 +1,15 @@
+#ifndef TIME_NSEC_H
+#define TIME_NSEC_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Returns the CLOCK_MONOTONIC time in nanoseconds, the clock every deadline and timeout here is measured on
+static inline uint64_t monotonic_nsec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+#endif // TIME_NSEC_H
@@ -0,0 +1,367 @@
+#include <assert.h>
+#include <time.h>
+#include "timer.h"
+#include "time_nsec.h"
+
+// The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots, each level's slot spanning a full turn of the level below
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+typedef struct wheel_timer {
+    chan_t* channel; // Channel the timer delivers to
+    uint64_t expires; // Tick the timer fires on
+    uint64_t period; // Ticks between firings of a ticker, 0 for one-shot timers
+    size_t fired; // Number of times the timer fired
+    bool pending; // Whether the timer is linked into a slot
+    size_t level; // Level and slot the timer is linked into while pending
+    size_t slot;
+    struct wheel_timer* prev; // Links in the slot's list
+    struct wheel_timer* next;
+} wheel_timer_t;
+
+typedef struct {
+    pthread_mutex_t mutex; // Mutex protecting everything below
+    pthread_cond_t condition; // Wakes the wheel thread when an earlier timer is added
+    wheel_timer_t* slots[TIMER_LEVELS][TIMER_SLOTS]; // Pending timers by level and slot
+    uint64_t current; // Last tick processed
+    uint64_t wake; // Tick the wheel thread sleeps until, 0 while it sleeps without limit
+    size_t pending; // Number of pending timers
+    wheel_timer_t** table; // Open addressing table finding the timer of a channel
+    size_t table_capacity; // Allocated length of table, a power of two
+    size_t table_count; // Number of entries in table
+} timer_wheel_t;
+
+static timer_wheel_t wheel;
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_tick()
+{
+    return monotonic_nsec() / TIMER_TICK_NSEC;
+}
+
+static size_t table_index(chan_t* channel, size_t capacity)
+{
+    uintptr_t key = (uintptr_t)channel;
+    key ^= key >> 17;
+    key *= 0x9e3779b97f4a7c15ull;
+    return (size_t)(key >> 7) & (capacity - 1);
+}
+
+// Adds timer to the channel lookup table, growing it to keep at most half of it in use
+// Must be called with the wheel's mutex held
+static void table_insert(wheel_timer_t* timer)
+{
+    if ((wheel.table_count + 1) * 2 > wheel.table_capacity) {
+        size_t capacity = (wheel.table_capacity == 0) ? 64 : wheel.table_capacity * 2;
+        wheel_timer_t** table = calloc(capacity, sizeof(wheel_timer_t*));
+        assert(table != NULL);
+        for (size_t i = 0; i < wheel.table_capacity; i++) {
+            if (wheel.table[i] != NULL) {
+                size_t index = table_index(wheel.table[i]->channel, capacity);
+                while (table[index] != NULL) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                table[index] = wheel.table[i];
+            }
+        }
+        free(wheel.table);
+        wheel.table = table;
+        wheel.table_capacity = capacity;
+    }
+    size_t index = table_index(timer->channel, wheel.table_capacity);
+    while (wheel.table[index] != NULL) {
+        index = (index + 1) & (wheel.table_capacity - 1);
+    }
+    wheel.table[index] = timer;
+    wheel.table_count++;
+}
+
+// Removes and returns the timer of channel from the lookup table, NULL if there is none
+// Must be called with the wheel's mutex held
+static wheel_timer_t* table_remove(chan_t* channel)
+{
+    if (wheel.table_capacity == 0) {
+        return NULL;
+    }
+    size_t mask = wheel.table_capacity - 1;
+    size_t index = table_index(channel, wheel.table_capacity);
+    while (wheel.table[index] != NULL && wheel.table[index]->channel != channel) {
+        index = (index + 1) & mask;
+    }
+    wheel_timer_t* timer = wheel.table[index];
+    if (timer == NULL) {
+        return NULL;
+    }
+    // shift back the entries that probed past the removed one
+    size_t hole = index;
+    for (size_t next = (hole + 1) & mask; wheel.table[next] != NULL; next = (next + 1) & mask) {
+        size_t home = table_index(wheel.table[next]->channel, wheel.table_capacity);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            wheel.table[hole] = wheel.table[next];
+            hole = next;
+        }
+    }
+    wheel.table[hole] = NULL;
+    wheel.table_count--;
+    return timer;
+}
+
+// Links timer into the slot matching how far away it expires
+// Must be called with the wheel's mutex held
+static void wheel_link(wheel_timer_t* timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires <= wheel.current) {
+        // already due, fire on the next tick
+        expires = wheel.current + 1;
+    }
+    uint64_t delta = expires - wheel.current;
+    size_t level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ull << (TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    uint64_t max_delta = 1ull << (TIMER_SLOT_BITS * TIMER_LEVELS);
+    if (delta >= max_delta) {
+        // too far for the wheel, park it in the furthest slot and place it again once that comes around
+        expires = wheel.current + max_delta - 1;
+    }
+    size_t slot = (size_t)(expires >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+    timer->prev = NULL;
+    timer->next = wheel.slots[level][slot];
+    if (timer->next != NULL) {
+        timer->next->prev = timer;
+    }
+    wheel.slots[level][slot] = timer;
+    timer->pending = true;
+    timer->level = level;
+    timer->slot = slot;
+    wheel.pending++;
+}
+
+// Unlinks timer from its slot
+// Must be called with the wheel's mutex held
+static void wheel_unlink(wheel_timer_t* timer)
+{
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel.slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->pending = false;
+    wheel.pending--;
+}
+
+// Delivers a timer's message and schedules its next firing if it is a ticker
+// Must be called with the wheel's mutex held
+static void wheel_fire(wheel_timer_t* timer)
+{
+    timer->fired++;
+    // never block the wheel: a ticker whose last tick was not received yet skips this one
+    channel_send(timer->channel, (void*)timer->fired, false);
+    if (timer->period > 0) {
+        timer->expires += timer->period;
+        wheel_link(timer);
+    }
+}
+
+// Advances the wheel by one tick, firing the timers that are due and cascading the higher levels
+// Must be called with the wheel's mutex held
+static void wheel_advance()
+{
+    wheel.current++;
+    // when a level wraps around, spread the timers of the level above over the levels below
+    for (size_t level = 1; level < TIMER_LEVELS; level++) {
+        if ((wheel.current & ((1ull << (TIMER_SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        size_t slot = (size_t)(wheel.current >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+        wheel_timer_t* timer = wheel.slots[level][slot];
+        wheel.slots[level][slot] = NULL;
+        while (timer != NULL) {
+            wheel_timer_t* next = timer->next;
+            timer->pending = false;
+            wheel.pending--;
+            if (timer->expires <= wheel.current) {
+                wheel_fire(timer);
+            } else {
+                wheel_link(timer);
+            }
+            timer = next;
+        }
+    }
+    size_t slot = (size_t)wheel.current & TIMER_SLOT_MASK;
+    wheel_timer_t* timer = wheel.slots[0][slot];
+    wheel.slots[0][slot] = NULL;
+    while (timer != NULL) {
+        wheel_timer_t* next = timer->next;
+        timer->pending = false;
+        wheel.pending--;
+        if (timer->expires <= wheel.current) {
+            wheel_fire(timer);
+        } else {
+            // parked in the furthest slot, not due yet
+            wheel_link(timer);
+        }
+        timer = next;
+    }
+}
+
+// Returns the next tick the wheel thread has to wake up on, 0 if no timer is pending
+// Must be called with the wheel's mutex held
+static uint64_t wheel_next_tick()
+{
+    if (wheel.pending == 0) {
+        return 0;
+    }
+    // the first busy slot of the lowest level, or the next time the lowest level wraps and cascades
+    for (uint64_t tick = wheel.current + 1; tick <= (wheel.current | TIMER_SLOT_MASK); tick++) {
+        if (wheel.slots[0][tick & TIMER_SLOT_MASK] != NULL) {
+            return tick;
+        }
+    }
+    return (wheel.current | TIMER_SLOT_MASK) + 1;
+}
+
+static void* wheel_main(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&wheel.mutex);
+    while (true) {
+        uint64_t now = now_tick();
+        if (wheel.pending == 0) {
+            // nothing to catch up on
+            wheel.current = now;
+        }
+        while (wheel.current < now) {
+            wheel_advance();
+        }
+        wheel.wake = wheel_next_tick();
+        if (wheel.wake == 0) {
+            pthread_cond_wait(&wheel.condition, &wheel.mutex);
+        } else {
+            uint64_t wake_nsec = wheel.wake * TIMER_TICK_NSEC;
+            struct timespec deadline;
+            deadline.tv_sec = (time_t)(wake_nsec / 1000000000ull);
+            deadline.tv_nsec = (long)(wake_nsec % 1000000000ull);
+            pthread_cond_timedwait(&wheel.condition, &wheel.mutex, &deadline);
+        }
+    }
+    return NULL;
+}
+
+static void wheel_init()
+{
+    pthread_mutex_init(&wheel.mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel.condition, &attr);
+    pthread_condattr_destroy(&attr);
+    wheel.current = now_tick();
+    wheel.wake = 0;
+    wheel.pending = 0;
+    wheel.table = NULL;
+    wheel.table_capacity = 0;
+    wheel.table_count = 0;
+    pthread_t pid;
+    int pthread_status = pthread_create(&pid, NULL, wheel_main, NULL);
+    assert(pthread_status == 0);
+    pthread_detach(pid);
+}
+
+// Creates a timer firing after duration_nsec and then every period_nsec if that is not 0
+static chan_t* timer_create_channel(uint64_t duration_nsec, uint64_t period_nsec)
+{
+    pthread_once(&wheel_once, wheel_init);
+    wheel_timer_t* timer = malloc(sizeof(wheel_timer_t));
+    if (timer == NULL) {
+        return NULL;
+    }
+    timer->channel = channel_create(1);
+    if (timer->channel == NULL) {
+        free(timer);
+        return NULL;
+    }
+    timer->period = (period_nsec + TIMER_TICK_NSEC - 1) / TIMER_TICK_NSEC;
+    if (period_nsec > 0 && timer->period == 0) {
+        timer->period = 1;
+    }
+    timer->fired = 0;
+    pthread_mutex_lock(&wheel.mutex);
+    // round up, a timer never fires early
+    uint64_t now_nsec = monotonic_nsec();
+    timer->expires = (now_nsec + duration_nsec + TIMER_TICK_NSEC - 1) / TIMER_TICK_NSEC;
+    if (wheel.pending == 0) {
+        // the wheel thread may not have caught up while idle
+        wheel.current = now_nsec / TIMER_TICK_NSEC;
+    }
+    wheel_link(timer);
+    table_insert(timer);
+    if (wheel.wake == 0 || timer->expires < wheel.wake) {
+        // the wheel thread sleeps past this timer
+        pthread_cond_signal(&wheel.condition);
+    }
+    pthread_mutex_unlock(&wheel.mutex);
+    return timer->channel;
+}
+
+// Returns a channel that receives one message, (void*)1, once duration_nsec has passed
+// The channel works with channel_receive and channel_select like any other, and must be released with channel_timer_stop
+// All timers are driven by a single timer wheel thread, started on first use
+// Returns NULL if the timer could not be created
+chan_t* channel_after(uint64_t duration_nsec)
+{
+    return timer_create_channel(duration_nsec, 0);
+}
+
+// Returns a channel that receives a message every period_nsec, carrying the tick's number starting at 1
+// Ticks are dropped rather than queued while the previous one has not been received
+// The channel must be released with channel_timer_stop
+// Returns NULL if period_nsec is 0 or the timer could not be created
+chan_t* channel_ticker(uint64_t period_nsec)
+{
+    if (period_nsec == 0) {
+        return NULL; // Taking invalid arguments
+    }
+    return timer_create_channel(period_nsec, period_nsec);
+}
+
+// Cancels the timer if it has not fired yet, then closes and destroys its channel
+// Must be called once for every timer channel, after every thread is done with the channel
+// Returns SUCCESS, or OTHER_ERROR if channel is not a timer channel
+enum chan_status channel_timer_stop(chan_t* channel)
+{
+    if (channel == NULL) {
+        return OTHER_ERROR; // Taking invalid arguments
+    }
+    pthread_once(&wheel_once, wheel_init);
+    pthread_mutex_lock(&wheel.mutex);
+    wheel_timer_t* timer = table_remove(channel);
+    if (timer == NULL) {
+        pthread_mutex_unlock(&wheel.mutex);
+        return OTHER_ERROR;
+    }
+    if (timer->pending) {
+        wheel_unlink(timer);
+    }
+    pthread_mutex_unlock(&wheel.mutex);
+    channel_close(channel);
+    channel_destroy(channel);
+    free(timer);
+    return SUCCESS;
+}
+
+// Returns the number of timers in the wheel that have not fired yet (tickers always count)
+size_t timer_pending_count()
+{
+    pthread_once(&wheel_once, wheel_init);
+    pthread_mutex_lock(&wheel.mutex);
+    size_t pending = wheel.pending;
+    pthread_mutex_unlock(&wheel.mutex);
+    return pending;
+}
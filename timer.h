@@ -0,0 +1,31 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "channel.h"
+
+// Resolution of the timer wheel, timer durations are rounded up to a whole number of ticks
+#define TIMER_TICK_NSEC 1000000ull
+
+// Returns a channel that receives one message, (void*)1, once duration_nsec has passed
+// The channel works with channel_receive and channel_select like any other, and must be released with channel_timer_stop
+// All timers are driven by a single timer wheel thread, started on first use
+// Returns NULL if the timer could not be created
+chan_t* channel_after(uint64_t duration_nsec);
+
+// Returns a channel that receives a message every period_nsec, carrying the tick's number starting at 1
+// Ticks are dropped rather than queued while the previous one has not been received
+// The channel must be released with channel_timer_stop
+// Returns NULL if period_nsec is 0 or the timer could not be created
+chan_t* channel_ticker(uint64_t period_nsec);
+
+// Cancels the timer if it has not fired yet, then closes and destroys its channel
+// Must be called once for every timer channel, after every thread is done with the channel
+// Returns SUCCESS, or OTHER_ERROR if channel is not a timer channel
+enum chan_status channel_timer_stop(chan_t* channel);
+
+// Returns the number of timers in the wheel that have not fired yet (tickers always count)
+size_t timer_pending_count();
+
+#endif // TIMER_H
@@ -0,0 +1,195 @@
+#ifndef TYPED_CHANNEL_H
+#define TYPED_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "channel.h"
+#include "channel_inline.h"
+
+// Generates a channel of fixed capacity storing values of type inline, without a heap payload per message:
+//
+//   DEFINE_CHANNEL(point_channel, struct point, 16)
+//
+// defines point_channel_t and these static inline functions, which behave like their chan_t counterparts:
+//   enum chan_status point_channel_init(point_channel_t* channel)
+//   enum chan_status point_channel_send(point_channel_t* channel, struct point value)
+//   enum chan_status point_channel_try_send(point_channel_t* channel, struct point value)
+//   enum chan_status point_channel_receive(point_channel_t* channel, struct point* value)
+//   enum chan_status point_channel_try_receive(point_channel_t* channel, struct point* value)
+//   enum chan_status point_channel_close(point_channel_t* channel)
+//   void point_channel_destroy(point_channel_t* channel)
+//   chan_t* point_channel_select_handle(point_channel_t* channel)
+//
+// The values live in the struct's own array of capacity slots, used as a ring under one mutex, with blocked senders and
+// receivers parked on condition variables like a chan_t's. init allocates nothing and a send or receive takes the mutex once
+// For channel_select, put the select handle in the select list as a RECV entry. Like chan::Channel's, it is a chan_t carrying a
+// token while the channel holds values, created on the first call; sends and receives only pay for the token after that.
+// Once select picks it, call try_receive, which may still return WOULDBLOCK if another receiver was faster. Select reports
+// CLOSED_ERROR once the channel is closed
+// DEFINE_CHANNEL_TYPE and DEFINE_CHANNEL_FUNCTIONS generate the two halves separately, e.g. the type in a header
+
+#define DEFINE_CHANNEL_TYPE(name, type, capacity)                                                                       \
+    typedef struct {                                                                                                    \
+        pthread_mutex_t mutex; /* Mutex protecting the fields below */                                                  \
+        pthread_cond_t send_condition; /* Signalled when a slot is freed */                                             \
+        pthread_cond_t receive_condition; /* Signalled when a value is added */                                         \
+        bool closed;                                                                                                    \
+        size_t head; /* Slot of the oldest value */                                                                     \
+        size_t count; /* Number of values held */                                                                       \
+        chan_t* ready; /* Token channel handed to channel_select, NULL until select_handle is first called */           \
+        type slots[capacity]; /* Ring of the values held, count of them from head on */                                 \
+    } name##_t;
+
+#define DEFINE_CHANNEL_FUNCTIONS(name, type, capacity)                                                                  \
+    _Static_assert((capacity) > 0, #name ": channel capacity must be positive");                                        \
+                                                                                                                        \
+    /* Returns SUCCESS, nothing is allocated */                                                                         \
+    static inline enum chan_status name##_init(name##_t* channel)                                                       \
+    {                                                                                                                   \
+        pthread_mutex_init(&channel->mutex, NULL);                                                                      \
+        pthread_cond_init(&channel->send_condition, NULL);                                                              \
+        pthread_cond_init(&channel->receive_condition, NULL);                                                           \
+        channel->closed = false;                                                                                        \
+        channel->head = 0;                                                                                              \
+        channel->count = 0;                                                                                             \
+        channel->ready = NULL;                                                                                          \
+        return SUCCESS;                                                                                                 \
+    }                                                                                                                   \
+                                                                                                                        \
+    /* Adds value behind the others and wakes a receiver, there must be room */                                         \
+    /* Must be called with the mutex held */                                                                            \
+    static inline void name##_put(name##_t* channel, type value)                                                        \
+    {                                                                                                                   \
+        size_t pos = channel->head + channel->count;                                                                    \
+        channel->slots[(pos >= (capacity)) ? pos - (capacity) : pos] = value;                                           \
+        channel->count++;                                                                                               \
+        if (channel->count == 1 && channel->ready != NULL) {                                                            \
+            channel_try_send(channel->ready, NULL);                                                                     \
+        }                                                                                                               \
+        pthread_cond_signal(&channel->receive_condition);                                                               \
+    }                                                                                                                   \
+                                                                                                                        \
+    /* Moves the oldest value into value and wakes a sender, there must be one */                                       \
+    /* Must be called with the mutex held */                                                                            \
+    static inline void name##_take(name##_t* channel, type* value)                                                      \
+    {                                                                                                                   \
+        *value = channel->slots[channel->head];                                                                         \
+        channel->head = (channel->head + 1 == (capacity)) ? 0 : channel->head + 1;                                      \
+        channel->count--;                                                                                               \
+        if (channel->ready != NULL) {                                                                                   \
+            void* token = NULL;                                                                                         \
+            if (channel->count == 0) {                                                                                  \
+                channel_try_receive(channel->ready, &token);                                                            \
+            } else {                                                                                                    \
+                /* select may have taken the token for this value, keep one for the rest */                             \
+                channel_try_send(channel->ready, NULL);                                                                 \
+            }                                                                                                           \
+        }                                                                                                               \
+        pthread_cond_signal(&channel->send_condition);                                                                  \
+    }                                                                                                                   \
+                                                                                                                        \
+    static inline enum chan_status name##_send(name##_t* channel, type value)                                           \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        while (!channel->closed && channel->count == (capacity)) {                                                      \
+            pthread_cond_wait(&channel->send_condition, &channel->mutex);                                               \
+        }                                                                                                               \
+        if (channel->closed) {                                                                                          \
+            pthread_mutex_unlock(&channel->mutex);                                                                      \
+            return CLOSED_ERROR;                                                                                        \
+        }                                                                                                               \
+        name##_put(channel, value);                                                                                     \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return SUCCESS;                                                                                                 \
+    }                                                                                                                   \
+                                                                                                                        \
+    static inline enum chan_status name##_try_send(name##_t* channel, type value)                                       \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        enum chan_status status = channel->closed ? CLOSED_ERROR : (channel->count == (capacity)) ? WOULDBLOCK : SUCCESS;\
+        if (status == SUCCESS) {                                                                                        \
+            name##_put(channel, value);                                                                                 \
+        }                                                                                                               \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return status;                                                                                                  \
+    }                                                                                                                   \
+                                                                                                                        \
+    static inline enum chan_status name##_receive(name##_t* channel, type* value)                                       \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        while (!channel->closed && channel->count == 0) {                                                               \
+            pthread_cond_wait(&channel->receive_condition, &channel->mutex);                                            \
+        }                                                                                                               \
+        if (channel->closed) {                                                                                          \
+            pthread_mutex_unlock(&channel->mutex);                                                                      \
+            return CLOSED_ERROR;                                                                                        \
+        }                                                                                                               \
+        name##_take(channel, value);                                                                                    \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return SUCCESS;                                                                                                 \
+    }                                                                                                                   \
+                                                                                                                        \
+    static inline enum chan_status name##_try_receive(name##_t* channel, type* value)                                   \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        enum chan_status status = channel->closed ? CLOSED_ERROR : (channel->count == 0) ? WOULDBLOCK : SUCCESS;        \
+        if (status == SUCCESS) {                                                                                        \
+            name##_take(channel, value);                                                                                \
+        }                                                                                                               \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return status;                                                                                                  \
+    }                                                                                                                   \
+                                                                                                                        \
+    /* Wakes every blocked call, and select through the token channel */                                                \
+    static inline enum chan_status name##_close(name##_t* channel)                                                      \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        if (channel->closed) {                                                                                          \
+            pthread_mutex_unlock(&channel->mutex);                                                                      \
+            return CLOSED_ERROR;                                                                                        \
+        }                                                                                                               \
+        channel->closed = true;                                                                                         \
+        if (channel->ready != NULL) {                                                                                   \
+            channel_close(channel->ready);                                                                              \
+        }                                                                                                               \
+        pthread_cond_broadcast(&channel->send_condition);                                                               \
+        pthread_cond_broadcast(&channel->receive_condition);                                                            \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return SUCCESS;                                                                                                 \
+    }                                                                                                                   \
+                                                                                                                        \
+    /* No other thread may use the channel anymore */                                                                   \
+    static inline void name##_destroy(name##_t* channel)                                                                \
+    {                                                                                                                   \
+        name##_close(channel);                                                                                          \
+        if (channel->ready != NULL) {                                                                                   \
+            channel_destroy(channel->ready);                                                                            \
+        }                                                                                                               \
+        pthread_mutex_destroy(&channel->mutex);                                                                         \
+        pthread_cond_destroy(&channel->send_condition);                                                                 \
+        pthread_cond_destroy(&channel->receive_condition);                                                              \
+    }                                                                                                                   \
+                                                                                                                        \
+    /* Returns NULL if the token channel could not be created */                                                        \
+    static inline chan_t* name##_select_handle(name##_t* channel)                                                       \
+    {                                                                                                                   \
+        pthread_mutex_lock(&channel->mutex);                                                                            \
+        if (channel->ready == NULL) {                                                                                   \
+            channel->ready = channel_create(1);                                                                         \
+            if (channel->ready != NULL && channel->closed) {                                                            \
+                channel_close(channel->ready);                                                                          \
+            } else if (channel->ready != NULL && channel->count > 0) {                                                  \
+                channel_try_send(channel->ready, NULL);                                                                 \
+            }                                                                                                           \
+        }                                                                                                               \
+        chan_t* ready = channel->ready;                                                                                 \
+        pthread_mutex_unlock(&channel->mutex);                                                                          \
+        return ready;                                                                                                   \
+    }
+
+#define DEFINE_CHANNEL(name, type, capacity)                                                                            \
+    DEFINE_CHANNEL_TYPE(name, type, capacity)                                                                           \
+    DEFINE_CHANNEL_FUNCTIONS(name, type, capacity)
+
+#endif // TYPED_CHANNEL_H
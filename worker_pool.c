@@ -0,0 +1,209 @@
+#include <assert.h>
+#include "worker_pool.h"
+#include "time_nsec.h"
+
+// Joins the workers that have exited so far
+// Must be called without the pool's mutex held, joining waits for the workers to finish exiting
+static void join_exited(worker_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pthread_t* exited = pool->exited;
+    size_t num_exited = pool->num_exited;
+    pool->exited = NULL;
+    pool->num_exited = 0;
+    pool->exited_capacity = 0;
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 0; i < num_exited; i++) {
+        pthread_join(exited[i], NULL);
+    }
+    free(exited);
+}
+
+// Records that the calling worker, no longer counted in workers, is exiting so that it gets joined later
+// Must be called with the pool's mutex held
+static void worker_exit(worker_pool_t* pool)
+{
+    if (pool->num_exited == pool->exited_capacity) {
+        pool->exited_capacity = (pool->exited_capacity == 0) ? 4 : pool->exited_capacity * 2;
+        pool->exited = realloc(pool->exited, sizeof(pthread_t) * pool->exited_capacity);
+        assert(pool->exited != NULL);
+    }
+    pool->exited[pool->num_exited++] = pthread_self();
+    pool->threads--;
+    pthread_cond_signal(&pool->exit_condition);
+}
+
+static void* worker_main(void* arg)
+{
+    worker_pool_t* pool = arg;
+    while (true) {
+        void* data = NULL;
+        enum chan_status status = channel_receive_timeout(pool->channel, &data, pool->options.linger_nsec);
+        if (status == SUCCESS) {
+            atomic_store(&pool->last_receive_nsec, monotonic_nsec());
+            pool->handler(data, pool->arg);
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        if (status == WOULDBLOCK && pool->workers <= pool->options.min_workers) {
+            // needed even when idle, keep waiting
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+        if (status == WOULDBLOCK) {
+            // idle for the linger period, retire
+            // a send made before we stopped being counted may have seen no need for a new worker,
+            // so check once more for a message now that sends see us gone
+            pool->workers--;
+            pthread_mutex_unlock(&pool->mutex);
+            status = channel_receive(pool->channel, &data, false);
+            pthread_mutex_lock(&pool->mutex);
+            if (status == SUCCESS) {
+                pool->workers++;
+                pthread_mutex_unlock(&pool->mutex);
+                atomic_store(&pool->last_receive_nsec, monotonic_nsec());
+                pool->handler(data, pool->arg);
+                continue;
+            }
+            pool->retired++;
+        } else {
+            // the channel is closed
+            pool->workers--;
+        }
+        worker_exit(pool);
+        pthread_mutex_unlock(&pool->mutex);
+        return NULL;
+    }
+}
+
+// Counts a worker that is about to be started in workers
+// Must be called with the pool's mutex held
+static void reserve_worker(worker_pool_t* pool)
+{
+    pool->workers++;
+    pool->pending++;
+    if (pool->workers > pool->peak_workers) {
+        pool->peak_workers = pool->workers;
+    }
+    atomic_store(&pool->last_receive_nsec, monotonic_nsec());
+}
+
+// Starts the workers reserved so far, after reaping workers that exited since the last start
+// Must be called without the pool's mutex held
+static void start_workers(worker_pool_t* pool)
+{
+    join_exited(pool);
+    pthread_mutex_lock(&pool->mutex);
+    for (; pool->pending > 0; pool->pending--) {
+        pthread_t pid;
+        if (pthread_create(&pid, NULL, worker_main, pool) != 0) {
+            pool->workers--;
+            continue;
+        }
+        pool->threads++;
+        pool->started++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Send hook deciding from the channel's depth whether another worker is needed
+// The decision is made with the channel locked, the worker is started once it is unlocked
+static bool pool_send_hook(void* arg, size_t depth, bool unlocked)
+{
+    worker_pool_t* pool = arg;
+    if (unlocked) {
+        start_workers(pool);
+        return false;
+    }
+    bool needed = false;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->workers < pool->options.max_workers) {
+        needed = (pool->workers == 0) || (depth > pool->options.depth_per_worker * pool->workers);
+        if (!needed && pool->options.max_wait_nsec > 0 && depth > 1) {
+            // messages have been queued for a while without the workers taking any
+            needed = (monotonic_nsec() - atomic_load(&pool->last_receive_nsec) > pool->options.max_wait_nsec);
+        }
+        if (needed) {
+            reserve_worker(pool);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return needed;
+}
+
+// Fills options with defaults: 0 to 4 workers, one more worker per 4 queued messages, 1 ms max wait and 10 ms linger
+void worker_pool_options_init(worker_pool_options_t* options)
+{
+    options->min_workers = 0;
+    options->max_workers = 4;
+    options->depth_per_worker = 4;
+    options->max_wait_nsec = 1000000;
+    options->linger_nsec = 10000000;
+}
+
+// Creates a pool consuming channel with handler and starts its min_workers workers
+// Returns NULL if the pool could not be created
+worker_pool_t* worker_pool_create(chan_t* channel, const worker_pool_options_t* options, worker_handler_t handler, void* arg)
+{
+    if (channel == NULL || options == NULL || handler == NULL || options->max_workers == 0 ||
+        options->min_workers > options->max_workers) {
+        return NULL; // Taking invalid arguments
+    }
+    worker_pool_t* pool = malloc(sizeof(worker_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->channel = channel;
+    pool->handler = handler;
+    pool->arg = arg;
+    pool->options = *options;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->exit_condition, NULL);
+    pool->workers = 0;
+    pool->threads = 0;
+    pool->peak_workers = 0;
+    pool->started = 0;
+    pool->retired = 0;
+    pool->pending = 0;
+    pool->exited = NULL;
+    pool->num_exited = 0;
+    pool->exited_capacity = 0;
+    atomic_init(&pool->last_receive_nsec, monotonic_nsec());
+    pthread_mutex_lock(&pool->mutex);
+    for (size_t i = 0; i < options->min_workers; i++) {
+        reserve_worker(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    start_workers(pool);
+    // from now on every send checks whether the pool should grow
+    channel_set_send_hook(channel, pool_send_hook, pool);
+    return pool;
+}
+
+// Fills stats with the pool's current counters
+void worker_pool_stats(worker_pool_t* pool, worker_pool_stats_t* stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+    stats->workers = pool->workers;
+    stats->peak_workers = pool->peak_workers;
+    stats->started = pool->started;
+    stats->retired = pool->retired;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Waits for every worker to exit and frees the pool
+// The channel must have been closed, messages still buffered in it are not handled
+void worker_pool_destroy(worker_pool_t* pool)
+{
+    // no send may start a worker once we are waiting for them to exit
+    channel_set_send_hook(pool->channel, NULL, NULL);
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->threads > 0) {
+        pthread_cond_wait(&pool->exit_condition, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    join_exited(pool);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->exit_condition);
+    free(pool);
+}
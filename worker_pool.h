@@ -0,0 +1,67 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+
+// Called by a pool worker for every message it receives from the pool's channel
+typedef void (*worker_handler_t)(void* data, void* arg);
+
+// Thresholds controlling when a worker pool grows and shrinks
+typedef struct {
+    size_t min_workers; // Workers kept running even when idle
+    size_t max_workers; // Most workers the pool will run at once
+    size_t depth_per_worker; // A worker is started when the channel holds more than this many messages per running worker
+    // A worker is started when the channel has held messages this long without any being received, 0 disables
+    // Only checked when a message is sent: after the last send, messages may wait longer behind busy workers
+    uint64_t max_wait_nsec;
+    uint64_t linger_nsec; // A worker above min_workers retires after waiting this long for a message
+} worker_pool_options_t;
+
+// Counters describing how a pool scaled
+typedef struct {
+    size_t workers; // Workers currently running
+    size_t peak_workers; // Most workers running at once
+    size_t started; // Workers started since the pool was created
+    size_t retired; // Workers that retired after lingering idle
+} worker_pool_stats_t;
+
+// Pool of consumer threads reading one channel, scaled by the channel's send hook rather than a polling thread
+// The hook decides with the channel locked and starts workers (reaping exited ones) only once the sender has unlocked it
+typedef struct {
+    chan_t* channel; // Channel the workers receive from
+    worker_handler_t handler; // Called for every message received
+    void* arg; // Argument passed to handler
+    worker_pool_options_t options;
+    pthread_mutex_t mutex; // Mutex protecting the fields below
+    pthread_cond_t exit_condition; // Signalled whenever a worker exits
+    size_t workers; // Workers running, including ones being started and excluding ones retiring
+    size_t threads; // Worker threads that have not recorded their exit yet, including retiring ones
+    size_t peak_workers; // Most workers running at once
+    size_t started; // Workers started since the pool was created
+    size_t retired; // Workers that retired after lingering idle
+    size_t pending; // Workers counted in workers that the send hook has yet to start once the channel is unlocked
+    pthread_t* exited; // Workers that exited but have not been joined yet
+    size_t num_exited; // Number of entries in exited
+    size_t exited_capacity; // Allocated length of exited
+    atomic_uint_least64_t last_receive_nsec; // When a worker last received a message (or was started)
+} worker_pool_t;
+
+// Fills options with defaults: 0 to 4 workers, one more worker per 4 queued messages, 1 ms max wait and 10 ms linger
+void worker_pool_options_init(worker_pool_options_t* options);
+
+// Creates a pool consuming channel with handler and starts its min_workers workers
+// Returns NULL if the pool could not be created
+worker_pool_t* worker_pool_create(chan_t* channel, const worker_pool_options_t* options, worker_handler_t handler, void* arg);
+
+// Fills stats with the pool's current counters
+void worker_pool_stats(worker_pool_t* pool, worker_pool_stats_t* stats);
+
+// Waits for every worker to exit and frees the pool
+// The channel must have been closed, messages still buffered in it are not handled
+void worker_pool_destroy(worker_pool_t* pool);
+
+#endif // WORKER_POOL_H